@@ -8,16 +8,23 @@ CONFIG += c++14
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+include(engine.pri)
+
 SOURCES += \
-    src\calculations.cpp \
+    src\beams_item.cpp \
+    src\curve_plot.cpp \
     src\filesystem.cpp \
-    src\geometry.cpp \
+    src\histogram_plot.cpp \
     src\interface.cpp \
+    src\slices_plot.cpp \
     main.cpp
 
 HEADERS += \
-    include\geometry.h \
-    include\mainwindow.h
+    include\beams_item.h \
+    include\curve_plot.h \
+    include\histogram_plot.h \
+    include\mainwindow.h \
+    include\slices_plot.h
 
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
@@ -0,0 +1,15 @@
+QT       += core
+QT       -= gui
+
+CONFIG += c++14 console
+CONFIG -= app_bundle
+
+TARGET = focon-bench
+
+include(..\engine.pri)
+
+# Fixtures and golden values are read from the source tree by default
+DEFINES += BENCH_DIR=\\\"$$PWD\\\"
+
+SOURCES += \
+    main.cpp
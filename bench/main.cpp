@@ -0,0 +1,527 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QRegularExpression>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <functional>
+#include <cmath>
+#include "..\include\model.h"
+#include "..\include\reference.h"
+
+namespace {
+
+QTextStream& out() {
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+QTextStream& err() {
+    static QTextStream stream(stderr);
+    return stream;
+}
+
+// Macro benchmark modes, named as in the command-line tool
+const QVector<QPair<QString, Mode>> modes = {
+    {"parallel", PARALLEL_BUNDLE},
+    {"exhaustive", EXHAUSTIVE_SAMPLING},
+    {"monte-carlo", MONTE_CARLO_METHOD},
+    {"length", LENGTH_OPTIMISATION},
+    {"d-out", D_OUT_OPTIMISATION},
+    {"focus", FOCUS_OPTIMISATION}
+};
+
+const QStringList fixtures = {"tube", "cone", "inverted_cone", "glass", "glass_cavity"};
+
+// Inputs of the micro benchmarks: beams entering the cone's entrance window at up to 30 degrees
+QVector<Beam> entering_beams(qreal radius, int count) {
+    QRandomGenerator generator(1);
+    QVector<Beam> beams;
+    beams.reserve(count);
+    while (beams.size() < count) {
+        qreal x = (2 * generator.generateDouble() - 1) * radius;
+        qreal y = (2 * generator.generateDouble() - 1) * radius;
+        if (x*x + y*y >= radius * radius) continue;
+        qreal gamma = qDegreesToRadians(30 * generator.generateDouble());
+        qreal psi = 2 * M_PI * generator.generateDouble();
+        beams.push_back(Beam(Point(x, y, 0), qSin(gamma) * qCos(psi), qSin(gamma) * qSin(psi), qCos(gamma)));
+    }
+    return beams;
+}
+
+// Runs the loop over all the inputs several times and keeps the fastest pass, so that a single
+// preemption does not spoil the figure. The loop returns a checksum to keep it from being optimised out.
+QJsonObject micro(const QString& name, int operations, int repeat, const std::function<qreal()>& loop) {
+    qint64 best = -1;
+    qreal checksum = 0;
+    for (int i = 0; i < repeat; ++i) {
+        QElapsedTimer timer;
+        timer.start();
+        checksum += loop();
+        qint64 elapsed = timer.nsecsElapsed();
+        if (best < 0 || elapsed < best) best = elapsed;
+    }
+    qreal ns = static_cast<qreal>(best) / operations;
+    err() << name << ": " << ns << " нс\n";
+    err().flush();
+    return {
+             {"name", name},
+             {"operations", operations},
+             {"ns_per_op", ns},
+             {"ops_per_s", ns > 0 ? QJsonValue(1e9 / ns) : QJsonValue()},
+             {"checksum", checksum}
+           };
+}
+
+QJsonArray micro_benchmarks(int count, int repeat) {
+    Cone cone(25, 5, 50);
+    Tube tube(25, 50);
+    Lens lens(50);
+    Plane plane(0);
+    const QVector<Beam> beams = entering_beams(cone.r1(), count);
+    QJsonArray results;
+
+    results.append(micro("Cone::intersection", count, repeat, [&]() {
+        qreal sum = 0;
+        for (const auto& beam : beams) {
+            sum += cone.intersection(beam).z();
+        }
+        return sum;
+    }));
+    results.append(micro("Tube::intersection", count, repeat, [&]() {
+        qreal sum = 0;
+        for (const auto& beam : beams) {
+            sum += tube.intersection(beam).z();
+        }
+        return sum;
+    }));
+    results.append(micro("Plane::refracted", count, repeat, [&]() {
+        qreal sum = 0;
+        for (const auto& beam : beams) {
+            sum += plane.refracted(beam, 1, 1.5).d_z();
+        }
+        return sum;
+    }));
+    results.append(micro("Lens::refracted", count, repeat, [&]() {
+        qreal sum = 0;
+        for (const auto& beam : beams) {
+            sum += lens.refracted(beam).d_z();
+        }
+        return sum;
+    }));
+    results.append(micro("Matrix*Beam", count, repeat, [&]() {
+        qreal sum = 0;
+        for (int i = 0; i < beams.size(); ++i) {
+            Matrix m(i * 0.001, cone.phi());
+            sum += (m.transponed() * (m * beams[i])).d_z();
+        }
+        return sum;
+    }));
+
+    // The full trace goes through the model in batches of a single chunk, so it runs in one thread
+    Settings settings;
+    Model model(settings);
+    const int batch = 1000;
+    QVector<double> rays;
+    rays.reserve(5 * beams.size());
+    for (const auto& beam : beams) {
+        rays << beam.x() << beam.y() << beam.d_x() << beam.d_y() << beam.d_z();
+    }
+    QVector<quint8> statuses(beams.size());
+    results.append(micro("trace", count, repeat, [&]() {
+        qreal sum = 0;
+        for (int begin = 0; begin < beams.size(); begin += batch) {
+            int size = qMin(batch, beams.size() - begin);
+            sum += model.trace_batch(rays.constData() + 5 * begin, size, statuses.data() + begin);
+        }
+        return sum;
+    }));
+    return results;
+}
+
+// Compares Cone::intersection with the reference on random beams inside narrowing, widening and cavity cones.
+// Half of the beams start on the surface going inwards as after a reflection, the rest start inside the cone.
+QJsonObject validate_intersections(int count) {
+    struct Case { QString name; qreal d1, d2, length, z; };
+    const QVector<Case> cases = {
+        {"narrowing", 25, 5, 50, 0},
+        {"widening", 10, 20, 40, 0},
+        {"cavity", 0, 8, 10, 50}
+    };
+    QRandomGenerator generator(1);
+    QJsonArray results;
+    int total_mismatches = 0;
+    for (const auto& test : cases) {
+        Cone cone(test.d1, test.d2, test.length, test.z);
+        reference::Cone<long double> reference_cone(cone.r1(), cone.r2(), test.length, test.z);
+        const qreal scale = qMax(qMax(cone.r1(), cone.r2()), cone.length());
+        int mismatches = 0, failures = 0;
+        qreal max_error = 0;
+        for (int i = 0; i < count; ++i) {
+            qreal z = test.z + generator.generateDouble() * test.length;
+            qreal r = cone.r1() + (cone.r2() - cone.r1()) * (z - test.z) / test.length;
+            bool on_surface = generator.generateDouble() < 0.5;
+            if (!on_surface) r *= qSqrt(generator.generateDouble());
+            qreal angle = 2 * M_PI * generator.generateDouble();
+            qreal gamma = 0.49 * M_PI * generator.generateDouble();
+            qreal psi = 2 * M_PI * generator.generateDouble();
+            qreal d_z = generator.generateDouble() < 0.3 ? -qCos(gamma) : qCos(gamma);
+            reference::Beam<long double> reference_beam(reference::Point<long double>(r * qCos(angle), r * qSin(angle), z),
+                                                        reference::Vector<long double>(qSin(gamma) * qCos(psi), qSin(gamma) * qSin(psi), d_z));
+            reference::Vector<long double> normal = reference_cone.normal(reference_beam.p);
+            long double cos_in = reference_beam.v.dot(normal);
+            if (on_surface && cos_in < 0) {
+                reference_beam.v = reference::Vector<long double>(reference_beam.v - normal * (2 * cos_in));
+            }
+            Beam beam(Point(reference_beam.p.x, reference_beam.p.y, reference_beam.p.z),
+                      reference_beam.v.x, reference_beam.v.y, reference_beam.v.z);
+
+            IntersectionStatus status;
+            Point p = cone.intersection(beam, &status);
+            if (status != INTERSECTION_FOUND) {
+                ++failures;
+                continue;
+            }
+            reference_beam = reference::Beam<long double>(reference::Point<long double>(beam.x(), beam.y(), beam.z()),
+                                                          reference::Vector<long double>(beam.d_x(), beam.d_y(), beam.d_z()));
+            long double t;
+            bool reference_hit = reference_cone.intersection(reference_beam, t, true) && reference_cone.contains(reference_beam.at(t).z);
+            bool hit = p.z() >= test.z && p.z() <= test.z + test.length;
+            if (hit != reference_hit) {
+                ++mismatches;
+            } else if (hit) {
+                reference::Point<long double> r = reference_beam.at(t);
+                qreal error = qSqrt(static_cast<qreal>((p.x() - r.x)*(p.x() - r.x) + (p.y() - r.y)*(p.y() - r.y) + (p.z() - r.z)*(p.z() - r.z)));
+                max_error = qMax(max_error, error / scale);
+                if (error > 1e-6 * scale) ++mismatches;
+            }
+        }
+        total_mismatches += mismatches;
+        err() << "Cone::intersection/" << test.name << ": расхождений " << mismatches << ", отказов " << failures
+              << ", максимальная ошибка " << max_error << "\n";
+        err().flush();
+        results.append(QJsonObject({
+                           {"case", test.name},
+                           {"beams", count},
+                           {"mismatches", mismatches},
+                           {"failures", failures},
+                           {"max_relative_error", max_error}
+                       }));
+    }
+    return {{"cases", results}, {"mismatches", total_mismatches}};
+}
+
+// Differential test of the engine against the reference tracer on random beams entering the focon at up to 40 degrees.
+// Disagreements of the beams that pass within the tolerance from a decision boundary (an aperture's edge, the FOV,
+// total internal reflection) are expected from the rounding and are reported apart from the rest
+template <typename T>
+QJsonObject fuzz(Model& model, int count, quint64 seed) {
+    const qreal radius = model.focon()->r1();
+    QRandomGenerator generator(seed);
+    QVector<double> rays;
+    rays.reserve(5 * count);
+    for (int i = 0; i < count; ++i) {
+        qreal r = radius * qSqrt(generator.generateDouble()) * (1 - 1e-6);
+        qreal angle = 2 * M_PI * generator.generateDouble();
+        qreal gamma = qAcos(1 - (1 - qCos(qDegreesToRadians(40.0))) * generator.generateDouble());
+        qreal psi = 2 * M_PI * generator.generateDouble();
+        rays << r * qCos(angle) << r * qSin(angle) << qSin(gamma) * qCos(psi) << qSin(gamma) * qSin(psi) << qCos(gamma);
+    }
+    QVector<quint8> statuses(count);
+    QVector<double> exits(6 * count);
+    model.trace_batch(rays.constData(), count, statuses.data(), exits.data());
+
+    const reference::Tracer<T> tracer(model);
+    QVector<reference::Result<T>> results(count);
+    QVector<int> chunks;
+    for (int begin = 0; begin < count; begin += 1000) chunks << begin;
+    QtConcurrent::blockingMap(chunks, [&](int begin) {
+        for (int i = begin; i < qMin(begin + 1000, count); ++i) {
+            results[i] = tracer.trace(rays.constData() + 5 * i);
+        }
+    });
+
+    const qreal boundary = 1e-6, direction_tolerance = 1e-6;
+    QVector<QVector<qint64>> matrix(BEAM_STATUSES, QVector<qint64>(BEAM_STATUSES, 0));
+    qint64 disagreements = 0, boundary_disagreements = 0, direction_mismatches = 0;
+    qreal max_direction_error = 0;
+    QJsonArray samples;
+    for (int i = 0; i < count; ++i) {
+        const auto& result = results[i];
+        int status = statuses[i];
+        if (status >= BEAM_STATUSES) continue;     // Rays rejected at the entrance
+        ++matrix[status][result.status];
+        if (status != result.status) {
+            if (result.margin < boundary) {
+                ++boundary_disagreements;
+                continue;
+            }
+            ++disagreements;
+        } else if (!is_failure(result.status)) {
+            const double * exit = exits.constData() + 6 * i;
+            qreal error = qSqrt(static_cast<qreal>((exit[3] - result.direction.x) * (exit[3] - result.direction.x)
+                                                   + (exit[4] - result.direction.y) * (exit[4] - result.direction.y)
+                                                   + (exit[5] - result.direction.z) * (exit[5] - result.direction.z)));
+            max_direction_error = qMax(max_direction_error, error);
+            if (error <= direction_tolerance) continue;
+            ++direction_mismatches;
+        } else continue;
+        if (samples.size() < failure_samples_limit) {
+            const double * ray = rays.constData() + 5 * i;
+            samples.append(QJsonObject({
+                               {"ray", QJsonArray({ray[0], ray[1], ray[2], ray[3], ray[4]})},
+                               {"status", status},
+                               {"reference_status", result.status},
+                               {"reference_reflections", result.reflections},
+                               {"margin", static_cast<double>(result.margin)}
+                           }));
+        }
+    }
+    QJsonArray stored_matrix;
+    for (const auto& row : matrix) {
+        QJsonArray stored_row;
+        for (qint64 value : row) stored_row.append(static_cast<double>(value));
+        stored_matrix.append(stored_row);
+    }
+    return {
+             {"beams", count},
+             {"disagreements", static_cast<double>(disagreements)},
+             {"boundary_disagreements", static_cast<double>(boundary_disagreements)},
+             {"direction_mismatches", static_cast<double>(direction_mismatches)},
+             {"max_direction_error", max_direction_error},
+             {"statuses", stored_matrix},
+             {"samples", samples}
+           };
+}
+
+bool load_fixture(const QString& path, QJsonObject& json_file) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) return false;
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll());
+    json_file = doc.object();
+    return doc.isObject();
+}
+
+// Values compared against the golden ones: the counts of the bundle and sampling modes
+// are exact thanks to the deterministic seeding, the losses are compared within the tolerance
+QJsonObject outcome(const Model::Result& result, Mode mode) {
+    if (is_optimisation(mode)) {
+        const auto& parameters = result.parameters;
+        QJsonObject values = {{"loss", parameters.loss}};
+        if (parameters.length > 0) values.insert("length", parameters.length);
+        if (parameters.d_out > 0) values.insert("d_out", parameters.d_out);
+        if (parameters.focus > 0) values.insert("focus", parameters.focus);
+        return values;
+    }
+    return {
+             {"loss", result.counts.first > 0 ? QJsonValue(Model::loss(result.counts)) : QJsonValue()},
+             {"passed", result.counts.first},
+             {"total", result.counts.second}
+           };
+}
+
+// Status of the run against its golden values: ok, mismatch or missing
+QString compare(const QJsonObject& values, const QJsonObject& golden, qreal tolerance, QJsonValue& error) {
+    if (golden.value("loss").isUndefined() || golden.value("loss").isNull()) return "missing";
+    bool match = true;
+    for (auto it = golden.constBegin(); it != golden.constEnd(); ++it) {
+        QJsonValue value = values.value(it.key());
+        if (it.key() == "loss") {
+            if (!value.isDouble()) return "mismatch";
+            error = value.toDouble() - it.value().toDouble();
+            match = match && qFabs(error.toDouble()) <= tolerance;
+        } else {
+            match = match && value == it.value();
+        }
+    }
+    return match ? "ok" : "mismatch";
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("focon-bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Измерение производительности расчёта фокона и проверка результатов по эталонным значениям.");
+    parser.addHelpOption();
+    QCommandLineOption fixtures_option("fixtures", "Папка с файлами настроек тестовых фоконов.", "dir", QString(BENCH_DIR) + "/fixtures");
+    QCommandLineOption golden_option("golden", "Файл эталонных значений.", "file", QString(BENCH_DIR) + "/golden.json");
+    QCommandLineOption update_option("update-golden", "Сохранить полученные значения как эталонные.");
+    QCommandLineOption filter_option("filter", "Рассчитывать только случаи, имена которых (фокон/режим) соответствуют выражению.", "regexp");
+    QCommandLineOption tolerance_option("tolerance", "Допустимое отклонение потерь от эталона, дБ.", "dB", "1e-9");
+    QCommandLineOption threads_option("threads", "Количество потоков.", "count");
+    QCommandLineOption beams_option("micro-beams", "Количество лучей в микротестах.", "count", "100000");
+    QCommandLineOption repeat_option("repeat", "Количество повторов микротестов.", "count", "5");
+    QCommandLineOption validation_option("validation-beams", "Количество случайных лучей для проверки пересечений с конусом (0 — без проверки).", "count", "1000000");
+    QCommandLineOption fuzz_option("fuzz-beams", "Количество случайных лучей для сравнения расчёта каждого фокона с эталонным трассировщиком (0 — без сравнения).", "count", "0");
+    QCommandLineOption fuzz_precision_option("fuzz-precision", "Точность эталонного трассировщика: long (long double) или quad (__float128, при сборке с CONFIG+=quadmath).", "precision", "long");
+    QCommandLineOption no_micro_option("no-micro", "Не выполнять микротесты.");
+    QCommandLineOption no_macro_option("no-macro", "Не выполнять расчёты режимов.");
+    QCommandLineOption output_option(QStringList() << "o" << "output", "Файл для сохранения результата.", "file");
+    parser.addOptions({fixtures_option, golden_option, update_option, filter_option, tolerance_option, threads_option,
+                       beams_option, repeat_option, validation_option, fuzz_option, fuzz_precision_option,
+                       no_micro_option, no_macro_option, output_option});
+    parser.process(app);
+
+    if (parser.isSet(threads_option)) {
+        int threads = parser.value(threads_option).toInt();
+        if (threads <= 0) {
+            err() << "Некорректное количество потоков: " << parser.value(threads_option) << "\n";
+            return 1;
+        }
+        QThreadPool::globalInstance()->setMaxThreadCount(threads);
+    }
+    QRegularExpression filter(parser.value(filter_option));
+    if (!filter.isValid()) {
+        err() << "Некорректное выражение: " << parser.value(filter_option) << "\n";
+        return 1;
+    }
+    qreal tolerance = parser.value(tolerance_option).toDouble();
+    int micro_beams = qMax(1000, parser.value(beams_option).toInt());
+    int repeat = qMax(1, parser.value(repeat_option).toInt());
+    int validation_beams = qMax(0, parser.value(validation_option).toInt());
+    int fuzz_beams = qMax(0, parser.value(fuzz_option).toInt());
+    QString fuzz_precision = parser.value(fuzz_precision_option);
+#ifdef FOCON_QUADMATH
+    bool precision_available = fuzz_precision == "long" || fuzz_precision == "quad";
+#else
+    bool precision_available = fuzz_precision == "long";
+#endif
+    if (!precision_available) {
+        err() << "Точность эталонного трассировщика недоступна: " << fuzz_precision << "\n";
+        return 1;
+    }
+
+    QJsonObject golden;
+    QFile golden_file(parser.value(golden_option));
+    if (golden_file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        golden = QJsonDocument::fromJson(golden_file.readAll()).object();
+        golden_file.close();
+    }
+
+    QJsonObject report = {{"threads", QThreadPool::globalInstance()->maxThreadCount()}};
+    if (!parser.isSet(no_micro_option)) {
+        report.insert("micro", micro_benchmarks(micro_beams, repeat));
+    }
+
+    int mismatches = 0;
+    if (validation_beams > 0) {
+        QJsonObject validation = validate_intersections(validation_beams);
+        mismatches += validation.value("mismatches").toInt();
+        report.insert("validation", validation);
+    }
+
+    QJsonArray macro;
+    QDir fixtures_dir(parser.value(fixtures_option));
+    for (const auto& fixture : fixtures) {
+        if (parser.isSet(no_macro_option)) break;
+        QJsonObject json_file;
+        if (!load_fixture(fixtures_dir.filePath(fixture + ".foc"), json_file)) {
+            err() << "Не удалось загрузить файл " << fixtures_dir.filePath(fixture + ".foc") << "\n";
+            return 1;
+        }
+        for (const auto& mode : modes) {
+            QString name = fixture + "/" + mode.first;
+            if (!filter.match(name).hasMatch()) continue;
+            QJsonObject case_file = json_file;
+            case_file.insert("Mode", mode.second);
+            if (mode.second == FOCUS_OPTIMISATION) {
+                // The focus is optimised for the entrance lens, which is not used with glass focons
+                if (case_file.value("Glass").toBool()) continue;
+                case_file.insert("Lens", true);
+            }
+            Settings settings = Settings::from_json(case_file);
+            Model model(settings);
+            Model::Result result = model.run();
+
+            QJsonObject values = outcome(result, mode.second);
+            QJsonValue error;
+            QString status = result.failed ? "failed"
+                                           : compare(values, golden.value(name).toObject(), tolerance, error);
+            // A case without a golden value is not checked at all, so it fails unless the values are being updated
+            if (status == "mismatch" || status == "failed" || (status == "missing" && !parser.isSet(update_option))) ++mismatches;
+            if (parser.isSet(update_option) && !result.failed) golden.insert(name, values);
+            err() << name << ": " << result.message << " [" << status << "]\n";
+            err().flush();
+
+            QJsonObject row = values;
+            row.insert("case", name);
+            row.insert("status", status);
+            row.insert("golden_loss", golden.value(name).toObject().value("loss"));
+            row.insert("error_db", error);
+            row.insert("beams", static_cast<double>(result.beams));
+            row.insert("elapsed_ms", static_cast<double>(result.elapsed));
+            row.insert("beams_per_s", result.elapsed > 0 ? QJsonValue(result.beams * 1000.0 / result.elapsed) : QJsonValue());
+            if (!result.performance.isEmpty()) row.insert("performance", result.performance);
+            macro.append(row);
+        }
+    }
+    if (!parser.isSet(no_macro_option)) {
+        report.insert("macro", macro);
+    }
+
+    // The engine is compared with the reference tracer in the mode of the Monte Carlo method
+    QJsonArray fuzz_cases;
+    for (int i = 0; i < fixtures.size() && fuzz_beams > 0; ++i) {
+        QString name = fixtures[i] + "/fuzz";
+        if (!filter.match(name).hasMatch()) continue;
+        QJsonObject json_file;
+        if (!load_fixture(fixtures_dir.filePath(fixtures[i] + ".foc"), json_file)) {
+            err() << "Не удалось загрузить файл " << fixtures_dir.filePath(fixtures[i] + ".foc") << "\n";
+            return 1;
+        }
+        json_file.insert("Mode", MONTE_CARLO_METHOD);
+        Model model(Settings::from_json(json_file));
+        QJsonObject row;
+#ifdef FOCON_QUADMATH
+        if (fuzz_precision == "quad") {
+            row = fuzz<__float128>(model, fuzz_beams, i + 1);
+        } else
+#endif
+        row = fuzz<long double>(model, fuzz_beams, i + 1);
+        qint64 disagreements = static_cast<qint64>(row.value("disagreements").toDouble() + row.value("direction_mismatches").toDouble());
+        mismatches += static_cast<int>(disagreements);
+        err() << name << ": расхождений " << disagreements << ", на границах " << row.value("boundary_disagreements").toDouble()
+              << ", максимальное отклонение направления " << row.value("max_direction_error").toDouble() << "\n";
+        err().flush();
+        row.insert("case", name);
+        row.insert("precision", fuzz_precision);
+        fuzz_cases.append(row);
+    }
+    if (fuzz_beams > 0) report.insert("fuzz", fuzz_cases);
+    report.insert("mismatches", mismatches);
+
+    if (parser.isSet(update_option)) {
+        if (!golden_file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+            err() << "Не удалось сохранить эталонные значения в файл " << golden_file.fileName() << "\n";
+            return 1;
+        }
+        golden_file.write(QJsonDocument(golden).toJson());
+        golden_file.close();
+    }
+
+    QByteArray json = QJsonDocument(report).toJson();
+    if (parser.isSet(output_option)) {
+        QFile file(parser.value(output_option));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+            err() << "Не удалось сохранить результат в файл " << parser.value(output_option) << "\n";
+            return 1;
+        }
+        file.write(json);
+    } else {
+        out() << json;
+        out().flush();
+    }
+    // Updating the golden values accepts the current results, so they cannot mismatch
+    return mismatches > 0 && !parser.isSet(update_option) ? 2 : 0;
+}
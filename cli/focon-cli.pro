@@ -0,0 +1,17 @@
+QT       += core
+QT       -= gui
+
+CONFIG += c++14 console
+CONFIG -= app_bundle
+
+TARGET = focon-cli
+
+include(..\engine.pri)
+
+SOURCES += \
+    main.cpp
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
@@ -0,0 +1,534 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QTextStream>
+#include <QtConcurrent>
+#include "..\include\model.h"
+
+namespace {
+
+QTextStream& out() {
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+QTextStream& err() {
+    static QTextStream stream(stderr);
+    return stream;
+}
+
+// Parameters given in the command line instead of the ones stored in the files
+struct Overrides {
+    QJsonObject values;
+    bool parse(const QCommandLineParser& parser, QString& error);
+};
+
+// Result of a single scenario file in the batch
+struct Row {
+    QString file;
+    Settings settings;
+    Model::Result result;
+    QString error;          // Loading error, the file was not calculated
+};
+
+const QStringList mode_names = {"single", "parallel", "exit", "divergent", "exhaustive", "monte-carlo",
+                                "length", "d-out", "focus", "full", "spot", "rays", "reverse", "tolerance", "sensitivity",
+                                "angle-scan", "scan"};
+
+// Names of the parameter scan's parameters in the order of SensitivityParameter
+const QStringList parameter_names = {"length", "d-out", "focus", "defocus", "cavity", "detector-offset"};
+
+bool load_settings(const QString& path, Settings& settings, QString& error, const QJsonObject& overrides = QJsonObject()) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        error = "Не удалось открыть файл " + path;
+        return false;
+    }
+    QJsonParseError parse_error;
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &parse_error);
+    file.close();
+    if (!doc.isObject()) {
+        error = "Некорректный файл настроек " + path + ": " + parse_error.errorString();
+        return false;
+    }
+    QJsonObject json_file = doc.object();
+    for (auto it = overrides.constBegin(); it != overrides.constEnd(); ++it) {
+        json_file.insert(it.key(), it.value());
+    }
+    settings = Settings::from_json(json_file);
+    settings.path = path;
+    return true;
+}
+
+bool Overrides::parse(const QCommandLineParser& parser, QString& error) {
+    if (parser.isSet("length")) {
+        bool ok = false;
+        qreal length = parser.value("length").toDouble(&ok);
+        if (!ok || length <= 0) {
+            error = "Некорректная длина фокона: " + parser.value("length");
+            return false;
+        }
+        values.insert("Length", length);
+    }
+    if (parser.isSet("mode")) {
+        // The mode can be given by its name or its number in the interface's list
+        QString text = parser.value("mode");
+        bool ok = false;
+        int mode = text.toInt(&ok);
+        if (!ok) mode = mode_names.indexOf(text);
+        if (mode < 0 || mode >= mode_names.size()) {
+            error = "Некорректный режим: " + text + ". Допустимые значения: " + mode_names.join(", ");
+            return false;
+        }
+        values.insert("Mode", mode);
+    }
+    if (parser.isSet("precision")) {
+        QString text = parser.value("precision");
+        int precision = text == "medium" || text == "0" ? 0 : text == "high" || text == "1" ? 1 : -1;
+        if (precision < 0) {
+            error = "Некорректная точность: " + text + ". Допустимые значения: medium, high";
+            return false;
+        }
+        values.insert("Precision", precision);
+    }
+    if (parser.isSet("single-precision")) {
+        values.insert("Single precision", true);
+    }
+    if (parser.isSet("energy")) {
+        values.insert("Energy", true);
+    }
+    if (parser.isSet("bands")) {
+        bool ok = false;
+        int bands = parser.value("bands").toInt(&ok);
+        if (!ok || bands < 0) {
+            error = "Некорректное число спектральных полос: " + parser.value("bands");
+            return false;
+        }
+        values.insert("Bands", bands);
+    }
+    if (parser.isSet("designs")) {
+        bool ok = false;
+        int designs = parser.value("designs").toInt(&ok);
+        if (!ok || designs <= 0) {
+            error = "Некорректное число вариантов конструкции: " + parser.value("designs");
+            return false;
+        }
+        values.insert("Designs", designs);
+    }
+    if (parser.isSet("scan")) {
+        // parameter:from:to
+        QStringList parts = parser.value("scan").split(':');
+        bool from_ok = false, to_ok = false;
+        int parameter = parameter_names.indexOf(parts.value(0));
+        qreal from = parts.value(1).toDouble(&from_ok);
+        qreal to = parts.value(2).toDouble(&to_ok);
+        if (parts.size() != 3 || parameter < 0 || !from_ok || !to_ok) {
+            error = "Некорректный диапазон сканирования: " + parser.value("scan")
+                    + ". Ожидается параметр:от:до, параметры: " + parameter_names.join(", ");
+            return false;
+        }
+        values.insert("Scan parameter", parameter);
+        values.insert("Scan start", from);
+        values.insert("Scan end", to);
+    }
+    if (parser.isSet("points")) {
+        bool ok = false;
+        int points = parser.value("points").toInt(&ok);
+        if (!ok || points < 2) {
+            error = "Некорректное число точек кривой: " + parser.value("points");
+            return false;
+        }
+        values.insert("Scan points", points);
+    }
+    if (parser.isSet("beams")) {
+        values.insert("Beam count", parser.value("beams").toDouble());
+    }
+    if (parser.isSet("rays")) {
+        // Given on the command line the path is relative to the working directory, not to the settings file
+        values.insert("Rays file", QFileInfo(parser.value("rays")).absoluteFilePath());
+    }
+    return true;
+}
+
+void print_report(const ShardResult& result) {
+    const auto& statistics = result.statistics;
+    out() << Model::results_message(statistics.passed, statistics.total, result.coverage()) << "\n";
+    out() << "Погрешность оценки потерь: ±" << statistics.loss_error() << " дБ.\n";
+    const auto& angles = statistics.exit_angles;
+    if (angles.count > 0) {
+        out() << "Выходной угол: среднее " << angles.mean << ", СКО " << angles.deviation()
+              << ", медиана " << angles.quantile(0.5) << ", P90 " << angles.quantile(0.9)
+              << ", максимум " << angles.maximum << " градусов.\n";
+    }
+    if (statistics.failed > 0) {
+        out() << "Не удалось рассчитать ход лучей: " << statistics.failed << " (" << statistics.failure_rate() * 100 << "%). Примеры:\n";
+        for (const auto& failure : statistics.failures) {
+            const Beam& beam = failure.beam;
+            out() << "  x = " << -beam.x() << ", y = " << -beam.y() << ", входной угол = " << beam.gamma()
+                  << ": " << Model::failure_name(failure.status) << "\n";
+        }
+    }
+    // The energy differs from the number of the detected beams only in the energy mode
+    if (statistics.detected_energy > 0 && statistics.detected_energy != statistics.passed) {
+        out() << "Потери энергии: " << statistics.energy_loss() << " ± " << statistics.energy_loss_error() << " дБ.\n";
+    }
+    if (statistics.bands() > 0) {
+        out() << "Потери по спектральным полосам, дБ:";
+        for (int k = 0; k < statistics.bands(); ++k) {
+            out() << (k > 0 ? "; " : " ") << k + 1 << ": " << statistics.band_loss(k);
+        }
+        out() << ".\n";
+    }
+    if (statistics.single_precision > 0) {
+        out() << "В одинарной точности рассчитано лучей: " << statistics.single_precision
+              << ", пересчитано в двойной: " << statistics.escalated << ".\n";
+    }
+    out() << "Время расчёта: " << result.elapsed / 1000.0 << " с.\n";
+    out().flush();
+}
+
+int run_shard(const QString& settings_path, const Shard& shard, const QJsonObject& overrides, QString output_path) {
+    Settings settings;
+    QString error;
+    if (!load_settings(settings_path, settings, error, overrides)) {
+        err() << error << "\n";
+        return 1;
+    }
+    if (settings.mode != EXHAUSTIVE_SAMPLING && settings.mode != MONTE_CARLO_METHOD) {
+        err() << "Разбиение на части возможно только в режимах полного перебора и метода Монте-Карло.\n";
+        return 1;
+    }
+    error = settings.glass_error();
+    if (!error.isEmpty()) {
+        err() << error << "\n";
+        return 1;
+    }
+    Model model(settings);
+    QObject::connect(&model, &Model::progress, [](const Progress& progress) {
+        err() << "\rВыполнено " << qRound(progress.done * 100) << "%";
+        err().flush();
+    }, Qt::DirectConnection);
+    ShardResult result = model.run_shard(shard);
+    err() << "\r";
+
+    if (output_path.isEmpty()) {
+        output_path = ShardResult::path_for(settings_path, shard);
+    }
+    if (!result.save(output_path)) {
+        err() << "Не удалось сохранить результат в файл " << output_path << "\n";
+        return 1;
+    }
+    out() << "Часть " << shard.to_string() << " сохранена в файл " << output_path << "\n";
+    print_report(result);
+    return 0;
+}
+
+int merge(const QStringList& paths, const QString& output_path) {
+    QVector<ShardResult> shards;
+    QString error;
+    for (const auto& path : paths) {
+        ShardResult result;
+        if (!ShardResult::load(path, result, error)) {
+            err() << error << "\n";
+            return 1;
+        }
+        shards.push_back(result);
+    }
+    ShardResult merged;
+    if (!ShardResult::merge(shards, merged, error)) {
+        err() << error << "\n";
+        return 1;
+    }
+    if (!output_path.isEmpty() && !merged.save(output_path)) {
+        err() << "Не удалось сохранить результат в файл " << output_path << "\n";
+        return 1;
+    }
+    print_report(merged);
+    return 0;
+}
+
+QString csv_field(const QString& text) {
+    if (!text.contains(',') && !text.contains('"') && !text.contains('\n')) return text;
+    return '"' + QString(text).replace('"', "\"\"") + '"';
+}
+
+QJsonObject to_json(const Row& row) {
+    const auto& result = row.result;
+    const auto& parameters = result.parameters;
+    const auto& angles = result.exit_angles;
+    bool optimisation = is_optimisation(row.settings.mode);
+    bool optimum_found = parameters.length > 0 || parameters.d_out > 0 || parameters.focus > 0;
+    QJsonValue loss;
+    if (optimisation) {
+        if (optimum_found) loss = parameters.loss;
+    } else if (row.settings.mode == REVERSE_TRACING) {
+        // The counts of the reverse beams do not give the loss without the ratio of the etendues
+        if (result.acceptance > 0) loss = Model::loss(result.acceptance);
+    } else if (result.counts.first > 0) {
+        loss = Model::loss(result.counts);
+    }
+    QString status = !row.error.isEmpty() || result.failed ? "error" : result.coverage < 1 ? "partial" : "ok";
+    QJsonArray bands;
+    for (const auto& band : result.bands) {
+        bands.append(QJsonArray({band.first, band.second}));
+    }
+    // The designs without passed beams have an infinite loss, which JSON cannot hold
+    bool tolerance = row.settings.mode == TOLERANCE_ANALYSIS && !result.design_losses.isEmpty();
+    auto design_loss = [&](qreal q) {
+        qreal value = Model::percentile(result.design_losses, q);
+        return tolerance && qIsFinite(value) ? QJsonValue(value) : QJsonValue();
+    };
+    QJsonArray sensitivities;
+    for (int i = 0; tolerance && i < result.sensitivities.size(); ++i) {
+        if (result.sensitivities[i] != 0) sensitivities.append(QJsonArray({Model::tolerance_name(i), result.sensitivities[i]}));
+    }
+    // The second derivative rather than the fit's coefficient
+    QJsonArray gradients, curvatures;
+    for (const auto& sensitivity : result.gradients) {
+        if (!sensitivity.valid) continue;
+        gradients.append(QJsonArray({Model::parameter_name(sensitivity.parameter), sensitivity.gradient}));
+        curvatures.append(QJsonArray({Model::parameter_name(sensitivity.parameter), 2 * sensitivity.curvature}));
+    }
+    return {
+             {"file", row.file},
+             {"mode", row.error.isEmpty() ? mode_names.value(row.settings.mode) : QString()},
+             {"status", status},
+             {"passed", result.counts.first},
+             {"total", result.counts.second},
+             {"loss", loss},
+             {"failures", static_cast<double>(result.failures)},
+             {"failure_rate", result.beams > 0 ? QJsonValue(static_cast<qreal>(result.failures) / result.beams) : QJsonValue()},
+             {"energy_loss", row.settings.energy && result.counts.first > 0 ? QJsonValue(result.energy_loss) : QJsonValue()},
+             {"band_losses", bands.isEmpty() ? QJsonValue() : QJsonValue(bands)},
+             {"loss_p50", design_loss(0.5)},
+             {"loss_p90", design_loss(0.9)},
+             {"loss_p99", design_loss(0.99)},
+             {"sensitivities", sensitivities.isEmpty() ? QJsonValue() : QJsonValue(sensitivities)},
+             {"gradients", gradients.isEmpty() ? QJsonValue() : QJsonValue(gradients)},
+             {"curvatures", curvatures.isEmpty() ? QJsonValue() : QJsonValue(curvatures)},
+             {"single_precision", static_cast<double>(result.single_precision_beams)},
+             {"escalated", static_cast<double>(result.escalated)},
+             {"length", parameters.length > 0 ? QJsonValue(parameters.length) : QJsonValue()},
+             {"d_out", parameters.d_out > 0 ? QJsonValue(parameters.d_out) : QJsonValue()},
+             {"focus", parameters.focus > 0 ? QJsonValue(parameters.focus) : QJsonValue()},
+             {"mean_angle", row.settings.mode == PARALLEL_BUNDLE_EXIT ? QJsonValue(result.mean_angle) : QJsonValue()},
+             {"angle_std", angles.count > 0 ? QJsonValue(angles.deviation()) : QJsonValue()},
+             {"angle_p90", angles.count > 0 ? QJsonValue(angles.quantile(0.9)) : QJsonValue()},
+             {"angle_max", angles.count > 0 ? QJsonValue(angles.maximum) : QJsonValue()},
+             {"coverage", result.coverage},
+             {"beams", static_cast<double>(result.beams)},
+             {"elapsed_ms", static_cast<double>(result.elapsed)},
+             {"beams_per_s", result.elapsed > 0 ? QJsonValue(result.beams * 1000.0 / result.elapsed) : QJsonValue()},
+             {"message", row.error.isEmpty() ? result.message : row.error}
+           };
+}
+
+QString slices_csv(const QVector<LossSlice>& slices) {
+    // One line per point of a slice, the deviations are given at the points' centres
+    QString csv = "x_parameter,y_parameter,x,y,loss\n";
+    for (const auto& slice : slices) {
+        const Histogram2D& losses = slice.losses;
+        qreal x_step = (losses.x_high() - losses.x_low()) / losses.width();
+        qreal y_step = (losses.y_high() - losses.y_low()) / losses.height();
+        for (int j = 0; j < losses.height(); ++j) {
+            for (int i = 0; i < losses.width(); ++i) {
+                qreal value = losses.value(i, j, 0);
+                csv += csv_field(Model::parameter_name(slice.x_parameter)) + "," + csv_field(Model::parameter_name(slice.y_parameter))
+                        + "," + QString::number(losses.x_low() + (i + 0.5) * x_step, 'g', 10)
+                        + "," + QString::number(losses.y_low() + (j + 0.5) * y_step, 'g', 10)
+                        + "," + (qIsFinite(value) ? QString::number(value, 'g', 10) : QString()) + "\n";
+            }
+        }
+    }
+    return csv;
+}
+
+void write_rows(const QVector<Row>& rows, bool json, QTextStream& stream) {
+    const QStringList columns = {"file", "mode", "status", "passed", "total", "loss", "failures", "failure_rate", "energy_loss",
+                                 "band_losses", "loss_p50", "loss_p90", "loss_p99", "sensitivities", "gradients", "curvatures",
+                                 "single_precision", "escalated", "length", "d_out", "focus", "mean_angle", "angle_std", "angle_p90", "angle_max", "coverage", "beams", "elapsed_ms", "beams_per_s", "message"};
+    if (json) {
+        QJsonArray array;
+        for (const auto& row : rows) {
+            // The counters of the profiling builds do not fit into a table and are given in JSON only
+            QJsonObject object = to_json(row);
+            if (!row.result.performance.isEmpty()) object.insert("performance", row.result.performance);
+            array.append(object);
+        }
+        stream << QJsonDocument(array).toJson();
+        return;
+    }
+    stream << columns.join(',') << "\n";
+    for (const auto& row : rows) {
+        QJsonObject object = to_json(row);
+        QStringList fields;
+        for (const auto& column : columns) {
+            QJsonValue value = object.value(column);
+            if (value.isArray()) {
+                // The bands, the sensitivities and the gradients are given as key:value pairs in a single field
+                QStringList items;
+                for (const auto& item : value.toArray()) {
+                    QJsonArray pair = item.toArray();
+                    QString key = pair.at(0).isString() ? pair.at(0).toString() : QString::number(pair.at(0).toDouble(), 'g', 10);
+                    items << key + ":" + QString::number(pair.at(1).toDouble(), 'g', 10);
+                }
+                fields << csv_field(items.join(';'));
+                continue;
+            }
+            fields << (value.isString() ? csv_field(value.toString())
+                                        : value.isDouble() ? QString::number(value.toDouble(), 'g', 10)
+                                                           : QString());
+        }
+        stream << fields.join(',') << "\n";
+    }
+}
+
+int run_batch(const QStringList& paths, const QJsonObject& overrides, bool json, const QString& output_path, bool record) {
+    // Every file is a separate task, so the serial modes of different files run concurrently.
+    // The models' own parallel loops share the same pool without starving it.
+    QVector<Row> rows(paths.size());
+    Row * row_data = rows.data();
+    QVector<QFuture<void>> futures;
+    for (int i = 0; i < paths.size(); ++i) {
+        futures.push_back(QtConcurrent::run(QThreadPool::globalInstance(), [&, row_data, i]() {
+            Row& row = row_data[i];
+            row.file = paths[i];
+            if (!load_settings(paths[i], row.settings, row.error, overrides)) return;
+            Model model(row.settings);
+            RayRecorder recorder;
+            if (record) {
+                QFileInfo info(paths[i]);
+                QString error;
+                if (recorder.open(info.dir().filePath(info.completeBaseName() + ".rays"), error)) {
+                    model.set_recorder(&recorder);
+                } else err() << error << "\n";
+            }
+            row.result = model.run();
+            if (recorder.is_open() && !recorder.close()) {
+                row.result.message += " Не удалось записать лучи в файл " + recorder.path() + ".";
+            }
+            // The spot diagram's distributions are too large for a row, they are saved next to the settings file
+            if (!row.result.spot.is_empty()) {
+                QFileInfo info(paths[i]);
+                QFile file(info.dir().filePath(info.completeBaseName() + ".spot.csv"));
+                if (file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+                    file.write(row.result.spot.to_csv().toUtf8());
+                }
+            }
+            if (!row.result.curve.is_empty()) {
+                QFileInfo info(paths[i]);
+                QFile file(info.dir().filePath(info.completeBaseName() + ".curve.csv"));
+                if (file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+                    file.write(row.result.curve.to_csv().toUtf8());
+                }
+            }
+            if (!row.result.slices.isEmpty()) {
+                QFileInfo info(paths[i]);
+                QFile file(info.dir().filePath(info.completeBaseName() + ".slices.csv"));
+                if (file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+                    file.write(slices_csv(row.result.slices).toUtf8());
+                }
+            }
+        }));
+    }
+    int failed = 0;
+    for (int i = 0; i < futures.size(); ++i) {
+        futures[i].waitForFinished();
+        const Row& row = rows[i];
+        bool ok = row.error.isEmpty() && !row.result.failed;
+        if (!ok) ++failed;
+        err() << "[" << i + 1 << "/" << paths.size() << "] " << row.file << ": "
+              << (row.error.isEmpty() ? row.result.message : row.error) << "\n";
+        err().flush();
+    }
+
+    if (output_path.isEmpty()) {
+        write_rows(rows, json, out());
+        out().flush();
+    } else {
+        QFile file(output_path);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+            err() << "Не удалось сохранить результат в файл " << output_path << "\n";
+            return 1;
+        }
+        QTextStream stream(&file);
+        stream.setCodec("UTF-8");
+        write_rows(rows, json, stream);
+    }
+    return failed > 0 ? 2 : 0;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("focon-cli");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Расчёт фокона без графического интерфейса. Файлы настроек рассчитываются параллельно, "
+                                     "результаты выводятся по одной строке на файл.");
+    parser.addHelpOption();
+    QCommandLineOption length_option("length", "Длина фокона, мм.", "mm");
+    QCommandLineOption mode_option("mode", "Режим: " + mode_names.join(", ") + " или его номер.", "mode");
+    QCommandLineOption precision_option("precision", "Точность: medium или high.", "precision");
+    QCommandLineOption single_precision_option("single-precision", "Рассчитывать статистику в одинарной точности, "
+                                               "пересчитывая лучи вблизи границ решения в двойной.");
+    QCommandLineOption energy_option("energy", "Учитывать потери энергии на стенках, границах стекла и при поглощении.");
+    QCommandLineOption bands_option("bands", "Число спектральных полос, для центров которых трассируется каждый луч.", "count");
+    QCommandLineOption designs_option("designs", "Число вариантов конструкции для анализа допусков.", "count");
+    QCommandLineOption scan_option("scan", "Параметр и диапазон для режима scan: " + parameter_names.join(", ")
+                                   + ", например length:20:100.", "parameter:from:to");
+    QCommandLineOption points_option("points", "Число точек кривой в режимах angle-scan и scan.", "count");
+    QCommandLineOption beams_option("beams", "Количество лучей для метода Монте-Карло.", "count");
+    QCommandLineOption format_option("format", "Формат результатов: csv или json.", "format", "csv");
+    QCommandLineOption shard_option("shard", "Рассчитать часть i из N (нумерация с 0) и сохранить её результат.", "i/N");
+    QCommandLineOption merge_option("merge", "Объединить результаты частей, заданные вместо файлов настроек.");
+    QCommandLineOption output_option(QStringList() << "o" << "output", "Файл для сохранения результата.", "file");
+    QCommandLineOption rays_option("rays", "Файл лучей для режима rays (.rays, двоичный или CSV).", "file");
+    QCommandLineOption record_option("record", "Записать все рассчитанные лучи в файл .rays рядом с файлом настроек.");
+    parser.addOptions({length_option, mode_option, precision_option, single_precision_option, energy_option, bands_option,
+                       designs_option, scan_option, points_option, beams_option, format_option, shard_option, merge_option,
+                       output_option, rays_option, record_option});
+    parser.addPositionalArgument("files", "Файлы настроек (*.foc) или, с ключом --merge, файлы частей (*.shard).");
+    parser.process(app);
+
+    const QStringList files = parser.positionalArguments();
+    if (files.isEmpty()) {
+        parser.showHelp(1);
+    }
+    if (parser.isSet(merge_option)) {
+        return merge(files, parser.value(output_option));
+    }
+
+    Overrides overrides;
+    QString error;
+    if (!overrides.parse(parser, error)) {
+        err() << error << "\n";
+        return 1;
+    }
+
+    if (parser.isSet(shard_option)) {
+        Shard shard;
+        if (!Shard::parse(parser.value(shard_option), shard)) {
+            err() << "Некорректный номер части: " << parser.value(shard_option) << "\n";
+            return 1;
+        }
+        if (files.size() != 1) {
+            err() << "Для расчёта части необходимо указать один файл настроек.\n";
+            return 1;
+        }
+        return run_shard(files.first(), shard, overrides.values, parser.value(output_option));
+    }
+
+    QString format = parser.value(format_option);
+    if (format != "csv" && format != "json") {
+        err() << "Некорректный формат: " << format << "\n";
+        return 1;
+    }
+    return run_batch(files, overrides.values, format == "json", parser.value(output_option), parser.isSet(record_option));
+}
@@ -0,0 +1,39 @@
+# Calculation engine shared by the application and the command-line tools.
+# It depends on QtCore only, so it can be used without a GUI.
+
+QT += concurrent
+
+CONFIG += c++14
+
+# Hot-path counters, reported with the results of every run: qmake CONFIG+=profiling
+profiling: DEFINES += FOCON_PROFILING
+
+# __float128 for the reference tracer (GCC only): qmake CONFIG+=quadmath
+quadmath {
+    DEFINES += FOCON_QUADMATH
+    LIBS += -lquadmath
+}
+
+SOURCES += \
+    $$PWD\src\calculations.cpp \
+    $$PWD\src\checkpoint.cpp \
+    $$PWD\src\geometry.cpp \
+    $$PWD\src\glass.cpp \
+    $$PWD\src\profiler.cpp \
+    $$PWD\src\ray_source.cpp \
+    $$PWD\src\recorder.cpp \
+    $$PWD\src\shard.cpp \
+    $$PWD\src\statistics.cpp
+
+HEADERS += \
+    $$PWD\include\budget.h \
+    $$PWD\include\checkpoint.h \
+    $$PWD\include\geometry.h \
+    $$PWD\include\glass.h \
+    $$PWD\include\model.h \
+    $$PWD\include\profiler.h \
+    $$PWD\include\ray_source.h \
+    $$PWD\include\reference.h \
+    $$PWD\include\recorder.h \
+    $$PWD\include\shard.h \
+    $$PWD\include\statistics.h
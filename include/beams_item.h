@@ -0,0 +1,45 @@
+#ifndef BEAMS_ITEM_H
+#define BEAMS_ITEM_H
+#include <QGraphicsItem>
+#include <QPainter>
+#include <QVector>
+#include <QHash>
+#include <QColor>
+#include <QLineF>
+#include "geometry.h"
+
+// Linear projection of the model's coordinates onto the scene
+struct Projection {
+    qreal xx = 1, xy = 0, xz = 0, dx = 0;   // Scene's x = xx*x + xy*y + xz*z + dx
+    qreal yx = 0, yy = 1, yz = 0, dy = 0;   // Scene's y = yx*x + yy*y + yz*z + dy
+    QPointF map(const Point& p) const { return QPointF(xx*p.x() + xy*p.y() + xz*p.z() + dx,
+                                                       yx*p.x() + yy*p.y() + yz*p.z() + dy); }
+};
+
+// All the beams' segments of a projection held in a single item.
+// Segments are kept in the model's coordinates and grouped by colour. Their projections are cached
+// and painted with one drawLines call per colour, so the scene does not have to manage an item per segment
+// and changing the projection costs a single pass over the cached vertices.
+class BeamsItem : public QGraphicsItem {
+private:
+    Projection projection;
+    QVector<QColor> colors;
+    QVector<QVector<Point>> vertices;   // Segments' ends of each colour in the model's coordinates
+    QVector<QVector<QLineF>> lines;     // Projected segments of each colour
+    QHash<QRgb, int> color_index;
+    QRectF bounds;
+    int lines_count = 0;
+
+    void include_in_bounds(const QLineF& line);
+
+public:
+    explicit BeamsItem(QGraphicsItem * parent = nullptr) : QGraphicsItem(parent) {}
+    void set_projection(const Projection& new_projection);
+    void add_segment(const Point& p1, const Point& p2, const QColor& color);
+    void clear();
+    bool is_empty() const { return lines_count == 0; }
+    QRectF boundingRect() const override;
+    void paint(QPainter * painter, const QStyleOptionGraphicsItem * option, QWidget * widget) override;
+};
+
+#endif // BEAMS_ITEM_H
@@ -0,0 +1,32 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+#include <QtGlobal>
+#include <QElapsedTimer>
+#include <atomic>
+
+// Limits of a single calculation shared by all the threads tracing its beams.
+// Cancellation is treated as an immediately exhausted budget.
+class Budget {
+private:
+    qint64 time_limit = 0;      // Wall-clock limit in ms, 0 means no limit
+    qint64 beam_limit = 0;      // Limit of traced beams, 0 means no limit
+    std::atomic<qint64> beams_traced{0};
+    std::atomic<bool> cancelled{false};
+    QElapsedTimer timer;
+
+public:
+    Budget() = default;
+    void set_limits(qint64 time, qint64 beams) { time_limit = time; beam_limit = beams; }
+    void start() { beams_traced = 0; timer.start(); }
+    void count(qint64 beams = 1) { beams_traced.fetch_add(beams, std::memory_order_relaxed); }
+    void cancel() { cancelled = true; }
+    qint64 traced() const { return beams_traced.load(std::memory_order_relaxed); }
+    qint64 elapsed() const { return timer.isValid() ? timer.elapsed() : 0; }
+    bool is_limited() const { return time_limit > 0 || beam_limit > 0; }
+    bool is_cancelled() const { return cancelled; }
+    bool exhausted() const { return cancelled
+                                    || (time_limit > 0 && elapsed() >= time_limit)
+                                    || (beam_limit > 0 && traced() >= beam_limit); }
+};
+
+#endif // BUDGET_H
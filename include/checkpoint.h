@@ -0,0 +1,34 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include <QtGlobal>
+#include <QString>
+#include <QHash>
+#include <QPair>
+#include <QElapsedTimer>
+
+// Results of already evaluated optimisation candidates stored next to the settings file.
+// The optimisers are deterministic, so replaying a run with the stored results restores
+// its whole state (iteration, best result, stagnation counters) without re-tracing anything.
+class Checkpoint {
+private:
+    QString path;
+    QString fingerprint;
+    QHash<QString, QPair<int, int>> results;
+    QElapsedTimer timer;
+    bool modified = false;
+    static constexpr qint64 save_interval = 5000;    // ms
+
+public:
+    Checkpoint() = default;
+    bool open(const QString& path, const QString& fingerprint);
+    bool is_open() const { return !path.isEmpty(); }
+    int size() const { return results.size(); }
+    bool lookup(const QString& key, QPair<int, int>& result) const;
+    void store(const QString& key, const QPair<int, int>& result);
+    void save();
+    void remove();
+    void close();
+    static QString path_for(const QString& settings_path);
+};
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,26 @@
+#ifndef CURVE_PLOT_H
+#define CURVE_PLOT_H
+#include <QWidget>
+#include <QPainter>
+#include <QPaintEvent>
+#include "model.h"
+
+// Line chart of a scan's curve: the transmission over the input angle or the loss over a parameter
+class CurvePlot : public QWidget
+{
+    Q_OBJECT
+
+private:
+    Curve curve;
+
+public:
+    explicit CurvePlot(QWidget * parent = nullptr) : QWidget(parent) {}
+    void set_curve(const Curve& new_curve);
+    void clear() { set_curve(Curve()); }
+    QSize sizeHint() const override { return QSize(480, 200); }
+
+protected:
+    void paintEvent(QPaintEvent * event) override;
+};
+
+#endif // CURVE_PLOT_H
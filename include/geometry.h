@@ -5,10 +5,15 @@
 #include <QLineF>
 #include <QTextStream>
 
-class bad_intersection : std::exception {
-    const char* what() const noexcept override { return "Beam calculation error"; }
+// Outcome of the search for a beam's intersection with the focon's surface
+enum IntersectionStatus {
+    INTERSECTION_FOUND,
+    INTERSECTION_DEGENERATE,    // No proper root: the beam goes across the axis without meeting the surface
+    INTERSECTION_VERTEX         // The beam hits the cone's vertex where the surface's normal is undefined
 };
 
+constexpr qreal intersection_tolerance = 1e-9;     // Relative to the cone's size
+
 class Point {
 private:
     qreal x_, y_, z_;
@@ -101,14 +106,15 @@ public:
     qreal n() const { return refraction_index; }
     Plane entrance() const { return Plane(0); }
     Plane exit() const { return Plane(length()); }
-    virtual Point intersection(const Beam& beam) const;
-    virtual bool is_conic();
+    virtual Point intersection(const Beam& beam, IntersectionStatus * status = nullptr) const;
+    virtual bool is_conic() const;
     void set_d1(qreal d1) { diameter_in = d1; }
     virtual void set_d2(qreal d2) { /* do nothing */ }
     void set_length(qreal new_length) { length_ = new_length; }
     void set_n(qreal n) { refraction_index = n; }
     Beam reflected(const Beam& beam, const Point& intersection) const;
-    Beam refracted(const Beam& beam) const;
+    Beam refracted(const Beam& beam) const { return refracted(beam, refraction_index); }
+    Beam refracted(const Beam& beam, qreal n) const;   // From the glass of index n into the air inside
 };
 
 class Cone : public Tube {
@@ -123,13 +129,17 @@ public:
     qreal d2() const override { return diameter_out; }
     qreal tan_phi() const  { return (d1() - d2())/(2*length()); }
     qreal phi() const override { return qAtan(tan_phi()); }
-    Point intersection(const Beam& beam) const override;
+    Point intersection(const Beam& beam, IntersectionStatus * status = nullptr) const override;
     qreal z_k() const { return z_offset + r1()/tan_phi(); }
     Point vertex() const { return Point(0, 0, z_k()); }
+    qreal z() const { return z_offset; }
     void set_d2(qreal d2) override { diameter_out = d2; }
     void set_z(qreal z) { z_offset = z; }
 };
 
+// Share of the unpolarised light reflected by the interface between the media, 1 on total internal reflection
+qreal fresnel_reflectance(qreal cos_in, qreal n1, qreal n2);
+
 class Matrix {
 private:
     qreal a[3][3];
@@ -160,10 +170,10 @@ public:
     qreal detector_z() const { return z_pos + z_offset; }
     Plane plane() const { return Plane(detector_z()); }
     Point intersection(const Beam& beam, qreal z) const;
-    bool hit(const Beam& beam) { return intersection(beam,window_z()).is_in_radius(window_radius())
+    bool hit(const Beam& beam) const { return intersection(beam,window_z()).is_in_radius(window_radius())
                                         && intersection(beam,detector_z()).is_in_radius(r()); }
-    bool missed(const Beam& beam) { return !hit(beam); }
-    bool detected(const Beam& beam) { return hit(beam) && qFabs(beam.gamma()) < fov(); }
+    bool missed(const Beam& beam) const { return !hit(beam); }
+    bool detected(const Beam& beam) const { return hit(beam) && qFabs(beam.gamma()) < fov(); }
     void set_position(qreal z) { z_pos = z; }
 };
 
@@ -175,6 +185,7 @@ public:
     Lens() = default;
     Lens(qreal f, qreal z_pos = 0) : focus(f), z_pos(z_pos) {}
     qreal F() const { return 1.0/focus; }
+    qreal f() const { return focus; }
     qreal z() const { return z_pos; }
     void set_focus(qreal f) { focus = f; }
     void set_position(qreal z) { z_pos = z; }
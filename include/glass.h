@@ -0,0 +1,35 @@
+#ifndef GLASS_H
+#define GLASS_H
+#include <QtGlobal>
+#include <QVector>
+#include <QString>
+#include <QJsonObject>
+
+// Refractive index of the focon's glass against the wavelength, given in micrometres
+class Glass {
+public:
+    enum Formula {
+        CONSTANT,       // n
+        CAUCHY,         // n = A + B/λ² + C/λ⁴ + ..., coefficients A, B, C, ...
+        SELLMEIER       // n² = 1 + Σ Bᵢλ²/(λ² − Cᵢ), coefficients B₁, C₁, B₂, C₂, ...
+    };
+
+private:
+    Formula formula_ = CONSTANT;
+    QVector<qreal> coefficients_ = {1.5};
+
+public:
+    Glass() = default;
+    explicit Glass(qreal n) : coefficients_({n}) {}
+    Glass(Formula formula, const QVector<qreal>& coefficients) : formula_(formula), coefficients_(coefficients) {}
+    Formula formula() const { return formula_; }
+    const QVector<qreal>& coefficients() const { return coefficients_; }
+    bool is_dispersive() const { return formula_ != CONSTANT; }
+    qreal n(qreal wavelength) const;
+    QJsonObject to_json() const;
+    static bool from_json(const QJsonObject& json_file, Glass& glass);
+    static Glass n_bk7();
+    static Glass fused_silica();
+};
+
+#endif // GLASS_H
@@ -0,0 +1,27 @@
+#ifndef HISTOGRAM_PLOT_H
+#define HISTOGRAM_PLOT_H
+#include <QWidget>
+#include <QPainter>
+#include <QPaintEvent>
+#include "statistics.h"
+
+// Small bar chart of a distribution with its summary and quantiles marked
+class HistogramPlot : public QWidget
+{
+    Q_OBJECT
+
+private:
+    Distribution distribution;
+    QString unit;
+
+public:
+    explicit HistogramPlot(const QString& unit, QWidget * parent = nullptr) : QWidget(parent), unit(unit) {}
+    void set_distribution(const Distribution& new_distribution);
+    void clear() { set_distribution(Distribution()); }
+    QSize sizeHint() const override { return QSize(480, 180); }
+
+protected:
+    void paintEvent(QPaintEvent * event) override;
+};
+
+#endif // HISTOGRAM_PLOT_H
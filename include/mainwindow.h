@@ -10,13 +10,24 @@
 #include <QDoubleSpinBox>
 #include <QGraphicsView>
 #include <QGraphicsLineItem>
+#include <QGraphicsPixmapItem>
 #include <QRandomGenerator>
 #include <QFileDialog>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QJsonArray>
 #include <QDebug>
 #include <QResizeEvent>
-#include "geometry.h"
+#include <QtConcurrent>
+#include <QFutureWatcher>
+#include <QDockWidget>
+#include <QPlainTextEdit>
+#include <memory>
+#include "model.h"
+#include "beams_item.h"
+#include "histogram_plot.h"
+#include "slices_plot.h"
+#include "curve_plot.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -26,8 +37,6 @@ constexpr qreal diameter = 150;
 constexpr qreal margin = 10;
 constexpr QPointF y_axis_label_offset = QPointF(-15,-10);
 constexpr QPointF x_axis_label_offset = QPointF(-5,-5);
-constexpr qreal loss_limit = 10;
-constexpr int length_limit = 500;
 
 class MainWindow : public QMainWindow
 {
@@ -40,54 +49,25 @@ public:
 private:
     Ui::MainWindow *ui;
 
-    enum BeamStatus {
-        REFLECTED,      // Failed to pass the focon
-        MISSED,         // Passed the focon but failed to hit the detector's surface
-        HIT,            // Passed the focon and hit the detector's surface
-        DETECTED        // Hit within the detector's FOV
-    };
-
-    enum Mode {
-        SINGLE_BEAM_CALCULATION,
-        PARALLEL_BUNDLE,
-        PARALLEL_BUNDLE_EXIT,
-        DIVERGENT_BUNDLE,
-        EXHAUSTIVE_SAMPLING,
-        MONTE_CARLO_METHOD,
-        LENGTH_OPTIMISATION,
-        D_OUT_OPTIMISATION,
-        FOCUS_OPTIMISATION,
-        FULL_OPTIMISATION,
-        COMPLEX_OPTIMISATION
-    };
-
-    struct Parameters {
-        int length = 0, focus = 0;
-        qreal d_out = 0, loss = 1e10;
-        Parameters() {}
-        Parameters(int length, qreal d_out, qreal loss) : length(length), d_out(d_out), loss(loss) {}
-        Parameters(int length, int focus, qreal d_out, qreal loss) : length(length), focus(focus), d_out(d_out), loss(loss) {}
-        Parameters(int focus, const Parameters& p) : length(p.length), focus(focus), d_out(p.d_out), loss(p.loss) {}
-    };
-
-    // Basic objects
-    Point intersection;
-    Tube * cone = nullptr;
-    Cone * cavity = nullptr;
-    Detector detector;
-    Lens lens;
-    Lens ocular;
+    // Models of the system: the displayed one and the one being calculated in the thread pool
+    Model * model = nullptr;
+    Model * calculation = nullptr;
+    QFutureWatcher<Model::Result> watcher;
+    std::unique_ptr<RayRecorder> recorder;     // Streams the beams of the running calculation to a file
+    QString rays_path;
+    QString rays_source_path;                   // Input of the external rays mode
+    Glass glass_material;                       // Glass of the focon, chosen in the elements' menu or loaded
 
     // Calculation results
     qreal scale;
     qreal scale_xoy;
     qreal scale_exit_xoy;
-    BeamStatus single_beam_status;
-    QVector<QGraphicsLineItem *> beams;
-    QVector<QGraphicsLineItem *> beams_xoy;
-    QVector<Point> points;
-    QVector<BeamStatus> statuses;
-    QVector<qreal> beam_angles;
+    BeamStatus single_beam_status = REFLECTED;
+    QVector<Point> path;
+    qreal density_radius = 0;       // Half-width of the displayed map, mm
+    SpotDiagram spot;
+    Curve curve;
+    QString settings_path;
 
     // Graphic objects
     QGraphicsScene* scene;
@@ -123,60 +103,61 @@ private:
     QGraphicsPolygonItem * polygon;
     QBrush glass_brush_black = QBrush(QPixmap(":/textures/glass-black.png"));
     QBrush glass_brush_white = QBrush(QPixmap(":/textures/glass-white.png"));
+    BeamsItem * beams;
+    BeamsItem * beams_xoy;
+    QGraphicsPixmapItem * density_xoy;
+
+    // Panels
+    HistogramPlot * angles_plot;
+    QDockWidget * angles_dock;
+    bool angles_dock_shown = false;     // The panel pops up with the first results only, then it is up to the user
+    SlicesPlot * slices_plot;
+    QDockWidget * slices_dock;
+    CurvePlot * curve_plot;
+    QDockWidget * curve_dock;
+    QPlainTextEdit * performance_view;
+    QDockWidget * performance_dock;
 
 private slots:
     // Interface
     void showEvent(QShowEvent * event) override;
     void resizeEvent(QResizeEvent * event) override;
     void clear();
-    void draw(int rotation_angle);
-    void draw(const Point& p, BeamStatus status, int rotation_angle);
-    void draw(const Point& p, qreal beam_angle, int rotation_angle);
+    void draw();
+    void set_projections(int rotation_angle);
     void draw_axes(int rotation_angle);
-    void set_beam_color(QGraphicsLineItem * beam, BeamStatus status);
-    void set_beam_color(QGraphicsLineItem * beam, qreal angle);
+    QColor beam_color(BeamStatus status) const;
+    QColor beam_color(qreal angle) const;
+    QImage density_image(const Histogram2D& density) const;
+    QString performance_text(const QJsonObject& performance) const;
     void init_graphics();
     void set_colors(bool night_theme_on);
     void set_text_size(bool big_fonts);
     void set_lens(bool visible);
     void set_ocular(bool visible);
     void set_glass(bool glass_on);
+    void set_material(const Glass& material);
     void rotate(int rotation_angle);
-    void show_results(const QPair<int, int>&);
-    void show_results(const QPair<int, qreal>&);
-    void show_results(const QPair<qreal, qreal>&);
-    void show_results(const Parameters&);
-    void show_results(qreal mean_angle);
 
     // Filesystem
+    QJsonObject settings() const;
+    Settings current_settings() const;
     void save_settings();
     void load_settings();
     void save_image();
     void save_image_xoy();
+    void save_spot();
+    void save_curve();
+    void set_recording(bool recording);
+    void open_rays();
 
     // Calculations
-    void init_objects();
-    Point starting_point() const;
-    Beam starting_beam() const;
-    void init_cone(qreal d1, qreal d2, qreal length);
-    qreal lens_focus(bool auto_focus) const;
-    void init_cavity(Tube* glass_cone);
     void build();
-    void transformation_on_entrance(Beam& beam);
-    void reflection_cycle(Beam& beam, const Beam& original_beam);
-    void transformation_on_exit(Beam& beam, const Beam& original_beam);
-    BeamStatus calculate_single_beam_path(Beam& beam);
-    QPair<int, int> calculate_parallel_beams(qreal angle);
-    QPair<int, int> calculate_divergent_beams(const Point& point);
-    QPair<int, int> calculate_every_beam();
-    QPair<int, int> monte_carlo_method();
-    QPair<int, qreal> optimal_length();
-    QPair<int, qreal> optimal_focus();
-    QPair<qreal, qreal> optimal_d_out();
-    Parameters full_optimisation();
-    Parameters complex_optimisation(); //
-    qreal loss(const QPair<int, int>&) const;
-    qreal mean_exit_angle() const;
+    void cancel();
+    void add_beams(const QVector<BeamRecord>& new_records);
+    void show_density(const Histogram2D& density);
+    void show_progress(const Progress& progress);
+    void finish_calculation();
 
 };
 #endif // MAINWINDOW_H
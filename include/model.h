@@ -0,0 +1,357 @@
+#ifndef MODEL_H
+#define MODEL_H
+#include <QObject>
+#include <QVector>
+#include <QPair>
+#include <QString>
+#include <QJsonObject>
+#include <QMetaType>
+#include <QMutex>
+#include <atomic>
+#include <memory>
+#include "geometry.h"
+#include "budget.h"
+#include "checkpoint.h"
+#include "statistics.h"
+#include "shard.h"
+#include "recorder.h"
+#include "ray_source.h"
+#include "profiler.h"
+#include "glass.h"
+
+constexpr qreal loss_limit = 10;
+constexpr int length_limit = 500;
+constexpr int density_resolution = 256;    // Side of the bundle modes' maps in pixels
+constexpr int spot_resolution = 128;       // Side of the spot diagram's maps in pixels
+constexpr int iteration_limit = 100000;    // Surfaces met by a beam before it is considered trapped
+constexpr qreal single_precision_band = 1e-4;  // Beams passing closer to a decision boundary are traced again in double precision
+constexpr qreal roulette_threshold = 1e-2; // Beams carrying a smaller share of energy play Russian roulette in the energy mode
+constexpr qreal roulette_survival = 0.1;   // Chance of such a beam to go on
+
+namespace reference { template <typename T> class Tracer; }
+
+enum Mode {
+    SINGLE_BEAM_CALCULATION,
+    PARALLEL_BUNDLE,
+    PARALLEL_BUNDLE_EXIT,
+    DIVERGENT_BUNDLE,
+    EXHAUSTIVE_SAMPLING,
+    MONTE_CARLO_METHOD,
+    LENGTH_OPTIMISATION,
+    D_OUT_OPTIMISATION,
+    FOCUS_OPTIMISATION,
+    FULL_OPTIMISATION,
+    SPOT_DIAGRAM,
+    EXTERNAL_RAYS,
+    REVERSE_TRACING,
+    TOLERANCE_ANALYSIS,
+    SENSITIVITY_ANALYSIS,
+    ANGLE_SCAN,
+    PARAMETER_SCAN,
+    COMPLEX_OPTIMISATION
+};
+
+inline bool is_optimisation(int mode) {
+    return (mode >= LENGTH_OPTIMISATION && mode <= FULL_OPTIMISATION) || mode == COMPLEX_OPTIMISATION;
+}
+
+struct Parameters {
+    int length = 0, focus = 0;
+    qreal d_out = 0, loss = 1e10;
+    qreal coverage = 1;     // Fraction of the search space evaluated before the budget ran out
+    Parameters() {}
+    Parameters(int length, qreal d_out, qreal loss) : length(length), d_out(d_out), loss(loss) {}
+    Parameters(int length, int focus, qreal d_out, qreal loss) : length(length), focus(focus), d_out(d_out), loss(loss) {}
+    Parameters(int focus, const Parameters& p) : length(p.length), focus(focus), d_out(p.d_out), loss(p.loss) {}
+};
+
+// Manufacturing tolerances of the tolerance analysis
+enum Tolerance {
+    TOLERANCE_D1,
+    TOLERANCE_D2,
+    TOLERANCE_LENGTH,
+    TOLERANCE_DETECTOR_OFFSET,
+    TOLERANCE_FOCAL_LENGTH,
+    TOLERANCES
+};
+
+// Parameters of the sensitivity analysis
+enum SensitivityParameter {
+    SENSITIVITY_LENGTH,
+    SENSITIVITY_D2,
+    SENSITIVITY_FOCAL_LENGTH,       // With the lens focused manually
+    SENSITIVITY_DEFOCUS,            // With the lens focused automatically
+    SENSITIVITY_CAVITY_LENGTH,
+    SENSITIVITY_DETECTOR_OFFSET,
+    SENSITIVITY_PARAMETERS
+};
+
+constexpr int slice_size = 7;       // Side of the sensitivity analysis' loss slices in steps
+
+// Behaviour of the loss around the current design along one parameter
+struct ParameterSensitivity {
+    int parameter = SENSITIVITY_LENGTH;
+    qreal step = 0;                 // Of the finite differences, in the parameter's units
+    qreal loss = 0;                 // dB, of the current design
+    qreal gradient = 0;             // dB per unit, the central difference
+    qreal slope = 0, curvature = 0; // Quadratic fit loss + slope·x + curvature·x² over ±2 steps, x being the deviation
+    bool valid = false;             // Every point passed some beams
+};
+
+// Losses over a grid of deviations of two parameters around the current design
+struct LossSlice {
+    int x_parameter = SENSITIVITY_LENGTH, y_parameter = SENSITIVITY_D2;
+    Histogram2D losses;             // dB, over the deviations in the parameters' units
+};
+
+constexpr int scan_angle = -1;      // Curve's parameter of the transmission over the input angle
+
+// Beams passed over the input angle or over a parameter, calculated point by point in the scan modes and by the optimisers
+struct Curve {
+    int parameter = scan_angle;     // SensitivityParameter or scan_angle
+    QVector<qreal> arguments;       // Ascending, in degrees or in the parameter's units
+    QVector<QPair<int, int>> counts;    // Passed and total beams per argument, no beams for the points not evaluated
+
+    void add(qreal argument, const QPair<int, int>& point_counts);
+    bool is_empty() const { return arguments.isEmpty(); }
+    QString to_csv() const;
+};
+
+// An entrance beam relative to the entrance's radius and the source's angle, so that it samples every design alike
+struct EntranceSample {
+    qreal x = 0, y = 0, angle = 0;
+    EntranceSample() {}
+    EntranceSample(qreal x, qreal y, qreal angle) : x(x), y(y), angle(angle) {}
+};
+
+// Input parameters of a calculation, detached from the interface so that it can run in a worker thread
+struct Settings {
+    qreal d_in = 25, d_out = 5, length = 50;
+    qreal angle = 5, x_offset = 0, y_offset = 0;
+    qreal aperture = 5, offset_det = 0, fov = 45, d_det = 5;
+    int mode = SINGLE_BEAM_CALCULATION;
+    int rotation = 0;
+    bool lens = false;
+    qreal focal_length = 50;
+    qreal focal_length_min = 25, focal_length_max = 150;
+    bool auto_focus = true;
+    qreal defocus = 1;          // Shift of the automatic focus in the detector's radii
+    bool ocular = false;
+    qreal ocular_focal_length = 10;
+    bool glass = false;
+    qreal cavity_length = 0;
+    int precision = 1;
+    bool budget = false;
+    int time_limit = 60;        // s
+    int beam_limit = 0;         // thousands of beams
+    qint64 beam_count = 0;      // Monte Carlo sample size, 0 means the one given by the precision
+    bool single_precision = false;  // Sampling modes trace the beams in float and escalate the doubtful ones
+    bool energy = false;        // Beams carry their share of energy lost on the walls, the interfaces and in the glass
+    qreal wall_reflectivity = 0.9;  // Of the hollow focon's metallic walls
+    qreal absorption = 0;       // Absorption coefficient of the glass, 1/mm
+    Glass material;             // Glass of the focon
+    qreal wavelength = 0.55;    // µm, the design wavelength every mode is calculated for
+    qreal wavelength_min = 0.4, wavelength_max = 0.7;   // µm, spectral range of the dispersion mode
+    int bands = 0;              // Spectral bands the sampling modes trace every beam in besides the design wavelength
+    QVector<qreal> tolerances = QVector<qreal>(TOLERANCES, 0);  // ±mm per Tolerance
+    bool normal_tolerances = false; // The deviations are normal with the tolerance as 3σ, otherwise uniform within it
+    int designs = 1000;         // Perturbed designs of the tolerance analysis
+    int scan_parameter = SENSITIVITY_LENGTH;    // Parameter of the parameter scan
+    qreal scan_from = 20, scan_to = 100;        // Its range in its units
+    int scan_points = 50;       // Points of the scans' curves
+    QString rays_file;          // Externally supplied rays, relative to the settings file
+    QString path;               // Settings file the parameters were loaded from or saved to
+
+    static Settings from_json(const QJsonObject& json_file);
+    QJsonObject to_json() const;
+    QString fingerprint() const;
+    QString sampling_fingerprint() const;
+    QVector<qreal> band_wavelengths() const;
+    QString glass_error() const;        // Empty if the glass' index is valid at the design wavelength and in every band
+};
+
+// A beam's representation in the bundle modes' projections
+struct BeamRecord {
+    Point point;                    // Entry or exit point of the beam or the end of its projection
+    BeamStatus status = REFLECTED;
+    qreal angle = 0;                // Exit angle
+    BeamRecord() {}
+    BeamRecord(const Point& point, BeamStatus status, qreal angle = 0) : point(point), status(status), angle(angle) {}
+};
+
+struct Progress {
+    qint64 beams = 0;               // Beams traced so far
+    int candidates = 0;             // Optimisation candidates evaluated so far
+    qreal done = 0;                 // Fraction of the work done
+    qint64 eta = -1;                // Estimated remaining time in ms, -1 if unknown
+    QPair<qint64, qint64> counts;   // Interim numbers of passed and total beams
+    Parameters best;                // Interim optimisation result
+};
+
+Q_DECLARE_METATYPE(BeamRecord)
+Q_DECLARE_METATYPE(Progress)
+Q_DECLARE_METATYPE(Histogram2D)
+
+class Model : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Result {
+        QPair<int, int> counts;
+        Parameters parameters;
+        qreal mean_angle = 0;
+        qreal acceptance = 0;       // Share of the entrance's etendue reaching the detector, found by reverse tracing
+        qreal energy_loss = 0;      // dB, loss of energy in the sampling modes with the energy mode on
+        QVector<QPair<qreal, qreal>> bands;     // Wavelengths in µm and the losses in dB per spectral band
+        QVector<qreal> design_losses;           // dB, sorted losses of the perturbed designs in the tolerance analysis
+        QVector<qreal> sensitivities;           // dB per tolerance, change of the designs' loss per Tolerance
+        QVector<ParameterSensitivity> gradients;    // Of the applicable parameters in the sensitivity analysis
+        QVector<LossSlice> slices;              // Of their pairs in the sensitivity analysis
+        Curve curve;                // Of the scan modes and of the length, D2 and focus optimisations
+        qreal coverage = 1;
+        QVector<Point> path;        // Complete path of the beam in single beam mode
+        BeamStatus status = REFLECTED;
+        QString message;            // Summary for the status bar
+        bool failed = false;        // The calculation was aborted by an error
+        qint64 failures = 0;        // Beams whose path could not be calculated, left out of the results
+        QVector<BeamFailure> failure_samples;   // First of them, for diagnostics
+        qint64 single_precision_beams = 0;      // Beams traced in single precision
+        qint64 escalated = 0;       // Of them, the ones traced again in double precision by a decision boundary
+        qint64 elapsed = 0;         // ms
+        qint64 beams = 0;           // Beams traced
+        Histogram2D density;        // Map of the entry or exit points in the bundle modes and Monte Carlo method
+        SpotDiagram spot;           // Distributions over the detector in spot diagram mode
+        Distribution exit_angles;   // Exit angles of the beams passed the focon in the bundle and sampling modes
+        QJsonObject performance;    // Hot-path counters of the run, empty unless the engine is built with profiling
+    };
+
+    explicit Model(const Settings& settings, QObject * parent = nullptr);
+    ~Model() override;
+    Result run();
+    ShardResult run_shard(const Shard& shard);
+    void cancel() { budget.cancel(); }
+    void set_recorder(RayRecorder * ray_recorder) { recorder = ray_recorder; }
+    qint64 trace_batch(const double * rays, qint64 count, quint8 * statuses, double * exits = nullptr);
+    const Settings& current_settings() const { return settings; }
+    const Tube * focon() const { return cone; }
+    const Cone * cavity_cone() const { return cavity; }
+    const Detector& photodetector() const { return detector; }
+    const Lens& entrance_lens() const { return lens; }
+    Point starting_point() const;
+    static qreal loss(const QPair<int, int>&);
+    static qreal loss(qint64 passed, qint64 total);
+    static qreal loss(qreal transmission);
+    static QString results_message(qint64 passed, qint64 total, qreal coverage = 1);
+    static QString failure_name(BeamStatus status);
+    static QString tolerance_name(int tolerance);
+    static QString parameter_name(int parameter);
+    static QString parameter_unit(int parameter);
+    static qreal percentile(const QVector<qreal>& sorted, qreal q);
+
+signals:
+    void beams_calculated(const QVector<BeamRecord>& records);
+    void progress(const Progress& progress);
+    void density_calculated(const Histogram2D& density);
+
+private:
+    Settings settings;
+
+    // Basic objects
+    Tube * cone = nullptr;
+    Cone * cavity = nullptr;
+    Detector detector;
+    Lens lens;
+    Lens ocular;
+
+    // Calculation state
+    mutable Budget budget;
+    RayRecorder * recorder = nullptr;   // Receives every traced beam if set
+    Checkpoint checkpoint;
+    qreal coverage = 1;
+    qint64 work_planned = 0, work_done = 0;     // Work items of the last sampling run
+    std::atomic<int> candidates{0};
+    std::atomic<qint64> last_progress{0};
+    Histogram2D density;
+    QMutex density_mutex;
+    std::atomic<qint64> last_density{0};
+    mutable QMutex failures_mutex;
+    mutable QVector<qint64> failure_counts = QVector<qint64>(BEAM_STATUSES, 0);    // Failed beams per BeamStatus
+    mutable QVector<BeamFailure> failure_samples;
+    std::unique_ptr<const reference::Tracer<float>> fast_tracer;     // Set during the sampling in single precision
+    qint64 single_precision_beams = 0, escalated_beams = 0;
+    QVector<qreal> band_indices;        // Refractive indices of the glass per spectral band
+    Curve curve;                        // Candidates evaluated by the optimiser of a single parameter
+
+    template <typename Function>
+    void parallel_for(qint64 count, qint64 chunk_size, Function function) const;
+    void report_progress(qreal done, const QPair<qint64, qint64>& counts = QPair<qint64, qint64>(), const Parameters& best = Parameters());
+    void init_density();
+    void accumulate_density(const QVector<BeamRecord>& records, bool mirrored);
+
+    void init_objects();
+    Beam starting_beam() const;
+    void init_cone(qreal d1, qreal d2, qreal length);
+    qreal lens_focus(bool auto_focus) const;
+    void init_cavity(Tube* glass_cone);
+    void init_bands();
+    void transformation_on_entrance(Beam& beam, qreal& energy, qreal n) const;
+    void attenuate(qreal& energy, const Point& from, const Point& to) const;
+    bool survives_roulette(qreal& energy, const Beam& original_beam, int event) const;
+    bool reflection_cycle(Beam& beam, const Beam& original_beam, QVector<Point>& points, int& reflections, qreal& energy, BeamStatus& failure, qreal n) const;
+    bool transformation_on_exit(Beam& beam, const Beam& original_beam, QVector<Point>& points, int& reflections, qreal& energy, BeamStatus& failure, qreal n) const;
+    BeamStatus calculate_single_beam_path(Beam& beam, QVector<Point>& points, qreal * energy = nullptr, qreal n = 0) const;
+    BeamStatus calculate_reverse_beam_path(Beam& beam, qreal& weight) const;
+    void add_failure(const Beam& original_beam, BeamStatus status) const;
+    Point exit_point(const Beam& beam, BeamStatus status) const;
+    void record_beam(const Beam& original_beam, const Beam& beam, const Point& exit_point, BeamStatus status, int reflections) const;
+    QPair<int, int> calculate_parallel_beams(qreal angle, Distribution * angles = nullptr);
+    void init_fast_tracer(bool statistics_only);
+    void finish_fast_tracing(const SamplingStatistics& statistics);
+    BeamStatus sample_beam(Beam& beam, SamplingStatistics& statistics, qint64 weight, QVector<Point>& points) const;
+    void sample_bands(const Beam& original_beam, BeamStatus status, qreal energy, SamplingStatistics& statistics, qint64 weight) const;
+    SamplingStatistics calculate_divergent_beams(const Point& point, qint64 weight = 1);
+    SamplingStatistics sample_every_beam(const Shard& shard = Shard());
+    SamplingStatistics monte_carlo_method(const Shard& shard = Shard(), SpotDiagram * spot = nullptr);
+    SamplingStatistics reverse_tracing(qreal& acceptance, qreal& loss_error);
+    QVector<EntranceSample> entrance_samples(qint64 count) const;
+    SamplingStatistics sample_entrance(const QVector<EntranceSample>& samples);
+    Settings sampled_settings() const;
+    static bool is_feasible(const Settings& design);
+    SamplingStatistics evaluate_design(const Settings& design, const QVector<EntranceSample>& samples);
+    Settings design_settings(const QVector<qreal>& deviations) const;
+    QVector<qreal> tolerance_analysis(QPair<int, int>& nominal, QVector<qreal>& sensitivities);
+    bool is_applicable(int parameter) const;
+    Settings perturbed_settings(const QVector<qreal>& offsets) const;
+    QVector<ParameterSensitivity> sensitivity_analysis(QPair<int, int>& nominal, QVector<LossSlice>& slices);
+    Curve angle_scan();
+    Curve parameter_scan();
+    qreal etendue_ratio() const;
+    QPair<int, int> calculate_every_beam();
+    QString candidate_key(const QString& kind) const;
+    QPair<int, int> evaluate_parallel_beams(qreal angle);
+    QPair<int, int> evaluate_every_beam();
+    Parameters optimal_length();
+    Parameters optimal_focus();
+    Parameters optimal_d_out();
+    Parameters full_optimisation();
+    Parameters complex_optimisation(); //
+
+    // Results
+    QString results_message(const Parameters&) const;
+    QString results_message(const Distribution& angles) const;
+    QString results_message(const SpotDiagram& spot) const;
+    QString energy_message(const SamplingStatistics& statistics) const;
+    QVector<QPair<qreal, qreal>> band_losses(const SamplingStatistics& statistics) const;
+    QString bands_message(const QVector<QPair<qreal, qreal>>& bands) const;
+    QString tolerance_message(const QPair<int, int>& nominal, const QVector<qreal>& losses, const QVector<qreal>& sensitivities) const;
+    QString sensitivity_message(const QVector<ParameterSensitivity>& gradients) const;
+    QString scan_message(const Curve& scanned) const;
+    QString reverse_results_message(const SamplingStatistics& statistics, qreal acceptance, qreal loss_error) const;
+    QString rays_file_path() const;
+    SamplingStatistics trace_ray_file(qint64& outside, qint64& invalid, QString& status_path, QString& error);
+    static QString coverage_message(qreal coverage);
+    static QString failures_message(const QVector<qint64>& failure_counts, qint64 beams);
+};
+
+#endif // MODEL_H
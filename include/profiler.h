@@ -0,0 +1,90 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+#include <QtGlobal>
+#include <QJsonObject>
+#include <QElapsedTimer>
+
+// Hot-path counters of the engine. They are compiled in only when FOCON_PROFILING is defined
+// (qmake CONFIG+=profiling), otherwise the PROFILE_* macros expand to nothing.
+
+enum ProfileCounter {
+    PROFILE_BEAMS,                  // Beams traced
+    PROFILE_CONE_INTERSECTIONS,
+    PROFILE_CAVITY_INTERSECTIONS,
+    PROFILE_FAILED_INTERSECTIONS,   // Intersections with the cone that could not be found
+    PROFILE_ESCAPES,                // Beams leaving the cone through its ends without meeting the surface
+    PROFILE_ROULETTE_STOPS,         // Beams stopped by the Russian roulette in the energy mode
+    PROFILE_COUNTERS
+};
+
+enum ProfileStage {
+    STAGE_SETUP,                    // Everything before the calculation itself
+    STAGE_TRACE,                    // The calculation of the mode
+    STAGE_DENSITY,                  // Accumulating the density maps
+    STAGE_MERGE,                    // Merging the statistics of the parallel parts
+    PROFILE_STAGES
+};
+
+// Counters of a run or of its part. Every thread writes to its own profile, set by ProfileScope,
+// and the profiles of the parallel parts are summed up by the caller, so no atomics are needed
+class Profile {
+public:
+    static constexpr int reflection_bins = 64;      // The last bin takes all the beams with more reflections
+
+    qint64 counters[PROFILE_COUNTERS] = {};
+    qint64 reflections[reflection_bins] = {};
+    qint64 stages[PROFILE_STAGES] = {};             // ns, summed over the threads
+
+    void merge(const Profile& other);
+    QJsonObject to_json() const;
+    static Profile *& current() {                   // Profile of the calling thread, may be null
+        thread_local Profile * profile = nullptr;
+        return profile;
+    }
+};
+
+// Directs the calling thread's counters to the given profile while it exists
+class ProfileScope {
+private:
+    Profile * previous;
+
+public:
+    explicit ProfileScope(Profile * profile) : previous(Profile::current()) { Profile::current() = profile; }
+    ~ProfileScope() { Profile::current() = previous; }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+};
+
+// Adds the time of its existence to a stage of the calling thread's profile
+class StageTimer {
+private:
+    ProfileStage stage;
+    QElapsedTimer timer;
+
+public:
+    explicit StageTimer(ProfileStage stage) : stage(stage) { timer.start(); }
+    ~StageTimer() {
+        if (Profile * profile = Profile::current()) profile->stages[stage] += timer.nsecsElapsed();
+    }
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+};
+
+#ifdef FOCON_PROFILING
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_COUNT(counter) \
+    do { if (Profile * profile_ = Profile::current()) ++profile_->counters[counter]; } while (false)
+#define PROFILE_ADD(counter, value) \
+    do { if (Profile * profile_ = Profile::current()) profile_->counters[counter] += (value); } while (false)
+#define PROFILE_REFLECTIONS(count) \
+    do { if (Profile * profile_ = Profile::current()) ++profile_->reflections[qMin<int>((count), Profile::reflection_bins - 1)]; } while (false)
+#define PROFILE_STAGE(stage) StageTimer PROFILE_CONCAT(stage_timer_, __LINE__)(stage)
+#else
+#define PROFILE_COUNT(counter) do {} while (false)
+#define PROFILE_ADD(counter, value) do {} while (false)
+#define PROFILE_REFLECTIONS(count) do {} while (false)
+#define PROFILE_STAGE(stage) do {} while (false)
+#endif
+
+#endif // PROFILER_H
@@ -0,0 +1,90 @@
+#ifndef RAY_SOURCE_H
+#define RAY_SOURCE_H
+#include <QtGlobal>
+#include <QString>
+#include <QVector>
+#include <QFile>
+#include <QByteArray>
+#include <cstring>
+#include "geometry.h"
+#include "recorder.h"
+
+// Codes of the per-ray status files besides the BeamStatus values
+enum RayCode : quint8 {
+    RAY_NOT_TRACED = 253,   // The calculation was interrupted before reaching the ray
+    RAY_OUTSIDE = 254,      // The ray misses the focon's entrance
+    RAY_INVALID = 255       // The record cannot be read or the ray does not go forward
+};
+
+// Externally supplied rays read straight from a memory-mapped file. Supported formats are the ray files
+// written by RayRecorder (their entry beams are used), raw binary records of five doubles (x, y, dx, dy, dz)
+// in the machine's byte order, and text files with these five numbers per line separated by commas,
+// semicolons or spaces. The rays are read in chunks that can be processed concurrently.
+class RaySource {
+public:
+    enum Format { RAY_FILE, BINARY, TEXT };
+
+private:
+    static constexpr int binary_record_size = 5 * sizeof(double);
+    QFile file;
+    RayFile ray_file;
+    Format file_format = BINARY;
+    const uchar * data = nullptr;
+    qint64 data_size = 0;
+    qint64 ray_count = 0;
+    qint64 chunk_size = 1;                  // Rays per chunk of the binary formats
+    QVector<qint64> chunk_offsets;          // Bytes where the chunks of a text file start, with the end of file as the last
+    QVector<qint64> chunk_firsts;           // Indices of the chunks' first rays, with the number of rays as the last
+
+    static bool is_ray_line(const char * begin, const char * end);
+    static bool parse_line(const char * begin, const char * end, Beam& ray);
+
+public:
+    RaySource() = default;
+    ~RaySource() { close(); }
+    bool open(const QString& path, QString& error);
+    void close();
+    Format format() const { return file_format; }
+    qint64 size() const { return ray_count; }
+    int chunk_count() const { return qMax(0, chunk_firsts.size() - 1); }
+    template <typename Function>
+    void for_each_ray(int chunk, Function function) const;
+};
+
+template <typename Function>
+void RaySource::for_each_ray(int chunk, Function function) const {
+    // Calls function(index, valid, ray) for every ray of the chunk in order
+    qint64 index = chunk_firsts[chunk];
+    if (file_format == TEXT) {
+        const char * text = reinterpret_cast<const char *>(data);
+        const char * end = text + chunk_offsets[chunk + 1];
+        for (const char * line = text + chunk_offsets[chunk]; line < end;) {
+            const char * line_end = static_cast<const char *>(memchr(line, '\n', end - line));
+            if (!line_end) line_end = end;
+            if (is_ray_line(line, line_end)) {
+                Beam ray;
+                bool valid = parse_line(line, line_end, ray);
+                function(index++, valid, ray);
+            }
+            line = line_end + 1;
+        }
+        return;
+    }
+    for (; index < chunk_firsts[chunk + 1]; ++index) {
+        qreal x, y, dx, dy, dz;
+        if (file_format == RAY_FILE) {
+            const RayRecord& record = ray_file[index];
+            x = record.entry_x; y = record.entry_y;
+            dx = record.entry_dx; dy = record.entry_dy; dz = record.entry_dz;
+        } else {
+            double values[5];
+            memcpy(values, data + index * binary_record_size, sizeof(values));
+            x = values[0]; y = values[1];
+            dx = values[2]; dy = values[3]; dz = values[4];
+        }
+        bool valid = qIsFinite(x) && qIsFinite(y) && qIsFinite(dx) && qIsFinite(dy) && qIsFinite(dz) && dz > 0;
+        function(index, valid, valid ? Beam(Point(x, y, 0), dx, dy, dz) : Beam());
+    }
+}
+
+#endif // RAY_SOURCE_H
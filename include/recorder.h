@@ -0,0 +1,83 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+#include <QtGlobal>
+#include <QString>
+#include <QVector>
+#include <QFile>
+#include <QMutex>
+#include <QJsonObject>
+#include <atomic>
+
+// Fixed-width record of a traced beam. The files store the records in the machine's byte order
+// right after the header, so they can be memory-mapped as an array of these structures.
+struct RayRecord {
+    double entry_x = 0, entry_y = 0;                // Entry point on the focon's entrance, mm
+    double entry_dx = 0, entry_dy = 0, entry_dz = 0;// Entry direction cosines
+    double exit_x = 0, exit_y = 0, exit_z = 0;      // Point where the beam leaves the focon, mm
+    double exit_dx = 0, exit_dy = 0, exit_dz = 0;   // Exit direction cosines
+    quint32 reflections = 0;                        // Reflections from the focon's walls
+    quint8 status = 0;                              // BeamStatus
+    quint8 reserved[3] = {0, 0, 0};
+};
+static_assert(sizeof(RayRecord) == 96, "RayRecord must have no padding");
+
+// Header of a ray file: magic, version, header size, record size, schema size and the schema in JSON,
+// zero-padded to a multiple of 64 bytes. Version 2 names the failure statuses in the schema,
+// the records are the same as in version 1, so such files are read as well
+struct RayFileHeader {
+    static constexpr char magic[9] = "FOCONRAY";
+    static constexpr quint32 version = 2;
+    static constexpr quint32 first_readable_version = 1;
+    static constexpr int alignment = 64;
+    static QJsonObject schema();
+};
+
+// Thread-safe streaming writer of ray records. The records are collected in striped buffers
+// so that the tracing threads rarely wait for each other, and only the buffers are kept in memory.
+// The order of the records in the file is not defined.
+class RayRecorder {
+private:
+    static constexpr int stripe_count = 16;
+    static constexpr int buffer_size = 4096;   // Records
+    struct Stripe {
+        QMutex mutex;
+        QVector<RayRecord> buffer;
+    };
+    QFile file;
+    QMutex file_mutex;
+    Stripe stripes[stripe_count];
+    std::atomic<qint64> written{0};
+    std::atomic<bool> failed{false};
+    void flush(Stripe& stripe);
+
+public:
+    RayRecorder() = default;
+    ~RayRecorder() { close(); }
+    bool open(const QString& path, QString& error);
+    bool is_open() const { return file.isOpen(); }
+    void add(const RayRecord& record);
+    bool close();
+    qint64 count() const { return written; }
+    QString path() const { return file.fileName(); }
+};
+
+// Read-only view of a ray file mapped into memory
+class RayFile {
+private:
+    QFile file;
+    uchar * data = nullptr;
+    qint64 header_size = 0, record_count = 0;
+    QJsonObject file_schema;
+
+public:
+    RayFile() = default;
+    ~RayFile() { close(); }
+    bool open(const QString& path, QString& error);
+    void close();
+    qint64 size() const { return record_count; }
+    const RayRecord * records() const { return reinterpret_cast<const RayRecord *>(data + header_size); }
+    const RayRecord& operator[](qint64 i) const { return records()[i]; }
+    const QJsonObject& schema() const { return file_schema; }
+};
+
+#endif // RECORDER_H
@@ -0,0 +1,317 @@
+#ifndef REFERENCE_H
+#define REFERENCE_H
+#include <cfloat>
+#include <cmath>
+#ifdef FOCON_QUADMATH
+#include <quadmath.h>
+#endif
+#include "model.h"
+
+// Reference tracer: the optical model of the engine calculated in extended precision, long double or
+// __float128 (qmake CONFIG+=quadmath), with plain vector formulas instead of the rotation matrices and angles
+// and with tolerances derived from the precision instead of fixed epsilons. It serves as an oracle for the fast
+// kernels (focon-bench --fuzz-beams). Instantiated with float, the same tracer is the engine's single precision
+// mode: every beam carries its distance to the decision boundaries, so the doubtful ones can be traced again.
+
+namespace reference {
+
+// Functions of the precisions, so that the templates below call them unqualified
+inline float sqrt(float x) { return std::sqrt(x); }
+inline float fabs(float x) { return std::fabs(x); }
+inline float cos(float x) { return std::cos(x); }
+inline float pi(float) { return static_cast<float>(M_PI); }
+inline float epsilon(float) { return FLT_EPSILON; }
+inline double sqrt(double x) { return std::sqrt(x); }
+inline double fabs(double x) { return std::fabs(x); }
+inline double cos(double x) { return std::cos(x); }
+inline double pi(double) { return M_PI; }
+inline double epsilon(double) { return DBL_EPSILON; }
+inline long double sqrt(long double x) { return std::sqrt(x); }
+inline long double fabs(long double x) { return std::fabs(x); }
+inline long double cos(long double x) { return std::cos(x); }
+inline long double pi(long double) { return 3.141592653589793238462643383279502884L; }
+inline long double epsilon(long double) { return LDBL_EPSILON; }
+#ifdef FOCON_QUADMATH
+inline __float128 sqrt(__float128 x) { return sqrtq(x); }
+inline __float128 fabs(__float128 x) { return fabsq(x); }
+inline __float128 cos(__float128 x) { return cosq(x); }
+inline __float128 pi(__float128) { return M_PIq; }
+inline __float128 epsilon(__float128) { return FLT128_EPSILON; }
+#endif
+
+// Relative tolerance of the root selection: the square root of the precision keeps clear of the rounding
+// of the intersection points, which are the starting points of the next segments
+template <typename T>
+T tolerance() { return sqrt(epsilon(T())); }
+
+template <typename T>
+struct Point {
+    T x = 0, y = 0, z = 0;
+    Point() {}
+    Point(T x, T y, T z) : x(x), y(y), z(z) {}
+    Point operator+(const Point& p) const { return Point(x + p.x, y + p.y, z + p.z); }
+    Point operator-(const Point& p) const { return Point(x - p.x, y - p.y, z - p.z); }
+    Point operator*(T k) const { return Point(k*x, k*y, k*z); }
+    T dot(const Point& p) const { return x*p.x + y*p.y + z*p.z; }
+    T r_sqr() const { return x*x + y*y; }
+};
+
+// Unit vector
+template <typename T>
+struct Vector : Point<T> {
+    Vector() : Point<T>(0, 0, 1) {}
+    Vector(T dx, T dy, T dz) : Point<T>(dx, dy, dz) {
+        T length = sqrt(dx*dx + dy*dy + dz*dz);
+        this->x /= length;
+        this->y /= length;
+        this->z /= length;
+    }
+    explicit Vector(const Point<T>& p) : Vector(p.x, p.y, p.z) {}
+};
+
+template <typename T>
+struct Beam {
+    Point<T> p;
+    Vector<T> v;
+    Beam() {}
+    Beam(const Point<T>& p, const Vector<T>& v) : p(p), v(v) {}
+    Point<T> at(T t) const { return p + v * t; }
+};
+
+template <typename T>
+class Plane {
+private:
+    T z_;
+
+public:
+    explicit Plane(T z = 0) : z_(z) {}
+    T z() const { return z_; }
+    Point<T> intersection(const Beam<T>& beam) const { return beam.at((z_ - beam.p.z) / beam.v.z); }
+    // Snell's law on the plane, the totally reflected beam is mirrored as in Plane::refracted
+    Beam<T> refracted(const Beam<T>& beam, T n1, T n2) const {
+        T sin_sqr = beam.v.r_sqr() * (n1*n1) / (n2*n2);
+        if (sin_sqr > 1) return Beam<T>(beam.p, Vector<T>(beam.v.x, beam.v.y, -beam.v.z));
+        T k = n1 / n2;
+        return Beam<T>(beam.p, Vector<T>(k * beam.v.x, k * beam.v.y, sqrt(1 - sin_sqr)));
+    }
+};
+
+// Thin lens: the beam goes to the point of the focal plane where the parallel beam through the center goes
+template <typename T>
+class Lens {
+private:
+    T focus, z_pos;
+
+public:
+    Lens(T f = 1, T z = 0) : focus(f), z_pos(z) {}
+    Beam<T> refracted(const Beam<T>& beam) const {
+        Point<T> p2 = Plane<T>(z_pos + focus).intersection(Beam<T>(Point<T>(0, 0, z_pos), beam.v));
+        return Beam<T>(beam.p, Vector<T>(focus > 0 ? p2 - beam.p : beam.p - p2));
+    }
+};
+
+// Cone or tube between the planes z and z + length with the radius R(z) = r1 + k*(z - z_offset)
+template <typename T>
+class Cone {
+private:
+    T r1, k, length, z_offset, scale;
+
+public:
+    Cone() : r1(0), k(0), length(0), z_offset(0), scale(0) {}
+    Cone(T r1, T r2, T length, T z = 0)
+        : r1(r1), k((r2 - r1) / length), length(length), z_offset(z)
+        , scale(std::max(std::max(r1, r2), length)) {}
+    T z_low() const { return z_offset; }
+    T z_high() const { return z_offset + length; }
+    T size() const { return scale; }
+    T radius(T z) const { return r1 + k * (z - z_offset); }
+    bool contains(T z) const { return z >= z_low() && z <= z_high(); }
+
+    // The nearest point ahead where the beam crosses the surface |P + t*D|_xy = R(z + t*dz) on the nappe where R >= 0,
+    // leaving the inner side of the cone if the beam is inside and entering it otherwise. Selecting the roots by the
+    // direction of the crossing instead of a distance from the start rejects the point the beam starts from
+    // at any precision. Returns false when there is no such point. The margin, if given, is lowered to the relative
+    // distance from an ambiguous choice: a tangent beam or a point by the vertex
+    bool intersection(const Beam<T>& beam, T& t, bool inside, T * margin = nullptr) const {
+        const Point<T>& p = beam.p;
+        const Vector<T>& d = beam.v;
+        const T r0 = radius(p.z);
+        // F(t) = a*t^2 + 2*h*t + c is negative inside the cone and its derivative is 2*(a*t + h)
+        const T a = d.r_sqr() - k*k * d.z*d.z;
+        const T h = p.x*d.x + p.y*d.y - r0 * k * d.z;
+        const T c = p.r_sqr() - r0*r0;
+        const T tol = tolerance<T>();
+        T roots[2];
+        int count = 0;
+        if (fabs(a) <= 16 * epsilon(T()) * (d.r_sqr() + k*k * d.z*d.z)) {
+            if (h != 0) roots[count++] = -c / (2*h);
+        } else {
+            T discriminant = h*h - a*c;
+            if (margin) *margin = std::min(*margin, fabs(discriminant) / (h*h + fabs(a*c)));
+            if (discriminant < 0) return false;
+            T q = -(h + (h < 0 ? -sqrt(discriminant) : sqrt(discriminant)));
+            roots[count++] = q / a;
+            if (q != 0) roots[count++] = c / q;
+        }
+        bool found = false;
+        for (int i = 0; i < count; ++i) {
+            if (roots[i] <= 0 || (found && roots[i] >= t)) continue;
+            T slope = a * roots[i] + h;
+            if (inside ? slope <= 0 : slope >= 0) continue;
+            T root_radius = radius(p.z + roots[i] * d.z);
+            if (margin) *margin = std::min(*margin, fabs(root_radius) / scale);
+            if (root_radius < -tol * scale) continue;
+            t = roots[i];
+            found = true;
+        }
+        return found;
+    }
+    // Unit normal pointing to the axis, the local Y axis of the engine's Matrix(ksi, phi)
+    Vector<T> normal(const Point<T>& p) const { return Vector<T>(-p.x, -p.y, radius(p.z) * k); }
+    bool is_vertex(const Point<T>& p) const { return radius(p.z) < tolerance<T>() * scale; }
+};
+
+template <typename T>
+struct Result {
+    BeamStatus status = REFLECTED;
+    Point<T> exit;          // Point where the beam leaves the focon, through the exit or back through the entrance
+    Vector<T> direction;
+    int reflections = 0;
+    T margin = 1;           // Smallest relative distance to a decision boundary met on the way
+};
+
+template <typename T>
+class Tracer {
+private:
+    Cone<T> focon, cavity;
+    bool has_cavity = false;
+    bool lens_on = false, ocular_on = false, glass = false;
+    bool full_path = false;     // Single beam mode goes on after the beam is turned back
+    Lens<T> lens, ocular;
+    T n = 1;
+    T window_z = 0, window_radius = 0, detector_z = 0, detector_radius = 0, cos_fov = 0;
+
+    static void bound(T& margin, T value) { margin = std::min(margin, fabs(value)); }
+
+public:
+    explicit Tracer(const Model& model) {
+        const Settings& settings = model.current_settings();
+        const Tube * cone = model.focon();
+        focon = Cone<T>(cone->r1(), cone->r2(), cone->length());
+        if (const ::Cone * cavity_cone = model.cavity_cone()) {
+            cavity = Cone<T>(cavity_cone->r1(), cavity_cone->r2(), cavity_cone->length(), cavity_cone->z());
+            has_cavity = true;
+        }
+        lens_on = settings.lens;
+        lens = Lens<T>(model.entrance_lens().f());
+        ocular_on = settings.ocular;
+        ocular = Lens<T>(settings.ocular_focal_length, cone->length());
+        glass = settings.glass;
+        n = cone->n();
+        full_path = settings.mode == SINGLE_BEAM_CALCULATION;
+        const Detector& detector = model.photodetector();
+        window_z = detector.window_z();
+        window_radius = detector.window_radius();
+        detector_z = detector.detector_z();
+        detector_radius = detector.r();
+        cos_fov = cos(static_cast<T>(detector.fov()) * pi(T()) / 180);
+    }
+
+    // The ray is (x, y, dx, dy, dz) at the entrance as in Model::trace_batch
+    Result<T> trace(const double * ray) const {
+        Result<T> result;
+        Beam<T> beam(Point<T>(ray[0], ray[1], 0), Vector<T>(ray[2], ray[3], ray[4]));
+        if (lens_on) {
+            beam = lens.refracted(beam);
+        } else if (glass) {
+            beam = Plane<T>(0).refracted(beam, 1, n);
+        }
+
+        const T scale = focon.size();
+        bool in_cavity = false;     // The beam refracted into the cavity goes on in the air
+        for (int iteration = 0; ; ++iteration) {
+            if (iteration >= iteration_limit) {
+                result.status = NON_TERMINATING;
+                return result;
+            }
+            T t = 0;
+            if (!focon.intersection(beam, t, true, &result.margin) || !focon.contains(beam.at(t).z)) {
+                // The beam leaves the focon through one of its ends
+                if (beam.v.z >= 0 && ((glass && !has_cavity) || ocular_on)) {
+                    // The ocular is available for the glass-free focons only
+                    Plane<T> exit(focon.z_high());
+                    beam.p = exit.intersection(beam);
+                    beam = glass ? exit.refracted(beam, n, 1) : ocular.refracted(beam);
+                    bound(result.margin, beam.v.z);
+                    if (full_path && beam.v.z < 0) continue;
+                }
+                break;
+            }
+            Point<T> point = beam.at(t);
+            bound(result.margin, (point.z - focon.z_low()) / scale);
+            bound(result.margin, (point.z - focon.z_high()) / scale);
+
+            bool hit_cavity = false;
+            T t_cavity = 0;
+            if (has_cavity && cavity.intersection(beam, t_cavity, in_cavity, &result.margin)) {
+                Point<T> cavity_point = beam.at(t_cavity);
+                bound(result.margin, (t - t_cavity) / scale);
+                if (cavity.contains(cavity_point.z) && t_cavity < t) {
+                    if (cavity.is_vertex(cavity_point)) {
+                        result.status = VERTEX_HIT;
+                        return result;
+                    }
+                    hit_cavity = true;
+                    point = cavity_point;
+                }
+            }
+
+            Vector<T> normal = hit_cavity ? cavity.normal(point) : focon.normal(point);
+            T cos_in = beam.v.dot(normal);
+            Vector<T> reflected(beam.v - normal * (2 * cos_in));
+            if (hit_cavity) {
+                // Beams coming from the glass refract into the cavity unless they are totally reflected
+                T sin_out_sqr = (1 - cos_in * cos_in) * n * n;
+                if (cos_in > 0) bound(result.margin, sin_out_sqr - 1);
+                if (cos_in < 0 || sin_out_sqr > 1) {
+                    beam = Beam<T>(point, reflected);
+                } else {
+                    Point<T> tangential = beam.v - normal * cos_in;
+                    T sin_in = sqrt(tangential.dot(tangential));
+                    beam = Beam<T>(point, Vector<T>(tangential * (sqrt(sin_out_sqr) / sin_in) + normal * sqrt(1 - sin_out_sqr)));
+                    in_cavity = true;
+                }
+            } else {
+                beam = Beam<T>(point, reflected);
+                ++result.reflections;
+            }
+            // The engine stops tracing the beams turned back by the walls, they cannot pass anymore
+            if (!full_path && !has_cavity && beam.v.z < 0) break;
+        }
+
+        bound(result.margin, beam.v.z);
+        if (beam.v.z < 0) {
+            result.status = REFLECTED;
+            result.exit = Plane<T>(focon.z_low()).intersection(beam);
+        } else {
+            result.exit = Plane<T>(focon.z_high()).intersection(beam);
+            Point<T> window = Plane<T>(window_z).intersection(beam);
+            Point<T> detector = Plane<T>(detector_z).intersection(beam);
+            bound(result.margin, (sqrt(window.r_sqr()) - window_radius) / window_radius);
+            bound(result.margin, (sqrt(detector.r_sqr()) - detector_radius) / detector_radius);
+            bool hit = window.r_sqr() < window_radius * window_radius && detector.r_sqr() < detector_radius * detector_radius;
+            if (!hit) {
+                result.status = MISSED;
+            } else {
+                bound(result.margin, beam.v.z - cos_fov);
+                result.status = beam.v.z > cos_fov ? DETECTED : HIT;
+            }
+        }
+        result.direction = beam.v;
+        return result;
+    }
+};
+
+}
+
+#endif // REFERENCE_H
@@ -0,0 +1,35 @@
+#ifndef SHARD_H
+#define SHARD_H
+#include <QtGlobal>
+#include <QString>
+#include <QVector>
+#include "statistics.h"
+
+// Part i of N of a sampling run. The work items (Monte Carlo chunks or starting points)
+// are dealt to the shards in turn, so independent processes need no coordination.
+struct Shard {
+    int index = 0, count = 1;
+    Shard() {}
+    Shard(int index, int count) : index(index), count(count) {}
+    bool contains(qint64 item) const { return item % count == index; }
+    QString to_string() const { return QString("%1/%2").arg(index).arg(count); }
+    static bool parse(const QString& text, Shard& shard);
+};
+
+// Mergeable result of a shard stored in a small JSON file
+struct ShardResult {
+    QString fingerprint;            // Settings the shard was calculated with
+    int mode = 0;
+    Shard shard;
+    qint64 planned = 0, done = 0;   // Work items of the shard
+    qint64 elapsed = 0;             // ms
+    SamplingStatistics statistics;
+
+    qreal coverage() const { return planned > 0 ? static_cast<qreal>(done) / planned : 1; }
+    bool save(const QString& path) const;
+    static bool load(const QString& path, ShardResult& result, QString& error);
+    static bool merge(const QVector<ShardResult>& shards, ShardResult& merged, QString& error);
+    static QString path_for(const QString& settings_path, const Shard& shard);
+};
+
+#endif // SHARD_H
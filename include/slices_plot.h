@@ -0,0 +1,26 @@
+#ifndef SLICES_PLOT_H
+#define SLICES_PLOT_H
+#include <QWidget>
+#include <QPainter>
+#include <QPaintEvent>
+#include "model.h"
+
+// Small heat maps of the loss over the sensitivity analysis' slices, sharing one colour scale
+class SlicesPlot : public QWidget
+{
+    Q_OBJECT
+
+private:
+    QVector<LossSlice> slices;
+
+public:
+    explicit SlicesPlot(QWidget * parent = nullptr) : QWidget(parent) {}
+    void set_slices(const QVector<LossSlice>& new_slices);
+    void clear() { set_slices(QVector<LossSlice>()); }
+    QSize sizeHint() const override { return QSize(480, 200); }
+
+protected:
+    void paintEvent(QPaintEvent * event) override;
+};
+
+#endif // SLICES_PLOT_H
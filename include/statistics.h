@@ -0,0 +1,158 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+#include <QtGlobal>
+#include <QVector>
+#include <QPair>
+#include <QJsonObject>
+#include <QString>
+#include "geometry.h"
+
+enum BeamStatus {
+    REFLECTED,      // Failed to pass the focon
+    MISSED,         // Passed the focon but failed to hit the detector's surface
+    HIT,            // Passed the focon and hit the detector's surface
+    DETECTED,       // Hit within the detector's FOV
+    // The beam's path could not be calculated
+    DEGENERATE_ROOT,    // No proper intersection with the cone's surface
+    VERTEX_HIT,         // The beam hit the cavity's vertex
+    NON_TERMINATING,    // The beam did not leave the focon within the reflection limit
+    BEAM_STATUSES
+};
+
+inline bool is_failure(BeamStatus status) { return status > DETECTED; }
+
+constexpr int failure_samples_limit = 10;   // Failed beams kept for diagnostics
+
+// A beam whose path could not be calculated, kept for diagnostics
+struct BeamFailure {
+    Beam beam;
+    BeamStatus status = DEGENERATE_ROOT;
+    BeamFailure() {}
+    BeamFailure(const Beam& beam, BeamStatus status) : beam(beam), status(status) {}
+};
+
+// Histogram with a fixed binning, so that the histograms of independent runs can be summed
+class Histogram {
+private:
+    qreal low = 0, high = 1;
+    QVector<qint64> bins;
+    qint64 underflow = 0, overflow = 0;
+
+public:
+    Histogram() = default;
+    Histogram(qreal low, qreal high, int bin_count) : low(low), high(high), bins(bin_count, 0) {}
+    void add(qreal value, qint64 weight = 1);
+    bool merge(const Histogram& other);
+    int size() const { return bins.size(); }
+    qreal bin_width() const { return (high - low) / bins.size(); }
+    qreal bin_low(int i) const { return low + i * bin_width(); }
+    qint64 operator[](int i) const { return bins[i]; }
+    qint64 total() const;
+    qreal quantile(qreal q) const;
+    QJsonObject to_json() const;
+    static Histogram from_json(const QJsonObject& json_file);
+};
+
+// Streaming distribution of a value in constant memory: exact moments and extremes,
+// quantiles are estimated from a fine-binned histogram
+class Distribution {
+public:
+    qint64 count = 0;
+    qreal mean = 0, m2 = 0;             // Running mean and sum of squared deviations from it
+    qreal minimum = 0, maximum = 0;
+    Histogram histogram;
+
+    Distribution() = default;
+    Distribution(qreal low, qreal high, int bin_count) : histogram(low, high, bin_count) {}
+    void add(qreal value, qint64 weight = 1);
+    bool merge(const Distribution& other);
+    qreal variance() const { return count > 1 ? m2 / (count - 1) : 0; }
+    qreal deviation() const { return qSqrt(variance()); }
+    qreal quantile(qreal q) const { return histogram.quantile(q); }
+    QJsonObject to_json() const;
+    static Distribution from_json(const QJsonObject& json_file);
+};
+
+// Two-dimensional histogram of points over a rectangular area with several layers of values,
+// e.g. numbers of beams per status or sums of exit angles. Its memory is bounded by its resolution only.
+class Histogram2D {
+private:
+    qreal x_low_ = 0, x_high_ = 0, y_low_ = 0, y_high_ = 0;
+    int width_ = 0, height_ = 0, layers_ = 0;
+    QVector<qreal> bins;    // Layer by layer, row by row
+
+public:
+    Histogram2D() = default;
+    Histogram2D(qreal x_low, qreal x_high, qreal y_low, qreal y_high, int width, int height, int layers = 1)
+        : x_low_(x_low), x_high_(x_high), y_low_(y_low), y_high_(y_high)
+        , width_(width), height_(height), layers_(layers), bins(width * height * layers, 0) {}
+    void add(qreal x, qreal y, int layer, qreal weight = 1);
+    bool merge(const Histogram2D& other);
+    bool is_empty() const { return bins.isEmpty(); }
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int layers() const { return layers_; }
+    qreal x_low() const { return x_low_; }
+    qreal x_high() const { return x_high_; }
+    qreal y_low() const { return y_low_; }
+    qreal y_high() const { return y_high_; }
+    qreal value(int i, int j, int layer) const { return bins[(layer * height_ + j) * width_ + i]; }
+};
+
+// Distributions of the beams that passed the focon over the detector's window and sensitive surface.
+// Radii are binned up to the given radius, the maps cover the square around it.
+class SpotDiagram {
+public:
+    qreal radius = 0;
+    qint64 beams = 0;
+    qreal max_angle = 0;
+    Histogram2D window_map;             // Beams
+    Histogram2D detector_map;           // Layers: beams, sums of the angles of incidence
+    Histogram window_radii;
+    Histogram detector_radii;
+    Histogram incidence_angles = Histogram(0, 90, 180);     // Degrees
+
+    SpotDiagram() = default;
+    SpotDiagram(qreal radius, int resolution);
+    bool is_empty() const { return radius <= 0; }
+    void add(const Point& window_point, const Point& detector_point, qreal angle);
+    bool merge(const SpotDiagram& other);
+    QString to_csv() const;
+};
+
+// Results of a sampling run (exhaustive sampling or Monte Carlo method).
+// All the members are sums, so the statistics of separately calculated parts of the run can be merged.
+class SamplingStatistics {
+public:
+    qint64 passed = 0;                  // Detected beams
+    qint64 total = 0;
+    QVector<qint64> statuses = QVector<qint64>(BEAM_STATUSES, 0);  // Beams per BeamStatus, the failed ones included
+    qint64 failed = 0;                  // Beams whose path could not be calculated, not counted in the total
+    QVector<BeamFailure> failures;      // First of the failed beams, for diagnostics
+    qint64 single_precision = 0;        // Beams traced in single precision, not weighted
+    qint64 escalated = 0;               // Of them, the ones traced again in double precision
+    qreal detected_energy = 0;          // Shares of the energy reaching the detector summed over the detected beams, weighted
+    qreal squared_energy = 0;           // Sum of their squares, for the error of the energy loss
+    QVector<qint64> band_passed, band_total;    // Beams per spectral band in the dispersion mode, weighted
+    QVector<qreal> band_energy;         // Shares of the energy reaching the detector per band, weighted
+    Distribution exit_angles = Distribution(0, 90, 900);    // Exit angles of the beams passed the focon, degrees
+    Histogram detected_radii = Histogram(0, 1, 50);     // Entry radii of the detected beams relative to the entrance radius
+
+    SamplingStatistics() = default;
+    void add(BeamStatus status, qreal exit_angle, qreal entry_radius, qint64 weight = 1, qreal energy = 1);
+    void add_failure(const Beam& beam, BeamStatus status, qint64 weight = 1);
+    void add_band(int band, int bands, BeamStatus status, qint64 weight = 1, qreal energy = 1);
+    bool merge(const SamplingStatistics& other);
+    QPair<int, int> counts() const { return qMakePair(static_cast<int>(passed), static_cast<int>(total)); }
+    qreal loss() const;
+    qreal loss_error() const;
+    qreal energy_loss() const;
+    qreal energy_loss_error() const;
+    int bands() const { return band_total.size(); }
+    qreal band_loss(int band, bool energy = false) const;
+    qreal failure_rate() const { return failed + total > 0 ? static_cast<qreal>(failed) / (failed + total) : 0; }
+    QJsonObject to_json() const;
+    static SamplingStatistics from_json(const QJsonObject& json_file);
+};
+
+#endif // STATISTICS_H
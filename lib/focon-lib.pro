@@ -0,0 +1,22 @@
+QT       += core
+QT       -= gui
+
+TEMPLATE = lib
+CONFIG += c++14 shared
+CONFIG -= app_bundle
+
+TARGET = focon
+DEFINES += FOCON_LIBRARY
+
+include(..\engine.pri)
+
+SOURCES += \
+    focon.cpp
+
+HEADERS += \
+    focon.h
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/lib
+else: unix:!android: target.path = /opt/$${TARGET}/lib
+!isEmpty(target.path): INSTALLS += target
@@ -0,0 +1,159 @@
+#include "focon.h"
+#include <QThreadPool>
+#include <QThread>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QByteArray>
+#include "..\include\model.h"
+
+struct focon_scene {
+    Settings settings;
+    QByteArray error;
+};
+
+static_assert(FOCON_DEGENERATE_ROOT == DEGENERATE_ROOT && FOCON_VERTEX_HIT == VERTEX_HIT && FOCON_NON_TERMINATING == NON_TERMINATING
+              && FOCON_OUTSIDE == RAY_OUTSIDE && FOCON_INVALID == RAY_INVALID,
+              "The library's codes must match the engine's");
+
+namespace {
+
+int fail(focon_scene * scene, const QString& message) {
+    scene->error = message.toUtf8();
+    return -1;
+}
+
+// The engine builds its geometry from the settings, so the scene setup only validates and stores them
+int apply(focon_scene * scene, const Settings& settings) {
+    if (settings.d_in <= 0 || settings.d_out <= 0 || settings.length <= 0) {
+        return fail(scene, "Диаметры и длина фокона должны быть положительными");
+    }
+    scene->settings = settings;
+    scene->error.clear();
+    return 0;
+}
+
+int run(focon_scene * scene, int mode, double angle, int64_t count, int64_t * passed, int64_t * total) {
+    if (!scene) return -1;
+    Settings settings = scene->settings;
+    settings.mode = mode;
+    settings.angle = angle;
+    settings.beam_count = count;
+    Model model(settings);
+    Model::Result result = model.run();
+    if (result.failed) return fail(scene, result.message);
+    if (passed) *passed = result.counts.first;
+    if (total) *total = result.counts.second;
+    scene->error.clear();
+    return 0;
+}
+
+}
+
+focon_scene * focon_create(void) {
+    return new focon_scene();
+}
+
+void focon_destroy(focon_scene * scene) {
+    delete scene;
+}
+
+const char * focon_last_error(const focon_scene * scene) {
+    return scene ? scene->error.constData() : "";
+}
+
+int focon_load_settings(focon_scene * scene, const char * json) {
+    if (!scene || !json) return -1;
+    QJsonParseError parse_error;
+    QJsonDocument document = QJsonDocument::fromJson(QByteArray(json), &parse_error);
+    if (!document.isObject()) return fail(scene, parse_error.errorString());
+    QJsonObject json_file = scene->settings.to_json();
+    QJsonObject values = document.object();
+    for (auto it = values.constBegin(); it != values.constEnd(); ++it) {
+        json_file.insert(it.key(), it.value());
+    }
+    return apply(scene, Settings::from_json(json_file));
+}
+
+int focon_set_cone(focon_scene * scene, double d_in, double d_out, double length) {
+    if (!scene) return -1;
+    Settings settings = scene->settings;
+    settings.d_in = d_in;
+    settings.d_out = d_out;
+    settings.length = length;
+    return apply(scene, settings);
+}
+
+int focon_set_detector(focon_scene * scene, double window, double offset, double fov, double diameter) {
+    if (!scene) return -1;
+    Settings settings = scene->settings;
+    settings.aperture = window;
+    settings.offset_det = offset;
+    settings.fov = fov;
+    settings.d_det = diameter;
+    return apply(scene, settings);
+}
+
+int focon_set_lens(focon_scene * scene, int enabled, double focal_length, int auto_focus, int defocus) {
+    if (!scene) return -1;
+    Settings settings = scene->settings;
+    if (enabled && settings.glass) return fail(scene, "Линза может использоваться только в системах без стеклянного фокона");
+    settings.lens = enabled != 0;
+    settings.focal_length = focal_length;
+    settings.auto_focus = auto_focus != 0;
+    settings.defocus = defocus;
+    return apply(scene, settings);
+}
+
+int focon_set_ocular(focon_scene * scene, int enabled, double focal_length) {
+    if (!scene) return -1;
+    Settings settings = scene->settings;
+    if (enabled && settings.glass) return fail(scene, "Окуляр может использоваться только в системах без стеклянного фокона");
+    settings.ocular = enabled != 0;
+    settings.ocular_focal_length = focal_length;
+    return apply(scene, settings);
+}
+
+int focon_set_glass(focon_scene * scene, int enabled, double cavity_length) {
+    if (!scene) return -1;
+    Settings settings = scene->settings;
+    settings.glass = enabled != 0;
+    settings.cavity_length = settings.glass ? cavity_length : 0;
+    if (settings.glass) {
+        settings.lens = false;
+        settings.ocular = false;
+    }
+    return apply(scene, settings);
+}
+
+int focon_set_precision(focon_scene * scene, int high) {
+    if (!scene) return -1;
+    Settings settings = scene->settings;
+    settings.precision = high ? 1 : 0;
+    return apply(scene, settings);
+}
+
+void focon_set_threads(int count) {
+    QThreadPool::globalInstance()->setMaxThreadCount(count > 0 ? count : QThread::idealThreadCount());
+}
+
+int64_t focon_trace_batch(focon_scene * scene, const double * in, size_t n, uint8_t * status_out, double * exit_out) {
+    if (!scene) return -1;
+    if (n > 0 && (!in || !status_out)) return fail(scene, "Не заданы буферы лучей и исходов");
+    Settings settings = scene->settings;
+    settings.mode = EXTERNAL_RAYS;
+    Model model(settings);
+    scene->error.clear();
+    return model.trace_batch(in, static_cast<qint64>(n), status_out, exit_out);
+}
+
+double focon_loss(int64_t passed, int64_t total) {
+    return Model::loss(passed, total);
+}
+
+int focon_parallel_bundle(focon_scene * scene, double angle, int64_t * passed, int64_t * total) {
+    return run(scene, PARALLEL_BUNDLE, angle, 0, passed, total);
+}
+
+int focon_monte_carlo(focon_scene * scene, double angle, int64_t count, int64_t * passed, int64_t * total) {
+    return run(scene, MONTE_CARLO_METHOD, angle, count, passed, total);
+}
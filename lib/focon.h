@@ -0,0 +1,81 @@
+#ifndef FOCON_H
+#define FOCON_H
+/*
+ * C interface of the focon model for use from other languages without the GUI.
+ *
+ * A scene holds the parameters of the system in the same units as the program (mm, degrees).
+ * Calculations run on the engine's thread pool, the functions block until they are done.
+ * A scene must not be used from several threads at the same time.
+ * Functions returning int return 0 on success and -1 on error, see focon_last_error() (UTF-8).
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#  if defined(FOCON_LIBRARY)
+#    define FOCON_API __declspec(dllexport)
+#  else
+#    define FOCON_API __declspec(dllimport)
+#  endif
+#else
+#  define FOCON_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Outcomes written by focon_trace_batch */
+enum {
+    FOCON_REFLECTED = 0,    /* Failed to pass the focon */
+    FOCON_MISSED = 1,       /* Passed the focon but failed to hit the detector's surface */
+    FOCON_HIT = 2,          /* Hit the detector's surface outside of its FOV */
+    FOCON_DETECTED = 3,     /* Hit within the detector's FOV */
+    /* The path could not be calculated */
+    FOCON_DEGENERATE_ROOT = 4,  /* No proper intersection with the cone's surface */
+    FOCON_VERTEX_HIT = 5,       /* The ray hit the cavity's vertex */
+    FOCON_NON_TERMINATING = 6,  /* The ray did not leave the focon within the reflection limit */
+    FOCON_OUTSIDE = 254,    /* The ray misses the focon's entrance */
+    FOCON_INVALID = 255     /* The ray is not finite or does not go forward */
+};
+
+typedef struct focon_scene focon_scene;
+
+FOCON_API focon_scene * focon_create(void);
+FOCON_API void focon_destroy(focon_scene * scene);
+FOCON_API const char * focon_last_error(const focon_scene * scene);
+
+/* Whole settings in the format of the .foc files, missing keys keep their values */
+FOCON_API int focon_load_settings(focon_scene * scene, const char * json);
+
+/* Scene setup */
+FOCON_API int focon_set_cone(focon_scene * scene, double d_in, double d_out, double length);
+FOCON_API int focon_set_detector(focon_scene * scene, double window, double offset, double fov, double diameter);
+FOCON_API int focon_set_lens(focon_scene * scene, int enabled, double focal_length, int auto_focus, int defocus);
+FOCON_API int focon_set_ocular(focon_scene * scene, int enabled, double focal_length);
+FOCON_API int focon_set_glass(focon_scene * scene, int enabled, double cavity_length);
+FOCON_API int focon_set_precision(focon_scene * scene, int high);
+
+/* Number of the pool's threads, 0 restores the default */
+FOCON_API void focon_set_threads(int count);
+
+/*
+ * Traces n rays given as (x, y, dx, dy, dz) in the entrance plane: 5*n doubles.
+ * Writes an outcome per ray into status_out and, if exit_out is not null, 6*n doubles
+ * (x, y, z, dx, dy, dz) of the point where the beam leaves the focon, NaN for the rays not traced.
+ * Returns the number of detected rays or -1 on error.
+ */
+FOCON_API int64_t focon_trace_batch(focon_scene * scene, const double * in, size_t n, uint8_t * status_out, double * exit_out);
+
+/* Loss in dB for the given numbers of detected and all rays */
+FOCON_API double focon_loss(int64_t passed, int64_t total);
+
+/* Parallel bundle at the given angle and Monte Carlo method within +-angle, count = 0 means the precision's default */
+FOCON_API int focon_parallel_bundle(focon_scene * scene, double angle, int64_t * passed, int64_t * total);
+FOCON_API int focon_monte_carlo(focon_scene * scene, double angle, int64_t count, int64_t * passed, int64_t * total);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FOCON_H */
@@ -0,0 +1,78 @@
+#include "..\include\beams_item.h"
+
+void BeamsItem::include_in_bounds(const QLineF& line) {
+    // Points are zero-length segments, so the bounds are tracked by coordinates rather than by united rectangles
+    qreal left = qMin(line.x1(), line.x2()), right = qMax(line.x1(), line.x2());
+    qreal top = qMin(line.y1(), line.y2()), bottom = qMax(line.y1(), line.y2());
+    if (lines_count++ == 0) {
+        bounds = QRectF(QPointF(left, top), QPointF(right, bottom));
+    } else {
+        bounds.setCoords(qMin(left, bounds.left()), qMin(top, bounds.top()),
+                         qMax(right, bounds.right()), qMax(bottom, bounds.bottom()));
+    }
+}
+
+void BeamsItem::set_projection(const Projection& new_projection) {
+    prepareGeometryChange();
+    projection = new_projection;
+    lines_count = 0;
+    bounds = QRectF();
+    for (int i = 0; i < vertices.size(); ++i) {
+        const auto& color_vertices = vertices[i];
+        auto& color_lines = lines[i];
+        for (int j = 0; j < color_lines.size(); ++j) {
+            color_lines[j] = QLineF(projection.map(color_vertices[2*j]), projection.map(color_vertices[2*j + 1]));
+            include_in_bounds(color_lines[j]);
+        }
+    }
+    update();
+}
+
+void BeamsItem::add_segment(const Point& p1, const Point& p2, const QColor& color) {
+    auto it = color_index.constFind(color.rgba());
+    int index;
+    if (it == color_index.constEnd()) {
+        index = colors.size();
+        color_index.insert(color.rgba(), index);
+        colors.push_back(color);
+        vertices.push_back(QVector<Point>());
+        lines.push_back(QVector<QLineF>());
+    } else index = it.value();
+
+    QLineF line = QLineF(projection.map(p1), projection.map(p2));
+    vertices[index].push_back(p1);
+    vertices[index].push_back(p2);
+    lines[index].push_back(line);
+
+    // The scene has to be notified before the bounding rectangle grows
+    bool inside = lines_count > 0
+            && qMin(line.x1(), line.x2()) >= bounds.left() && qMax(line.x1(), line.x2()) <= bounds.right()
+            && qMin(line.y1(), line.y2()) >= bounds.top() && qMax(line.y1(), line.y2()) <= bounds.bottom();
+    if (!inside) prepareGeometryChange();
+    include_in_bounds(line);
+    update(QRectF(line.p1(), line.p2()).normalized().adjusted(-1, -1, 1, 1));
+}
+
+void BeamsItem::clear() {
+    prepareGeometryChange();
+    colors.clear();
+    vertices.clear();
+    lines.clear();
+    color_index.clear();
+    bounds = QRectF();
+    lines_count = 0;
+}
+
+QRectF BeamsItem::boundingRect() const {
+    // Margins for the pen's width
+    return bounds.adjusted(-1, -1, 1, 1);
+}
+
+void BeamsItem::paint(QPainter * painter, const QStyleOptionGraphicsItem * option, QWidget * widget) {
+    Q_UNUSED(option);
+    Q_UNUSED(widget);
+    for (int i = 0; i < colors.size(); ++i) {
+        painter->setPen(QPen(colors[i]));
+        painter->drawLines(lines[i]);
+    }
+}
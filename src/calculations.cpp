@@ -1,22 +1,211 @@
-#include "..\include\mainwindow.h"
-#include "ui_mainwindow.h"
-
-void MainWindow::init_objects() {
-    init_cone(ui->d_in->value(), ui->d_out->value(), ui->length->value());
-    detector = Detector(ui->aperture->value(), ui->length->value(), ui->offset_det->value(),
-                        ui->fov->value(), ui->d_det->value());
-    qreal focus = lens_focus(ui->auto_focus->isChecked());
+#include "..\include\model.h"
+#include "..\include\reference.h"
+#include <QtConcurrent>
+#include <QThreadPool>
+#include <QMutex>
+#include <QRandomGenerator>
+#include <QHash>
+#include <QJsonDocument>
+#include <QFileInfo>
+#include <QDir>
+#include <QDebug>
+#include <algorithm>
+#include <numeric>
+
+static const char * tolerance_keys[TOLERANCES] = {"D1 tolerance", "D2 tolerance", "Length tolerance",
+                                                  "Detector's offset tolerance", "Focal length tolerance"};
+
+Settings Settings::from_json(const QJsonObject& json_file) {
+    Settings settings;
+    settings.d_in = json_file.value("D1").toDouble(settings.d_in);
+    settings.d_out = json_file.value("D2").toDouble(settings.d_out);
+    settings.length = json_file.value("Length").toDouble(settings.length);
+    settings.angle = json_file.value("Angle").toDouble(settings.angle);
+    settings.x_offset = json_file.value("X offset").toDouble(settings.x_offset);
+    settings.y_offset = json_file.value("Y offset").toDouble(settings.y_offset);
+    settings.aperture = json_file.value("Detector's window").toDouble(settings.aperture);
+    settings.offset_det = json_file.value("Detector's offset").toDouble(settings.offset_det);
+    settings.fov = json_file.value("Detector's FOV").toDouble(settings.fov);
+    settings.d_det = json_file.value("Detector's diameter").toDouble(settings.d_det);
+    settings.mode = json_file.value("Mode").toInt(settings.mode);
+    settings.rotation = json_file.value("Rotation").toInt(settings.rotation);
+    settings.lens = json_file.value("Lens").toBool(settings.lens);
+    settings.focal_length = json_file.value("Focal length").toDouble(settings.focal_length);
+    settings.auto_focus = json_file.value("Auto focus").toBool(settings.auto_focus);
+    settings.defocus = json_file.value("Defocus").toDouble(settings.defocus);
+    settings.ocular = json_file.value("Ocular").toBool(settings.ocular);
+    settings.ocular_focal_length = json_file.value("Ocular focal length").toDouble(settings.ocular_focal_length);
+    settings.glass = json_file.value("Glass").toBool(settings.glass);
+    settings.cavity_length = settings.glass ? json_file.value("Cavity length").toDouble(settings.cavity_length) : 0;
+    settings.precision = json_file.value("Precision").toInt(settings.precision);
+    settings.budget = json_file.value("Budget").toBool(settings.budget);
+    settings.time_limit = json_file.value("Time limit").toInt(settings.time_limit);
+    settings.beam_limit = json_file.value("Beam limit").toInt(settings.beam_limit);
+    settings.beam_count = static_cast<qint64>(json_file.value("Beam count").toDouble(settings.beam_count));
+    settings.rays_file = json_file.value("Rays file").toString(settings.rays_file);
+    settings.single_precision = json_file.value("Single precision").toBool(settings.single_precision);
+    settings.energy = json_file.value("Energy").toBool(settings.energy);
+    settings.wall_reflectivity = json_file.value("Wall reflectivity").toDouble(settings.wall_reflectivity);
+    settings.absorption = json_file.value("Absorption").toDouble(settings.absorption);
+    Glass::from_json(json_file.value("Glass material").toObject(), settings.material);
+    settings.wavelength = json_file.value("Wavelength").toDouble(settings.wavelength);
+    settings.wavelength_min = json_file.value("Minimal wavelength").toDouble(settings.wavelength_min);
+    settings.wavelength_max = json_file.value("Maximal wavelength").toDouble(settings.wavelength_max);
+    settings.bands = json_file.value("Bands").toInt(settings.bands);
+    for (int i = 0; i < TOLERANCES; ++i) {
+        settings.tolerances[i] = qMax<qreal>(0, json_file.value(tolerance_keys[i]).toDouble(settings.tolerances[i]));
+    }
+    settings.normal_tolerances = json_file.value("Normal tolerances").toBool(settings.normal_tolerances);
+    settings.designs = json_file.value("Designs").toInt(settings.designs);
+    settings.scan_parameter = qBound<int>(0, json_file.value("Scan parameter").toInt(settings.scan_parameter), SENSITIVITY_PARAMETERS - 1);
+    settings.scan_from = json_file.value("Scan start").toDouble(settings.scan_from);
+    settings.scan_to = json_file.value("Scan end").toDouble(settings.scan_to);
+    settings.scan_points = json_file.value("Scan points").toInt(settings.scan_points);
+    if (json_file.contains("Defocusing")) { // This subfunction provides backwards compatibility with older save files
+        auto def = json_file.value("Defocusing").toString();
+        settings.defocus = def == "plus" ? 1 : def == "minus" ? -1 : 0;
+    }
+    // The lens can be used in glass-free systems only
+    if (settings.glass) {
+        settings.lens = false;
+        settings.ocular = false;
+    }
+    // The same bounds are used by the interface for the focal length input
+    settings.focal_length_min = settings.d_in;
+    settings.focal_length_max = settings.length + 100;
+    return settings;
+}
+
+QJsonObject Settings::to_json() const {
+    QJsonObject json_file = {
+             {"D1", d_in},
+             {"D2", d_out},
+             {"Length", length},
+             {"Angle", angle},
+             {"X offset", x_offset},
+             {"Y offset", y_offset},
+             {"Detector's window", aperture},
+             {"Detector's offset", offset_det},
+             {"Detector's FOV", fov},
+             {"Detector's diameter", d_det},
+             {"Mode", mode},
+             {"Rotation", rotation},
+             {"Lens", lens},
+             {"Focal length", focal_length},
+             {"Auto focus", auto_focus},
+             {"Defocus", defocus},
+             {"Ocular", ocular},
+             {"Ocular focal length", ocular_focal_length},
+             {"Glass", glass},
+             {"Cavity length", cavity_length},
+             {"Precision", precision},
+             {"Budget", budget},
+             {"Time limit", time_limit},
+             {"Beam limit", beam_limit},
+             {"Beam count", static_cast<double>(beam_count)},
+             {"Rays file", rays_file},
+             {"Single precision", single_precision},
+             {"Energy", energy},
+             {"Wall reflectivity", wall_reflectivity},
+             {"Absorption", absorption},
+             {"Glass material", material.to_json()},
+             {"Wavelength", wavelength},
+             {"Minimal wavelength", wavelength_min},
+             {"Maximal wavelength", wavelength_max},
+             {"Bands", bands},
+             {"Normal tolerances", normal_tolerances},
+             {"Designs", designs},
+             {"Scan parameter", scan_parameter},
+             {"Scan start", scan_from},
+             {"Scan end", scan_to},
+             {"Scan points", scan_points}
+           };
+    for (int i = 0; i < TOLERANCES; ++i) {
+        json_file.insert(tolerance_keys[i], tolerances[i]);
+    }
+    return json_file;
+}
+
+QString Settings::fingerprint() const {
+    // Parameters varied by the optimisers and purely visual ones do not affect the stored candidates' results
+    QJsonObject json_file = to_json();
+    for (const auto& key : {"D2", "Length", "Focal length", "Mode", "Rotation", "Budget", "Time limit", "Beam limit"}) {
+        json_file.remove(key);
+    }
+    return QJsonDocument(json_file).toJson(QJsonDocument::Compact);
+}
+
+QString Settings::sampling_fingerprint() const {
+    // Every parameter of the system affects the sampling results, only the visual ones and the limits do not
+    QJsonObject json_file = to_json();
+    for (const auto& key : {"Rotation", "Budget", "Time limit", "Beam limit"}) {
+        json_file.remove(key);
+    }
+    return QJsonDocument(json_file).toJson(QJsonDocument::Compact);
+}
+
+QVector<qreal> Settings::band_wavelengths() const {
+    // Centres of the equal bands the spectral range is divided into
+    QVector<qreal> wavelengths;
+    for (int k = 0; k < bands; ++k) {
+        wavelengths.push_back(wavelength_min + (k + 0.5) * (wavelength_max - wavelength_min) / bands);
+    }
+    return wavelengths;
+}
+
+QString Settings::glass_error() const {
+    // Sellmeier's formula has poles at its Cᵢ and Cauchy's one at zero, so the index may come out undefined or below unity
+    if (!glass) return QString();
+    QVector<qreal> wavelengths = {wavelength};
+    if (!is_optimisation(mode)) wavelengths += band_wavelengths();
+    for (qreal value : wavelengths) {
+        if (!(value > 0)) return "Некорректная длина волны: " + QString().setNum(value) + " мкм.";
+        qreal n = material.n(value);
+        if (!qIsFinite(n) || n < 1) {
+            return "Некорректный показатель преломления стекла на длине волны " + QString().setNum(value) + " мкм: n = " + QString().setNum(n) + ".";
+        }
+    }
+    return QString();
+}
+
+static BeamStatus failure_status(IntersectionStatus status) {
+    return status == INTERSECTION_VERTEX ? VERTEX_HIT : DEGENERATE_ROOT;
+}
+
+Model::Model(const Settings& settings, QObject * parent)
+    : QObject(parent)
+    , settings(settings)
+    , lens(Lens(1))
+{
+    // Limits are given in seconds and in thousands of beams
+    if (settings.budget) {
+        budget.set_limits(settings.time_limit * 1000, static_cast<qint64>(settings.beam_limit) * 1000);
+    }
+    init_objects();
+}
+
+Model::~Model() {
+    delete cone;
+    delete cavity;
+}
+
+void Model::init_objects() {
+    init_cone(settings.d_in, settings.d_out, settings.length);
+    detector = Detector(settings.aperture, settings.length, settings.offset_det,
+                        settings.fov, settings.d_det);
+    qreal focus = lens_focus(settings.auto_focus);
     lens.set_focus(focus);
-    ui->focal_length->setValue(focus);
-    ocular = Lens(ui->ocular_focal_length->value(), cone->length());
+    settings.focal_length = focus;
+    ocular = Lens(settings.ocular_focal_length, cone->length());
     init_cavity(cone);
+    init_bands();
 }
 
-Point MainWindow::starting_point() const { return Point(-ui->offset->value(), -ui->height->value(), 0); }
+Point Model::starting_point() const { return Point(-settings.x_offset, -settings.y_offset, 0); }
 
-Beam MainWindow::starting_beam() const { return Beam(starting_point(), ui->angle->value()); }
+Beam Model::starting_beam() const { return Beam(starting_point(), settings.angle); }
 
-void MainWindow::init_cone(qreal d1, qreal d2, qreal length) {
+void Model::init_cone(qreal d1, qreal d2, qreal length) {
     bool different_diameters = qFabs(d1 - d2) > 1e-6;
     bool type_change_needed = cone && different_diameters != cone->is_conic();
     if (type_change_needed) {
@@ -32,115 +221,434 @@ void MainWindow::init_cone(qreal d1, qreal d2, qreal length) {
         cone->set_d2(d2);
         cone->set_length(length);
     }
-    if (ui->glass->isChecked()) {
-        cone->set_n(1.5);
+    if (settings.glass) {
+        cone->set_n(settings.material.n(settings.wavelength));
     }
 }
 
-qreal MainWindow::lens_focus(bool auto_focus) const {
+qreal Model::lens_focus(bool auto_focus) const {
     if (auto_focus) {
-        return detector.detector_z() * (cone->r1()/(cone->r1() - detector.r() * ui->defocus->value()));
-    } else return ui->focal_length->value();
+        return detector.detector_z() * (cone->r1()/(cone->r1() - detector.r() * settings.defocus));
+    } else return settings.focal_length;
 }
 
-void MainWindow::init_cavity(Tube* glass_cone) {
-    bool cavity_is_needed = ui->glass->isChecked() && ui->cavity_length->value() > 0;
+void Model::init_cavity(Tube* glass_cone) {
+    bool cavity_is_needed = settings.glass && settings.cavity_length > 0;
     if (cavity_is_needed) {
-        qreal z = glass_cone->length() - ui->cavity_length->value();
+        qreal z = glass_cone->length() - settings.cavity_length;
         if (cavity) {
             *cavity = Cone(1,1,1);
             cavity->set_d1(0);
             cavity->set_d2(cone->d2());
-            cavity->set_length(ui->cavity_length->value());
+            cavity->set_length(settings.cavity_length);
             cavity->set_z(z);
-        } else cavity = new Cone(0, cone->d2(), ui->cavity_length->value(), z);
+        } else cavity = new Cone(0, cone->d2(), settings.cavity_length, z);
+        cavity->set_n(glass_cone->n());
     } else if (cavity) {
         delete cavity;
         cavity = nullptr;
     }
 }
 
-void MainWindow::build() {
-    clear();
-    points.clear();
-    statuses.clear();
-    beam_angles.clear();
-    init_graphics();
-    ui->rotation->setEnabled(ui->mode->currentIndex() < EXHAUSTIVE_SAMPLING);
+void Model::init_bands() {
+    // The hollow focons and the lenses have no dispersion, so every band keeps the design path.
+    // The optimisers compare the candidates at the design wavelength only
+    band_indices.clear();
+    if (is_optimisation(settings.mode)) return;
+    for (qreal wavelength : settings.band_wavelengths()) {
+        band_indices.push_back(settings.glass ? settings.material.n(wavelength) : cone->n());
+    }
+}
 
-    try {
-        switch (ui->mode->currentIndex()) {
+Model::Result Model::run() {
+    Result result;
+    result.message = settings.glass_error();
+    if (!result.message.isEmpty()) {
+        result.failed = true;
+        return result;
+    }
+#ifdef FOCON_PROFILING
+    Profile profile;
+    ProfileScope profile_scope(&profile);
+#endif
+    budget.start();
+    failure_counts = QVector<qint64>(BEAM_STATUSES, 0);
+    failure_samples.clear();
+    single_precision_beams = escalated_beams = 0;
+    int resumed_candidates = 0;
+    {
+        PROFILE_STAGE(STAGE_SETUP);
+        if (is_optimisation(settings.mode) && !settings.path.isEmpty()) {
+            if (checkpoint.open(Checkpoint::path_for(settings.path), settings.fingerprint())) {
+                resumed_candidates = checkpoint.size();
+            }
+        }
+        init_density();
+    }
+    {
+        PROFILE_STAGE(STAGE_TRACE);
+        switch (settings.mode) {
         case SINGLE_BEAM_CALCULATION:
             if (starting_point().is_in_radius(cone->r1())) {
                 Beam beam = starting_beam();
-                single_beam_status = calculate_single_beam_path(beam);
-                draw(ui->rotation->value());
-                if (points.size() > 1) {
-                    ui->statusbar->showMessage("Количество отражений: " + QString().setNum(points.size() - 2 - static_cast<int>(ui->ocular->isChecked())));
-                }
-            } else ui->statusbar->showMessage("Заданная точка входа луча находится вне апертуры.");
+                qreal energy = 1;
+                result.status = calculate_single_beam_path(beam, result.path, &energy);
+                if (is_failure(result.status)) {
+                    result.message = "Не удалось рассчитать ход луча: " + failure_name(result.status) + ".";
+                } else if (result.path.size() > 1) {
+                    result.message = "Количество отражений: " + QString().setNum(result.path.size() - 2 - static_cast<int>(settings.ocular));
+                    if (settings.energy) {
+                        result.message += ". Доля сохранённой энергии: " + QString().setNum(energy * 100) + "%";
+                    }
+                } else result.message = "Некорректный входной угол";
+            } else result.message = "Заданная точка входа луча находится вне апертуры.";
             break;
         case PARALLEL_BUNDLE:
-            draw_axes(ui->rotation->value());
-            show_results(calculate_parallel_beams(ui->angle->value()));
+            result.counts = calculate_parallel_beams(settings.angle, &result.exit_angles);
+            result.message = results_message(result.counts.first, result.counts.second, coverage);
             break;
         case PARALLEL_BUNDLE_EXIT:
-            draw_axes(ui->rotation->value());
-            calculate_parallel_beams(ui->angle->value());
-            if (!beam_angles.empty()) {
-                show_results(mean_exit_angle());
-            } else ui->statusbar->showMessage("Ни один луч не достиг выходной апертуры.");
-            break;
-        case DIVERGENT_BUNDLE:
-            draw_axes(ui->rotation->value());
-            show_results(calculate_divergent_beams(starting_point()));
+            calculate_parallel_beams(settings.angle, &result.exit_angles);
+            result.mean_angle = result.exit_angles.mean;
+            result.message = result.exit_angles.count > 0
+                    ? results_message(result.exit_angles)
+                    : "Ни один луч не достиг выходной апертуры.";
             break;
+        case DIVERGENT_BUNDLE: {
+            auto statistics = calculate_divergent_beams(starting_point());
+            result.counts = statistics.counts();
+            result.exit_angles = statistics.exit_angles;
+            result.energy_loss = statistics.energy_loss();
+            result.bands = band_losses(statistics);
+            result.message = results_message(statistics.passed, statistics.total, coverage) + energy_message(statistics)
+                    + bands_message(result.bands);
+        } break;
         case EXHAUSTIVE_SAMPLING:
-            show_results(calculate_every_beam());
+        case MONTE_CARLO_METHOD: {
+            auto statistics = settings.mode == EXHAUSTIVE_SAMPLING ? sample_every_beam() : monte_carlo_method();
+            result.counts = statistics.counts();
+            result.exit_angles = statistics.exit_angles;
+            result.energy_loss = statistics.energy_loss();
+            result.bands = band_losses(statistics);
+            result.message = results_message(statistics.passed, statistics.total, coverage) + energy_message(statistics)
+                    + bands_message(result.bands);
+        } break;
+        case SPOT_DIAGRAM: {
+            // The spot should contain the beams that miss the detector as well, hence the margin
+            qreal radius = 2 * qMax(qMax(cone->r2(), detector.r()), detector.window_radius());
+            result.spot = SpotDiagram(radius, spot_resolution);
+            auto statistics = monte_carlo_method(Shard(), &result.spot);
+            result.counts = statistics.counts();
+            result.exit_angles = statistics.exit_angles;
+            result.density = result.spot.detector_map;
+            result.energy_loss = statistics.energy_loss();
+            result.bands = band_losses(statistics);
+            result.message = results_message(statistics.passed, statistics.total, coverage) + energy_message(statistics)
+                    + bands_message(result.bands) + " " + results_message(result.spot);
+        } break;
+        case EXTERNAL_RAYS: {
+            qint64 outside = 0, invalid = 0;
+            QString status_path, error;
+            auto statistics = trace_ray_file(outside, invalid, status_path, error);
+            if (!error.isEmpty()) {
+                result.message = error;
+                result.failed = true;
+                break;
+            }
+            // Rays missing the entrance are lost as well
+            result.counts = qMakePair(static_cast<int>(statistics.passed), static_cast<int>(statistics.total + outside));
+            result.exit_angles = statistics.exit_angles;
+            result.message = results_message(statistics.passed, statistics.total + outside, coverage);
+            if (outside > 0) {
+                result.message += " Лучей вне входной апертуры: " + QString().setNum(outside)
+                        + ", потери в фоконе: " + QString().setNum(statistics.loss()) + " дБ.";
+            }
+            if (invalid > 0) {
+                result.message += " Некорректных записей: " + QString().setNum(invalid) + ".";
+            }
+            result.energy_loss = statistics.energy_loss();
+            result.message += energy_message(statistics);
+            result.bands = band_losses(statistics);
+            result.message += bands_message(result.bands);
+            if (!status_path.isEmpty()) {
+                result.message += " Исходы лучей записаны в файл " + status_path + ".";
+            }
+        } break;
+        case REVERSE_TRACING:
+            if (cavity) {
+                result.message = "Обратная трассировка недоступна для фокона с полостью: преломление на стенке полости в модели необратимо.";
+            } else if (qFabs(settings.angle) < 1e-6) {
+                result.message = "Для обратной трассировки необходим ненулевой входной угол.";
+            } else {
+                qreal loss_error = 0;
+                auto statistics = reverse_tracing(result.acceptance, loss_error);
+                result.counts = statistics.counts();
+                result.exit_angles = statistics.exit_angles;
+                result.message = reverse_results_message(statistics, result.acceptance, loss_error);
+            }
+            break;
+        case TOLERANCE_ANALYSIS:
+            result.design_losses = tolerance_analysis(result.counts, result.sensitivities);
+            result.message = tolerance_message(result.counts, result.design_losses, result.sensitivities);
             break;
-        case MONTE_CARLO_METHOD:
-            show_results(monte_carlo_method());
+        case SENSITIVITY_ANALYSIS:
+            result.gradients = sensitivity_analysis(result.counts, result.slices);
+            result.message = sensitivity_message(result.gradients);
+            break;
+        case ANGLE_SCAN:
+            if (qFabs(settings.angle) < 1e-6) {
+                result.message = "Для расчёта пропускания по углу необходим ненулевой входной угол: он задаёт верхнюю границу диапазона.";
+            } else {
+                result.curve = angle_scan();
+                // The row's counts are the ones of the largest angle evaluated: the points finish out of order,
+                // so the budget may leave the largest angles without beams
+                for (int i = result.curve.counts.size() - 1; i >= 0; --i) {
+                    if (result.curve.counts[i].second > 0) {
+                        result.counts = result.curve.counts[i];
+                        break;
+                    }
+                }
+                result.message = scan_message(result.curve);
+            }
+            break;
+        case PARAMETER_SCAN:
+            // The cavity can be scanned from the solid glass focon on
+            if (settings.scan_parameter == SENSITIVITY_CAVITY_LENGTH ? !settings.glass : !is_applicable(settings.scan_parameter)) {
+                result.message = "Параметр «" + parameter_name(settings.scan_parameter) + "» не используется в текущей системе.";
+            } else {
+                result.curve = parameter_scan();
+                result.message = scan_message(result.curve);
+                // The row's counts are the ones of the best point
+                qreal best = qInf();
+                for (const auto& point : result.curve.counts) {
+                    if (point.first > 0 && loss(point) < best) {
+                        best = loss(point);
+                        result.counts = point;
+                    }
+                }
+            }
             break;
         case LENGTH_OPTIMISATION:
-            show_results(optimal_length());
+            result.parameters = optimal_length();
+            result.curve = curve;
+            result.message = results_message(result.parameters);
             break;
         case D_OUT_OPTIMISATION:
-            show_results(optimal_d_out());
+            result.parameters = optimal_d_out();
+            result.curve = curve;
+            result.message = results_message(result.parameters);
             break;
         case FOCUS_OPTIMISATION:
-            if (ui->lens->isChecked()) {
-                show_results(optimal_focus());
-            } else ui->statusbar->showMessage("Для оптимизации линзы необходимо включить её в систему.");
+            if (settings.lens) {
+                result.parameters = optimal_focus();
+                result.curve = curve;
+                result.message = results_message(result.parameters);
+            } else result.message = "Для оптимизации линзы необходимо включить её в систему.";
             break;
         case FULL_OPTIMISATION:
-            show_results(full_optimisation());
+            result.parameters = full_optimisation();
+            result.message = results_message(result.parameters);
             break;
         default:
             break;
         }
-    } catch (Beam& beam) {
-        ui->statusbar->showMessage("Возникла ошибка при вычислении хода луча: x = " + QString().setNum(-beam.x())
-                                   + ", y = " + QString().setNum(-beam.y()) + ", входной угол = " + QString().setNum(beam.gamma()));
     }
+    // Failed beams are left out of the results, the run goes on without them
+    result.failures = std::accumulate(failure_counts.begin(), failure_counts.end(), qint64(0));
+    result.failure_samples = failure_samples;
+    if (result.failures > 0 && settings.mode != SINGLE_BEAM_CALCULATION) {
+        result.message += failures_message(failure_counts, budget.traced());
+    }
+    result.single_precision_beams = single_precision_beams;
+    result.escalated = escalated_beams;
+    if (single_precision_beams > 0) {
+        result.message += " В одинарной точности рассчитано лучей: " + QString().setNum(single_precision_beams)
+                + ", из них вблизи границ решения пересчитано в двойной: " + QString().setNum(escalated_beams)
+                + " (" + QString().setNum(100.0 * escalated_beams / single_precision_beams, 'g', 3) + "%).";
+    }
+    if (resumed_candidates > 0) {
+        result.message += " Расчёт продолжен с контрольной точки, взято готовых результатов: " + QString().setNum(resumed_candidates) + ".";
+    }
+    result.coverage = is_optimisation(settings.mode) ? result.parameters.coverage : coverage;
+    result.elapsed = budget.elapsed();
+    result.beams = budget.traced();
+    result.density = density;
+#ifdef FOCON_PROFILING
+    result.performance = profile.to_json();
+#endif
+    // Interrupted runs keep their checkpoint for resuming, completed ones do not need it anymore.
+    // The candidates are never cut short, so a limit reached during the last one does not leave the search unfinished
+    if (result.coverage < 1 || budget.is_cancelled()) {
+        checkpoint.close();
+    } else checkpoint.remove();
+    return result;
+}
+
+ShardResult Model::run_shard(const Shard& shard) {
+    // Only the sampling modes can be split into independent parts
+    ShardResult result;
+    result.fingerprint = settings.sampling_fingerprint();
+    result.mode = settings.mode;
+    result.shard = shard;
+    budget.start();
+    if (settings.mode == EXHAUSTIVE_SAMPLING) {
+        result.statistics = sample_every_beam(shard);
+    } else if (settings.mode == MONTE_CARLO_METHOD) {
+        result.statistics = monte_carlo_method(shard);
+    }
+    result.planned = work_planned;
+    result.done = work_done;
+    result.elapsed = budget.elapsed();
+    return result;
+}
+
+template <typename Function>
+void Model::parallel_for(qint64 count, qint64 chunk_size, Function function) const {
+    // Splits the range [0, count) into chunks processed by the thread pool as function(begin, end, chunk)
+    QVector<QFuture<void>> futures;
+#ifdef FOCON_PROFILING
+    QMutex mutex;
+    // Every chunk counts into its own profile, which is added to the caller's one when the chunk is done
+    Profile * parent_profile = Profile::current();
+#endif
+    for (qint64 chunk = 0, begin = 0; begin < count; ++chunk, begin += chunk_size) {
+        qint64 end = qMin(begin + chunk_size, count);
+        futures.push_back(QtConcurrent::run(QThreadPool::globalInstance(), [&, begin, end, chunk]() {
+#ifdef FOCON_PROFILING
+            Profile chunk_profile;
+            ProfileScope profile_scope(parent_profile ? &chunk_profile : nullptr);
+#endif
+            function(begin, end, chunk);
+#ifdef FOCON_PROFILING
+            if (parent_profile) {
+                QMutexLocker locker(&mutex);
+                parent_profile->merge(chunk_profile);
+            }
+#endif
+        }));
+    }
+    // Waiting for an unstarted task runs it in the current thread, so nested calls cannot starve the pool
+    for (auto& future : futures) {
+        future.waitForFinished();
+    }
+}
+
+void Model::report_progress(qreal done, const QPair<qint64, qint64>& counts, const Parameters& best) {
+    // Progress is reported at most every 100 ms whichever thread calls it
+    qint64 now = budget.elapsed();
+    qint64 last = last_progress.load();
+    if (now - last < 100 || !last_progress.compare_exchange_strong(last, now)) return;
+
+    Progress current;
+    current.beams = budget.traced();
+    current.candidates = candidates;
+    current.done = done;
+    current.eta = done > 0 ? static_cast<qint64>(now * (1 - done) / done) : -1;
+    current.counts = counts;
+    current.best = best;
+    emit progress(current);
 }
 
-void MainWindow::transformation_on_entrance(Beam& beam) {
-    if (ui->lens->isChecked()) {
+void Model::init_density() {
+    // Entry points are mapped per status, while exit points are weighted by the beams' exit angles
+    switch (settings.mode) {
+    case PARALLEL_BUNDLE:
+    case MONTE_CARLO_METHOD:
+    case REVERSE_TRACING:
+        density = Histogram2D(-cone->r1(), cone->r1(), -cone->r1(), cone->r1(), density_resolution, density_resolution, DETECTED + 1);
+        break;
+    case PARALLEL_BUNDLE_EXIT:
+        density = Histogram2D(-cone->r2(), cone->r2(), -cone->r2(), cone->r2(), density_resolution, density_resolution, 2);
+        break;
+    default:
+        density = Histogram2D();
+        break;
+    }
+}
+
+void Model::accumulate_density(const QVector<BeamRecord>& records, bool mirrored) {
+    PROFILE_STAGE(STAGE_DENSITY);
+    QMutexLocker locker(&density_mutex);
+    for (const auto& record : records) {
+        // The parallel bundles are simmetrical relative to y axis so only one half of them is calculated
+        int copies = mirrored && qFabs(record.point.x()) > 1e-6 ? 2 : 1;
+        for (int k = 0; k < copies; ++k) {
+            const Point point = k == 0 ? record.point : record.point.x_pair();
+            if (settings.mode == PARALLEL_BUNDLE_EXIT) {
+                density.add(point.x(), point.y(), 0);
+                density.add(point.x(), point.y(), 1, record.angle);
+            } else density.add(point.x(), point.y(), record.status);
+        }
+    }
+    // Interim maps are sent at most every 100 ms, the copy shares the data until the next batch
+    qint64 now = budget.elapsed();
+    if (now - last_density >= 100) {
+        last_density = now;
+        emit density_calculated(density);
+    }
+}
+
+void Model::transformation_on_entrance(Beam& beam, qreal& energy, qreal n) const {
+    if (settings.lens) {
         beam = lens.refracted(beam);
-    } else if (ui->glass->isChecked()) {
-        beam = cone->entrance().refracted(beam, 1, 1.5);
+    } else if (settings.glass) {
+        if (settings.energy) energy *= 1 - fresnel_reflectance(beam.cos_g(), 1, n);
+        beam = cone->entrance().refracted(beam, 1, n);
     }
 }
 
-void MainWindow::reflection_cycle(Beam& beam, const Beam& original_beam) {
-    while(true) {
+void Model::attenuate(qreal& energy, const Point& from, const Point& to) const {
+    // Bulk absorption of the glass along the beam's path
+    if (settings.absorption <= 0) return;
+    qreal distance = qSqrt(qPow(to.x() - from.x(), 2) + qPow(to.y() - from.y(), 2) + qPow(to.z() - from.z(), 2));
+    energy *= qExp(-settings.absorption * distance);
+}
+
+bool Model::survives_roulette(qreal& energy, const Beam& original_beam, int event) const {
+    // Russian roulette: a beam carrying little energy is either stopped or goes on with the energy of the stopped ones.
+    // The random number depends on the beam only, so the results do not depend on the threads' scheduling.
+    // The single beam and the parallel bundles need the complete paths
+    bool complete_paths = settings.mode == SINGLE_BEAM_CALCULATION || settings.mode == PARALLEL_BUNDLE
+            || settings.mode == PARALLEL_BUNDLE_EXIT;
+    if (energy >= roulette_threshold || complete_paths) return true;
+    const qreal values[6] = {original_beam.x(), original_beam.y(), original_beam.d_x(), original_beam.d_y(),
+                             original_beam.d_z(), static_cast<qreal>(event)};
+    qreal random = static_cast<quint32>(qHashBits(values, sizeof(values))) / 4294967296.0;
+    if (random >= roulette_survival) {
+        PROFILE_COUNT(PROFILE_ROULETTE_STOPS);
+        return false;
+    }
+    energy /= roulette_survival;
+    return true;
+}
+
+bool Model::reflection_cycle(Beam& beam, const Beam& original_beam, QVector<Point>& points, int& reflections, qreal& energy, BeamStatus& failure, qreal n) const {
+    // The beams refracted into the cavity stay in the air, as the cavity's side reflects them
+    bool in_cavity = false;
+    for (int iteration = 0; ; ++iteration) {
+        // Beams caught between the walls would never leave the focon
+        if (iteration >= iteration_limit) {
+            failure = NON_TERMINATING;
+            return false;
+        }
 //        qDebug() << beam;
-        intersection = cone->intersection(beam);
+        IntersectionStatus status;
+        Point intersection = cone->intersection(beam, &status);
+        PROFILE_COUNT(PROFILE_CONE_INTERSECTIONS);
+        if (status != INTERSECTION_FOUND) {
+            failure = failure_status(status);
+            return false;
+        }
 //        qDebug() << "cone inter" << intersection;
 
         bool hit_cavity = false;
         if (cavity) {
-            Point cavity_intersection = cavity->intersection(beam);
+            Point cavity_intersection = cavity->intersection(beam, &status);
+            PROFILE_COUNT(PROFILE_CAVITY_INTERSECTIONS);
+            if (status != INTERSECTION_FOUND) {
+                failure = failure_status(status);
+                return false;
+            }
 //            qDebug() << "cavity inter " << cavity_intersection;
 
             if (cavity_intersection.z() > cavity->z_k()
@@ -154,7 +662,7 @@ void MainWindow::reflection_cycle(Beam& beam, const Beam& original_beam) {
             }
         }
 
-        switch (ui->mode->currentIndex()) {
+        switch (settings.mode) {
         case SINGLE_BEAM_CALCULATION:
             // Points array forms complete beam path
             points.push_back(intersection);
@@ -172,6 +680,7 @@ void MainWindow::reflection_cycle(Beam& beam, const Beam& original_beam) {
 
         // Transforming the beam after hitting a point outside of the cone is not necessary
         if (intersection.z() < 0 || intersection.z() > cone->length()) break;
+        if (settings.energy && settings.glass && !in_cavity) attenuate(energy, beam.p1(), intersection);
 
         QLineF line = QLineF(0, 0, intersection.x(), intersection.y());
         qreal ksi = qDegreesToRadians(-90 + line.angle());
@@ -181,42 +690,70 @@ void MainWindow::reflection_cycle(Beam& beam, const Beam& original_beam) {
 //        qDebug() << transformed_beam;
 
         if (hit_cavity) {
-            transformed_beam = cavity->refracted(transformed_beam);
+            qreal cos_in = transformed_beam.d_y();
+            transformed_beam = cavity->refracted(transformed_beam, n);
+            bool refracted = cos_in > 0 && transformed_beam.d_y() > 0;
+            if (settings.energy) {
+                // The glass side refracts the beam unless it is reflected totally, the cavity's side reflects it
+                qreal reflectance = cos_in > 0 ? fresnel_reflectance(cos_in, n, 1) : fresnel_reflectance(cos_in, 1, n);
+                energy *= refracted ? 1 - reflectance : reflectance;
+            }
+            in_cavity = in_cavity || refracted;
         } else {
+            // The glass focon's walls reflect by Fresnel's law, the hollow one's are metallic
+            if (settings.energy) {
+                energy *= settings.glass ? fresnel_reflectance(transformed_beam.d_y(), n, 1) : settings.wall_reflectivity;
+            }
             transformed_beam.reflect();
+            ++reflections;
+        }
+        if (settings.energy && !survives_roulette(energy, original_beam, iteration)) {
+            failure = REFLECTED;
+            return false;
         }
 
 //        qDebug() << transformed_beam;
 
         beam = m.transponed()*transformed_beam;
 
-        // In complex modes there is no need to calculate full path of reflected beams
-        if (ui->mode->currentIndex() != SINGLE_BEAM_CALCULATION && !cavity && beam.cos_g() < 0) break;
+        // In complex modes there is no need to calculate full path of reflected beams.
+        // The beams traced back from the detector are lost as soon as they turn to the exit
+        bool turned = settings.mode == REVERSE_TRACING ? beam.cos_g() > 0 : beam.cos_g() < 0;
+        if (settings.mode != SINGLE_BEAM_CALCULATION && !cavity && turned) break;
     }
+    return true;
 }
 
-void MainWindow::transformation_on_exit(Beam& beam, const Beam& original_beam) {
-    bool simple_glass_cone = ui->glass->isChecked() && !cavity;
+bool Model::transformation_on_exit(Beam& beam, const Beam& original_beam, QVector<Point>& points, int& reflections, qreal& energy, BeamStatus& failure, qreal n) const {
+    bool simple_glass_cone = settings.glass && !cavity;
     bool axial_beam = qFabs(beam.d_y()) < 1e-6 && qFabs(beam.x()) < 1e-6 && qFabs(beam.y()) < 1e-6;
-    bool transformation_needed = beam.cos_g() >= 0 && (simple_glass_cone || ui->ocular->isChecked() || axial_beam);
+    bool transformation_needed = beam.cos_g() >= 0 && (simple_glass_cone || settings.ocular || axial_beam);
     if (transformation_needed) {
         Point exit_intersection = cone->exit().intersection(beam);
+        if (settings.energy && simple_glass_cone) {
+            attenuate(energy, beam.p1(), exit_intersection);
+            qreal reflectance = fresnel_reflectance(beam.cos_g(), n, 1);
+            energy *= reflectance < 1 ? 1 - reflectance : 1;
+        }
         beam = Beam(exit_intersection, beam.d_x(), beam.d_y(), beam.d_z());
-        beam = ui->ocular->isEnabled()
-                ? ocular.refracted(beam)
-                : cone->exit().refracted(beam, 1.5, 1);
-        switch (ui->mode->currentIndex()) {
+        // The ocular is available for the glass-free focons only. The axial beams are moved to the exit
+        // without it when it is off: it is not placed at the exit then and may even have its focus there
+        if (settings.glass) {
+            beam = cone->exit().refracted(beam, n, 1);
+        } else if (settings.ocular) {
+            beam = ocular.refracted(beam);
+        }
+        switch (settings.mode) {
         case SINGLE_BEAM_CALCULATION:
             points.pop_back();
             points.push_back(exit_intersection);
             if (beam.d_z() < 0) {
-                try {
-                    reflection_cycle(beam, original_beam);
-                } catch (bad_intersection&) {
-                    throw original_beam;
-                }
-                transformation_on_exit(beam, original_beam);
-            } else points.push_back(cone->intersection(beam));
+                return reflection_cycle(beam, original_beam, points, reflections, energy, failure, n)
+                        && transformation_on_exit(beam, original_beam, points, reflections, energy, failure, n);
+            } else {
+                points.push_back(cone->intersection(beam));
+                PROFILE_COUNT(PROFILE_CONE_INTERSECTIONS);
+            }
             break;
         case DIVERGENT_BUNDLE:
             if (points.back().z() > cone->length()) {
@@ -227,37 +764,58 @@ void MainWindow::transformation_on_exit(Beam& beam, const Beam& original_beam) {
             break;
         }
     }
+    return true;
 }
 
-MainWindow::BeamStatus MainWindow::calculate_single_beam_path(Beam& beam) {
+BeamStatus Model::calculate_single_beam_path(Beam& beam, QVector<Point>& points, qreal * energy, qreal n) const {
+    // The energy is the share of the beam's energy reaching its final state, it is calculated in the energy mode only.
+    // The glass has the given refractive index, the design one if it is not given. Only the design paths are recorded
+    const bool recording = recorder && n <= 0;
+    if (n <= 0) n = cone->n();
     const auto original_beam = beam;
+    qreal transmitted = 1;
+    if (energy) *energy = transmitted;
     points.push_back(beam.p1());
+    budget.count();
+    PROFILE_COUNT(PROFILE_BEAMS);
+    int reflections = 0;
 
     // Perpendicular beams cause infinite loop in tubes
     if (!cone->is_conic() && qFabs(beam.d_y()) > 0.999999) {
-        ui->statusbar->showMessage("Некорректный входной угол");
+        PROFILE_REFLECTIONS(reflections);
+        if (recording) record_beam(original_beam, beam, beam.p1(), REFLECTED, reflections);
         return REFLECTED;
     }
 
-    transformation_on_entrance(beam);
-    try {
-        reflection_cycle(beam, original_beam);
-    } catch (bad_intersection&) {
-        throw original_beam;
+    transformation_on_entrance(beam, transmitted, n);
+    BeamStatus failure = DEGENERATE_ROOT;
+    if (!reflection_cycle(beam, original_beam, points, reflections, transmitted, failure, n)
+            || !transformation_on_exit(beam, original_beam, points, reflections, transmitted, failure, n)) {
+        if (!is_failure(failure)) {
+            // Stopped by the Russian roulette, its energy is carried on by the surviving beams
+            PROFILE_REFLECTIONS(reflections);
+            if (recording) record_beam(original_beam, beam, beam.p1(), failure, reflections);
+            if (energy) *energy = 0;
+            return failure;
+        }
+        // The path is left as it was calculated up to the failure
+        add_failure(original_beam, failure);
+        PROFILE_REFLECTIONS(reflections);
+        if (recording) record_beam(original_beam, beam, beam.p1(), failure, reflections);
+        return failure;
     }
-    transformation_on_exit(beam, original_beam);
 
     BeamStatus status;
     if (beam.d_z() < 0) {
         status = REFLECTED;
         // Cut the reflected beams' tails at the cone's entrance so the projections are cleaner
-        if (ui->mode->currentIndex() == SINGLE_BEAM_CALCULATION) {
+        if (settings.mode == SINGLE_BEAM_CALCULATION) {
             points.back() = cone->entrance().intersection(beam);
-        } else if (ui->mode->currentIndex() == PARALLEL_BUNDLE_EXIT) {
+        } else if (settings.mode == PARALLEL_BUNDLE_EXIT) {
             points.pop_back();
         }
     } else {
-        if (ui->mode->currentIndex() == PARALLEL_BUNDLE_EXIT) {
+        if (settings.mode == PARALLEL_BUNDLE_EXIT) {
             points.back() = cone->exit().intersection(beam);
         }
         if (detector.missed(beam)) {
@@ -265,119 +823,974 @@ MainWindow::BeamStatus MainWindow::calculate_single_beam_path(Beam& beam) {
         } else {
             status = detector.detected(beam) ? DETECTED : HIT;
             // Cut the passed beams' tails at the detectors's plane
-            if (ui->mode->currentIndex() == SINGLE_BEAM_CALCULATION
-                || (ui->mode->currentIndex() == DIVERGENT_BUNDLE && points.back().z() > cone->length())) {
+            if (settings.mode == SINGLE_BEAM_CALCULATION
+                || (settings.mode == DIVERGENT_BUNDLE && points.back().z() > cone->length())) {
                 points.back() = detector.plane().intersection(beam);
             }
         }
     }
+    PROFILE_REFLECTIONS(reflections);
+    if (recording) record_beam(original_beam, beam, exit_point(beam, status), status, reflections);
+    if (energy) *energy = transmitted;
     return status;
 }
 
-QPair<int, int> MainWindow::calculate_parallel_beams(qreal angle) {
-    int beams_total = 0;
-    int beams_passed = 0;
-    int count = ui->precision->currentIndex() ? 50 : 25;
-    for (int i = 0; i < count; ++i) {
-        qreal x = i * cone->r1() / count;
-        for (int j = -count; j < count; ++j) {
-            qreal y = j * cone->r1() / count;
-            Point start = Point(-x, -y, 0);
-            if (start.is_in_radius(cone->r1())) {
-                Beam beam = Beam(start, angle);
-                // The results are simmetrical relative to y axis, hence doubling total count for i > 0
-                beams_total += (i > 0 ? 2 : 1);
-                BeamStatus status = calculate_single_beam_path(beam);
-                if (status == DETECTED) {
-                    beams_passed += (i > 0 ? 2 : 1);
-                }
-                if (ui->mode->currentIndex() == PARALLEL_BUNDLE) {
-                    statuses.push_back(status);
-                    draw(points.back(), status, ui->rotation->value());
-                    if (x > 0) {
-                        draw(points.back().x_pair(), status, ui->rotation->value());
+void Model::add_failure(const Beam& original_beam, BeamStatus status) const {
+    // Failures are rare, so the lock does not slow the calculation down
+    QMutexLocker locker(&failures_mutex);
+    ++failure_counts[status];
+    if (failure_samples.size() < failure_samples_limit) {
+        failure_samples.push_back(BeamFailure(original_beam, status));
+    }
+}
+
+static Beam mirrored(const Beam& beam) {
+    // The transformations of the surfaces expect the beam to go along z, the ones going back are mirrored around them
+    return Beam(beam.p1(), beam.d_x(), beam.d_y(), -beam.d_z());
+}
+
+BeamStatus Model::calculate_reverse_beam_path(Beam& beam, qreal& weight) const {
+    // The beam starts on the detector and goes back through the system, every transformation of the forward path
+    // is reversed. The beam is MISSED if it is stopped by the window or misses the exit, REFLECTED if it turns back
+    // to the detector's side, HIT if it leaves the entrance outside the source's angle and DETECTED within it.
+    // The lenses keep the area in the space of the beams' slopes rather than the etendue, the weight makes up for it.
+    // In the energy mode it includes the share of the energy as well, which is the same both ways
+    const auto original_beam = beam;
+    weight = 1;
+    budget.count();
+    PROFILE_COUNT(PROFILE_BEAMS);
+    int reflections = 0;
+    if (!detector.intersection(beam, detector.window_z()).is_in_radius(detector.window_radius())) return MISSED;
+    Point exit_intersection = cone->exit().intersection(beam);
+    if (!exit_intersection.is_in_radius(cone->r2())) return MISSED;
+    beam = beam.on_point(exit_intersection);
+    if (settings.ocular) {
+        qreal cos_before = beam.cos_g();
+        beam = mirrored(ocular.refracted(mirrored(beam)));
+        weight *= qPow(beam.cos_g() / cos_before, 4);
+    } else if (settings.glass) {
+        if (settings.energy) weight *= 1 - fresnel_reflectance(beam.cos_g(), 1, cone->n());
+        beam = mirrored(cone->exit().refracted(mirrored(beam), 1, cone->n()));
+    }
+    // Perpendicular beams cause infinite loop in tubes
+    if (beam.d_z() >= 0 || (!cone->is_conic() && qFabs(beam.d_y()) > 0.999999)) return REFLECTED;
+
+    QVector<Point> points;
+    BeamStatus failure = DEGENERATE_ROOT;
+    qreal energy = 1;
+    if (!reflection_cycle(beam, original_beam, points, reflections, energy, failure, cone->n())) {
+        // The beams stopped by the Russian roulette are not failures
+        if (!is_failure(failure)) return failure;
+        add_failure(original_beam, failure);
+        PROFILE_REFLECTIONS(reflections);
+        return failure;
+    }
+    PROFILE_REFLECTIONS(reflections);
+    if (beam.d_z() >= 0) return REFLECTED;
+    weight *= energy;
+    if (settings.energy && settings.glass) attenuate(weight, beam.p1(), cone->entrance().intersection(beam));
+
+    beam = beam.on_point(cone->entrance().intersection(beam));
+    if (settings.lens) {
+        qreal cos_before = beam.cos_g();
+        beam = mirrored(lens.refracted(mirrored(beam)));
+        weight *= qPow(beam.cos_g() / cos_before, 4);
+    } else if (settings.glass) {
+        qreal reflectance = fresnel_reflectance(beam.cos_g(), cone->n(), 1);
+        if (settings.energy && reflectance < 1) weight *= 1 - reflectance;
+        beam = mirrored(cone->entrance().refracted(mirrored(beam), cone->n(), 1));
+    }
+    // The total internal reflection on the entrance turns the beam back as well
+    if (beam.d_z() >= 0) return REFLECTED;
+    return 180 - beam.gamma() < qFabs(settings.angle) ? DETECTED : HIT;
+}
+
+Point Model::exit_point(const Beam& beam, BeamStatus status) const {
+    // The beam leaves the focon through its exit or back through the entrance
+    return (status == REFLECTED ? cone->entrance() : cone->exit()).intersection(beam);
+}
+
+void Model::record_beam(const Beam& original_beam, const Beam& beam, const Point& exit_point, BeamStatus status, int reflections) const {
+    RayRecord record;
+    record.entry_x = original_beam.x();
+    record.entry_y = original_beam.y();
+    record.entry_dx = original_beam.d_x();
+    record.entry_dy = original_beam.d_y();
+    record.entry_dz = original_beam.d_z();
+    record.exit_x = exit_point.x();
+    record.exit_y = exit_point.y();
+    record.exit_z = exit_point.z();
+    record.exit_dx = beam.d_x();
+    record.exit_dy = beam.d_y();
+    record.exit_dz = beam.d_z();
+    record.reflections = static_cast<quint32>(reflections);
+    record.status = static_cast<quint8>(status);
+    recorder->add(record);
+}
+
+QPair<int, int> Model::calculate_parallel_beams(qreal angle, Distribution * angles) {
+    int count = settings.precision ? 50 : 25;
+    bool drawing = settings.mode == PARALLEL_BUNDLE || settings.mode == PARALLEL_BUNDLE_EXIT;
+    QVector<QPair<int, int>> row_results(count);
+    QVector<Distribution> row_angles(count);
+    std::atomic<int> rows_done{0};
+    // Every row of the grid is calculated as a separate task and mapped as a single batch
+    parallel_for(count, 1, [&](qint64 begin, qint64 end, qint64) {
+        QVector<Point> points;
+        for (int i = begin; i < end; ++i) {
+            int beams_total = 0;
+            int beams_passed = 0;
+            Distribution row_distribution = angles ? Distribution(0, 90, 900) : Distribution();
+            QVector<BeamRecord> records;
+            qreal x = i * cone->r1() / count;
+            for (int j = -count; j < count; ++j) {
+                qreal y = j * cone->r1() / count;
+                Point start = Point(-x, -y, 0);
+                if (start.is_in_radius(cone->r1())) {
+                    Beam beam = Beam(start, angle);
+                    points.clear();
+                    BeamStatus status = calculate_single_beam_path(beam, points);
+                    // Failed beams are left out of the counts
+                    if (is_failure(status)) continue;
+                    // The results are simmetrical relative to y axis, hence doubling total count for i > 0
+                    beams_total += (i > 0 ? 2 : 1);
+                    if (status == DETECTED) {
+                        beams_passed += (i > 0 ? 2 : 1);
                     }
-                } else if (ui->mode->currentIndex() == PARALLEL_BUNDLE_EXIT && status > REFLECTED) {
                     qreal beam_angle = beam.gamma();
-                    beam_angles.push_back(beam_angle);
-                    draw(points.back(), beam_angle, ui->rotation->value());
-                    if (x > 0) {
-                        draw(points.back().x_pair(), beam_angle, ui->rotation->value());
+                    if (angles && status > REFLECTED) {
+                        row_distribution.add(beam_angle);
+                    }
+                    if (settings.mode == PARALLEL_BUNDLE) {
+                        records.push_back(BeamRecord(points.back(), status));
+                    } else if (settings.mode == PARALLEL_BUNDLE_EXIT && status > REFLECTED) {
+                        records.push_back(BeamRecord(points.back(), status, beam_angle));
                     }
                 }
             }
+            row_results[i] = qMakePair(beams_passed, beams_total);
+            row_angles[i] = row_distribution;
+            if (drawing) {
+                if (!records.isEmpty()) accumulate_density(records, true);
+                report_progress(static_cast<qreal>(++rows_done) / count);
+            }
         }
+    });
+
+    int beams_total = 0;
+    int beams_passed = 0;
+    for (int i = 0; i < count; ++i) {
+        beams_passed += row_results[i].first;
+        beams_total += row_results[i].second;
+        if (angles) angles->merge(row_angles[i]);
     }
     return qMakePair(beams_passed, beams_total);
 }
 
-QPair<int, int> MainWindow::calculate_divergent_beams(const Point& start) {
-    int beams_total = 0;
-    int beams_passed = 0;
-    int count = ui->precision->currentIndex() ? 10 : 5;
-    int limit = abs(static_cast<int>(ui->angle->value() * count));
+void Model::init_fast_tracer(bool statistics_only) {
+    // The tracer copies the geometry, which the optimisers change between the samplings.
+    // The recorder and the spot diagram need the beams' full double precision paths
+    // The energy of the beams is calculated in double precision only
+    bool fast = settings.single_precision && statistics_only && !recorder && !settings.energy;
+    fast_tracer.reset(fast ? new reference::Tracer<float>(*this) : nullptr);
+}
+
+void Model::finish_fast_tracing(const SamplingStatistics& statistics) {
+    fast_tracer.reset();
+    single_precision_beams += statistics.single_precision;
+    escalated_beams += statistics.escalated;
+}
+
+BeamStatus Model::sample_beam(Beam& beam, SamplingStatistics& statistics, qint64 weight, QVector<Point>& points) const {
+    // Failed beams are counted instead of aborting the whole run, it is up to the caller to decide what to do with them.
+    // The beam is left in its final state
+    const Beam original_beam = beam;
+    points.clear();
+    if (fast_tracer) {
+        // Only the outcome of the beam is needed, so single precision will do unless the beam passes
+        // close to a decision boundary or fails. Such beams are traced again in double precision below
+        const double ray[5] = {beam.x(), beam.y(), beam.d_x(), beam.d_y(), beam.d_z()};
+        const reference::Result<float> fast = fast_tracer->trace(ray);
+        ++statistics.single_precision;
+        if (!is_failure(fast.status) && fast.margin >= single_precision_band) {
+            budget.count();
+            PROFILE_COUNT(PROFILE_BEAMS);
+            PROFILE_REFLECTIONS(fast.reflections);
+            points.push_back(original_beam.p1());
+            beam = Beam(Point(fast.exit.x, fast.exit.y, fast.exit.z), fast.direction.x, fast.direction.y, fast.direction.z);
+            statistics.add(fast.status, beam.gamma(), original_beam.p1().r() / cone->r1(), weight);
+            sample_bands(original_beam, fast.status, 1, statistics, weight);
+            return fast.status;
+        }
+        ++statistics.escalated;
+    }
+    qreal energy = 1;
+    BeamStatus status = calculate_single_beam_path(beam, points, &energy);
+    if (is_failure(status)) {
+        statistics.add_failure(original_beam, status, weight);
+        points.clear();
+    } else {
+        statistics.add(status, beam.gamma(), original_beam.p1().r() / cone->r1(), weight, energy);
+        sample_bands(original_beam, status, energy, statistics, weight);
+    }
+    return status;
+}
+
+void Model::sample_bands(const Beam& original_beam, BeamStatus status, qreal energy, SamplingStatistics& statistics, qint64 weight) const {
+    // The bands share the sampled beam with the design wavelength. The glass splits their paths at the entrance already,
+    // so the beam is traced again only for the bands whose index differs from the previous one's, starting with the design one
+    QVector<Point> points;
+    qreal previous_index = cone->n();
+    for (int k = 0; k < band_indices.size(); ++k) {
+        if (band_indices[k] != previous_index) {
+            previous_index = band_indices[k];
+            Beam beam = original_beam;
+            points.clear();
+            status = calculate_single_beam_path(beam, points, &energy, previous_index);
+        }
+        // The beams failed in a band are left out of its results only
+        if (!is_failure(status)) statistics.add_band(k, band_indices.size(), status, weight, energy);
+    }
+}
+
+SamplingStatistics Model::calculate_divergent_beams(const Point& start, qint64 weight) {
+    SamplingStatistics statistics;
+    int count = settings.precision ? 10 : 5;
+    int limit = abs(static_cast<int>(settings.angle * count));
+    QVector<Point> points;
+    QVector<BeamRecord> records;
     for (int i = -limit; i <= limit; ++i) {
         qreal angle = static_cast<qreal>(i) / count;
         Beam beam = Beam(start, angle);
-        ++beams_total;
-        BeamStatus status = calculate_single_beam_path(beam);
-        statuses.push_back(status);
-        if (status == DETECTED) {
-            ++beams_passed;
+        BeamStatus status = sample_beam(beam, statistics, weight, points);
+        if (settings.mode == DIVERGENT_BUNDLE && !points.isEmpty()) {
+            records.push_back(BeamRecord(points.back(), status));
         }
-        draw(points.back(), status, ui->rotation->value());
     }
-    return qMakePair(beams_passed, beams_total);
+    if (!records.isEmpty()) emit beams_calculated(records);
+    return statistics;
 }
 
-QPair<int, int> MainWindow::calculate_every_beam() {
-    int beams_total = 0;
-    int beams_passed = 0;
-    int count = ui->precision->currentIndex() ? 25 : 20;
-    for (int i = 0; i < count; ++i) {
+SamplingStatistics Model::sample_every_beam(const Shard& shard) {
+    int count = settings.precision ? 25 : 20;
+    // Inside the optimisation modes the sampling is never cut short so that the candidates stay comparable
+    bool limited = settings.mode == EXHAUSTIVE_SAMPLING;
+    // Starting points along with their weights
+    // The results are simmetrical relative to y axis, hence doubling count for i > 0
+    // The results are also simmetrical relative to x axis due to divergent beam modelling method used
+    QVector<QPair<Point, int>> starts;
+    for (int i = 0, k = 0; i < count; ++i) {
         qreal x = i * cone->r1() / count;
         for (int j = 0; j < count; ++j) {
             qreal y = j * cone->r1() / count;
             Point start = Point(-x, -y, 0);
-            if (start.is_in_radius(cone->r1())) {
-                QPair<int, int> current_result = calculate_divergent_beams(start);
-                // The results are simmetrical relative to y axis, hence doubling count for i > 0
-                // The results are also simmetrical relative to x axis due to divergent beam modelling method used
-                beams_passed += (i > 0 ? 2 : 1) * (j > 0 ? 2 : 1) * current_result.first;
-                beams_total += (i > 0 ? 2 : 1) * (j > 0 ? 2 : 1) * current_result.second;
+            if (start.is_in_radius(cone->r1()) && shard.contains(k++)) {
+                starts.push_back(qMakePair(start, (i > 0 ? 2 : 1) * (j > 0 ? 2 : 1)));
             }
         }
     }
-    return qMakePair(beams_passed, beams_total);
+
+    SamplingStatistics statistics;
+    QMutex mutex;
+    std::atomic<int> starts_done{0};
+    init_fast_tracer(true);
+    parallel_for(starts.size(), 1, [&](qint64 begin, qint64 end, qint64) {
+        for (qint64 k = begin; k < end; ++k) {
+            if (limited && budget.exhausted()) return;
+            SamplingStatistics current_result = calculate_divergent_beams(starts[k].first, starts[k].second);
+            PROFILE_STAGE(STAGE_MERGE);
+            QMutexLocker locker(&mutex);
+            statistics.merge(current_result);
+            int done = ++starts_done;
+            if (limited) {
+                report_progress(static_cast<qreal>(done) / starts.size(), qMakePair(statistics.passed, statistics.total));
+            }
+        }
+    });
+    finish_fast_tracing(statistics);
+    work_planned = starts.size();
+    work_done = starts_done;
+    if (limited && work_done < work_planned) {
+        coverage = static_cast<qreal>(work_done) / work_planned;
+    }
+    return statistics;
 }
 
-QPair<int, int> MainWindow::monte_carlo_method() {
-    int beams_total = 0;
-    int beams_passed = 0;
-    int count = ui->precision->currentIndex() ? 100000 : 10000;
-    QRandomGenerator rng;
-    for (int i = 0; i < count; ++i) {
+SamplingStatistics Model::monte_carlo_method(const Shard& shard, SpotDiagram * spot) {
+    qint64 count = settings.beam_count > 0 ? settings.beam_count : (settings.precision ? 100000 : 10000);
+    // Chunks' sizes and seeds depend on the sample size only, so that every sharding of the run traces the same beams
+    qint64 chunk_size = qMax<qint64>(1000, count / 4096);
+    QVector<qint64> chunks;
+    work_planned = 0;
+    for (qint64 chunk = 0; chunk * chunk_size < count; ++chunk) {
+        if (shard.contains(chunk)) {
+            chunks.push_back(chunk);
+            work_planned += qMin(chunk_size, count - chunk * chunk_size);
+        }
+    }
+
+    SamplingStatistics statistics;
+    QMutex mutex;
+    init_fast_tracer(spot == nullptr);
+    parallel_for(chunks.size(), 1, [&](qint64 begin, qint64 end, qint64) {
+        for (qint64 k = begin; k < end; ++k) {
+            qint64 chunk = chunks[k];
+            // Every chunk has its own generator so that the results do not depend on the threads' scheduling
+            QRandomGenerator rng(static_cast<quint32>(chunk) + 1);
+            SamplingStatistics chunk_statistics;
+            // Every chunk fills its own distributions without locking, they are summed up afterwards
+            SpotDiagram chunk_spot = spot ? SpotDiagram(spot->radius, spot_resolution) : SpotDiagram();
+            QVector<Point> points;
+            // Entry points are mapped in small batches, so the memory does not depend on the sample size
+            QVector<BeamRecord> records;
+            qint64 chunk_end = qMin(count, (chunk + 1) * chunk_size);
+            for (qint64 i = chunk * chunk_size; i < chunk_end; ++i) {
+                if (budget.exhausted()) break;
+                qreal x = 2 * rng.generateDouble() - 1;
+                qreal y = 2 * rng.generateDouble() - 1;
+                Point start = Point(x * cone->r1(), y * cone->r1(), 0);
+                if (start.is_in_radius(cone->r1())) {
+                    Beam beam = Beam(start, (2 * rng.generateDouble() - 1) * qFabs(settings.angle));
+                    BeamStatus status = sample_beam(beam, chunk_statistics, 1, points);
+                    if (!density.is_empty() && !points.isEmpty()) {
+                        records.push_back(BeamRecord(start, status));
+                        if (records.size() >= 1000) {
+                            accumulate_density(records, false);
+                            records.clear();
+                        }
+                    }
+                    if (spot && status > REFLECTED && !is_failure(status)) {
+                        chunk_spot.add(detector.intersection(beam, detector.window_z()),
+                                       detector.intersection(beam, detector.detector_z()), beam.gamma());
+                    }
+                } else --i;
+            }
+            if (!records.isEmpty()) accumulate_density(records, false);
+            PROFILE_STAGE(STAGE_MERGE);
+            QMutexLocker locker(&mutex);
+            statistics.merge(chunk_statistics);
+            if (spot) spot->merge(chunk_spot);
+            qint64 done = statistics.total + statistics.failed;
+            report_progress(static_cast<qreal>(done) / work_planned, qMakePair(statistics.passed, statistics.total));
+        }
+    });
+    finish_fast_tracing(statistics);
+    work_done = statistics.total + statistics.failed;
+    if (work_done < work_planned) {
+        coverage = static_cast<qreal>(work_done) / work_planned;
+    }
+    return statistics;
+}
+
+qreal Model::etendue_ratio() const {
+    // Etendue of the detector's surface within its FOV relative to the one of the entrance within the source's angle.
+    // Both emit uniformly over the projected solid angle, which is proportional to the squared sine of the half-angle
+    qreal sin_fov = qSin(qDegreesToRadians(qMin<qreal>(detector.fov(), 90)));
+    qreal sin_angle = qSin(qDegreesToRadians(qMin<qreal>(qFabs(settings.angle), 90)));
+    return qPow(detector.r() * sin_fov, 2) / qPow(cone->r1() * sin_angle, 2);
+}
+
+SamplingStatistics Model::reverse_tracing(qreal& acceptance, qreal& loss_error) {
+    // By reciprocity the share of the entrance's etendue reaching the detector equals the share of the detector's
+    // etendue reaching the entrance within the source's angle, scaled by the ratio of the two. The beams start
+    // on the detector, so none of them is wasted on the entrance's area that never reaches it
+    qint64 count = settings.beam_count > 0 ? settings.beam_count : (settings.precision ? 100000 : 10000);
+    qint64 chunk_size = qMax<qint64>(1000, count / 4096);
+    qreal sin_fov = qSin(qDegreesToRadians(qMin<qreal>(detector.fov(), 90)));
+    work_planned = count;
+
+    SamplingStatistics statistics;
+    qreal weights = 0, squared_weights = 0;     // Of the accepted beams
+    QMutex mutex;
+    parallel_for(count, chunk_size, [&](qint64 begin, qint64 end, qint64 chunk) {
+        QRandomGenerator rng(static_cast<quint32>(chunk) + 1);
+        SamplingStatistics chunk_statistics;
+        qreal chunk_weights = 0, chunk_squared_weights = 0;
+        QVector<BeamRecord> records;
+        for (qint64 i = begin; i < end; ++i) {
+            if (budget.exhausted()) break;
+            // Points are uniform over the detector's surface and directions over the projected solid angle
+            qreal r = detector.r() * qSqrt(rng.generateDouble());
+            qreal psi = 2 * M_PI * rng.generateDouble();
+            qreal sin_gamma = sin_fov * qSqrt(rng.generateDouble());
+            qreal omega = 2 * M_PI * rng.generateDouble();
+            Point start = Point(r * qCos(psi), r * qSin(psi), detector.detector_z());
+            Beam beam = Beam(start, sin_gamma * qCos(omega), sin_gamma * qSin(omega), -qSqrt(1 - sin_gamma * sin_gamma));
+            qreal weight = 1;
+            BeamStatus status = calculate_reverse_beam_path(beam, weight);
+            if (is_failure(status)) {
+                chunk_statistics.add_failure(Beam(start, beam.d_x(), beam.d_y(), beam.d_z()), status);
+                continue;
+            }
+            if (status == DETECTED) {
+                chunk_weights += weight;
+                chunk_squared_weights += weight * weight;
+            }
+            // The angles and the radii are the ones of the beams leaving the entrance
+            chunk_statistics.add(status, 180 - beam.gamma(), beam.p1().r() / cone->r1());
+            if (status > REFLECTED) {
+                records.push_back(BeamRecord(beam.p1(), status));
+            }
+        }
+        if (!records.isEmpty()) accumulate_density(records, false);
+        PROFILE_STAGE(STAGE_MERGE);
+        QMutexLocker locker(&mutex);
+        statistics.merge(chunk_statistics);
+        weights += chunk_weights;
+        squared_weights += chunk_squared_weights;
+        report_progress(static_cast<qreal>(statistics.total + statistics.failed) / work_planned);
+    });
+    work_done = statistics.total + statistics.failed;
+    if (work_done < work_planned) {
+        coverage = static_cast<qreal>(work_done) / work_planned;
+    }
+    // Standard error of the loss estimate from the spread of the weights, the binomial one for the unit weights
+    qint64 total = qMax<qint64>(1, statistics.total);
+    qreal mean = weights / total;
+    acceptance = mean * etendue_ratio();
+    loss_error = mean > 0 ? 10/qLn(10) * qSqrt(qMax<qreal>(0, squared_weights / total - mean * mean) / total) / mean : 0;
+    return statistics;
+}
+
+qint64 Model::trace_batch(const double * rays, qint64 count, quint8 * statuses, double * exits) {
+    // Rays are (x, y, dx, dy, dz), exits are (x, y, z, dx, dy, dz) of the point where the beam leaves the focon.
+    // The buffers belong to the caller and are written in place, every chunk to its own range
+    budget.start();
+    std::atomic<qint64> passed{0};
+    qint64 chunk_size = qMax<qint64>(1000, count / 4096);
+    parallel_for(count, chunk_size, [&](qint64 begin, qint64 end, qint64) {
+        QVector<Point> points;
+        qint64 chunk_passed = 0;
+        for (qint64 i = begin; i < end; ++i) {
+            const double * ray = rays + 5 * i;
+            double * exit = exits ? exits + 6 * i : nullptr;
+            if (exit) std::fill(exit, exit + 6, qQNaN());
+            bool valid = qIsFinite(ray[0]) && qIsFinite(ray[1]) && qIsFinite(ray[2]) && qIsFinite(ray[3]) && qIsFinite(ray[4]) && ray[4] > 0;
+            if (!valid) {
+                statuses[i] = RAY_INVALID;
+                continue;
+            }
+            Beam beam = Beam(Point(ray[0], ray[1], 0), ray[2], ray[3], ray[4]);
+            if (!beam.p1().is_in_radius(cone->r1())) {
+                statuses[i] = RAY_OUTSIDE;
+                continue;
+            }
+            points.clear();
+            BeamStatus status = calculate_single_beam_path(beam, points);
+            statuses[i] = static_cast<quint8>(status);
+            if (status == DETECTED) ++chunk_passed;
+            if (exit && !is_failure(status)) {
+                Point point = exit_point(beam, status);
+                exit[0] = point.x();
+                exit[1] = point.y();
+                exit[2] = point.z();
+                exit[3] = beam.d_x();
+                exit[4] = beam.d_y();
+                exit[5] = beam.d_z();
+            }
+        }
+        passed += chunk_passed;
+    });
+    return passed;
+}
+
+QString Model::rays_file_path() const {
+    if (settings.path.isEmpty() || QFileInfo(settings.rays_file).isAbsolute()) return settings.rays_file;
+    return QFileInfo(settings.path).dir().filePath(settings.rays_file);
+}
+
+SamplingStatistics Model::trace_ray_file(qint64& outside, qint64& invalid, QString& status_path, QString& error) {
+    SamplingStatistics statistics;
+    if (settings.rays_file.isEmpty()) {
+        error = "Не выбран файл лучей.";
+        return statistics;
+    }
+    RaySource source;
+    if (!source.open(rays_file_path(), error)) return statistics;
+
+    // Statuses are written straight into a memory-mapped file, one byte per ray in the order of the input
+    QFileInfo info(rays_file_path());
+    QFile status_file(info.dir().filePath(info.completeBaseName() + ".status"));
+    uchar * statuses = nullptr;
+    if (source.size() > 0 && status_file.open(QIODevice::ReadWrite | QIODevice::Truncate)
+            && status_file.resize(source.size())) {
+        statuses = status_file.map(0, source.size());
+    }
+    if (statuses) status_path = status_file.fileName();
+
+    QMutex mutex;
+    std::atomic<qint64> outside_count{0}, invalid_count{0}, rays_done{0};
+    work_planned = source.size();
+    parallel_for(source.chunk_count(), 1, [&](qint64 begin, qint64 end, qint64) {
+        for (qint64 chunk = begin; chunk < end; ++chunk) {
+            SamplingStatistics chunk_statistics;
+            QVector<Point> points;
+            qint64 chunk_rays = 0;
+            source.for_each_ray(chunk, [&](qint64 index, bool valid, const Beam& ray) {
+                quint8 code;
+                if (budget.exhausted()) {
+                    code = RAY_NOT_TRACED;
+                } else {
+                    ++chunk_rays;
+                    if (!valid) {
+                        code = RAY_INVALID;
+                        ++invalid_count;
+                    } else if (!ray.p1().is_in_radius(cone->r1())) {
+                        code = RAY_OUTSIDE;
+                        ++outside_count;
+                    } else {
+                        Beam beam = ray;
+                        code = static_cast<quint8>(sample_beam(beam, chunk_statistics, 1, points));
+                    }
+                }
+                if (statuses) statuses[index] = code;
+            });
+            PROFILE_STAGE(STAGE_MERGE);
+            QMutexLocker locker(&mutex);
+            statistics.merge(chunk_statistics);
+            qint64 done = rays_done += chunk_rays;
+            report_progress(static_cast<qreal>(done) / qMax<qint64>(1, work_planned), qMakePair(statistics.passed, statistics.total));
+        }
+    });
+    if (statuses) status_file.unmap(statuses);
+    status_file.close();
+
+    outside = outside_count;
+    invalid = invalid_count;
+    work_done = rays_done;
+    if (work_done < work_planned) {
+        coverage = static_cast<qreal>(work_done) / work_planned;
+    }
+    return statistics;
+}
+
+QVector<EntranceSample> Model::entrance_samples(qint64 count) const {
+    // Uniform over the entrance's disk and the source's angles as in the Monte Carlo method
+    QRandomGenerator rng(1);
+    QVector<EntranceSample> samples;
+    samples.reserve(static_cast<int>(count));
+    while (samples.size() < count) {
         qreal x = 2 * rng.generateDouble() - 1;
         qreal y = 2 * rng.generateDouble() - 1;
-        Point start = Point(x * cone->r1(), y * cone->r1(), 0);
-        if (start.is_in_radius(cone->r1())) {
-            Beam beam = Beam(start, (2 * rng.generateDouble() - 1) * fabs(ui->angle->value()));
-            ++beams_total;
-            BeamStatus status = calculate_single_beam_path(beam);
-            if (status == DETECTED) {
-                ++beams_passed;
+        qreal angle = 2 * rng.generateDouble() - 1;
+        if (x * x + y * y <= 1) samples.push_back(EntranceSample(x, y, angle));
+    }
+    return samples;
+}
+
+SamplingStatistics Model::sample_entrance(const QVector<EntranceSample>& samples) {
+    // The samples are traced in the calling thread, the designs are the parallel tasks
+    SamplingStatistics statistics;
+    QVector<Point> points;
+    init_fast_tracer(true);
+    for (const auto& sample : samples) {
+        Beam beam = Beam(Point(sample.x * cone->r1(), sample.y * cone->r1(), 0), sample.angle * qFabs(settings.angle));
+        sample_beam(beam, statistics, 1, points);
+    }
+    finish_fast_tracing(statistics);
+    return statistics;
+}
+
+Settings Model::sampled_settings() const {
+    // The variants of the design are sampled as in the Monte Carlo method within this run's limits
+    Settings design = settings;
+    design.mode = MONTE_CARLO_METHOD;
+    design.budget = false;
+    design.bands = 0;
+    design.path.clear();
+    return design;
+}
+
+bool Model::is_feasible(const Settings& design) {
+    // Deviations larger than the dimensions themselves give designs that cannot be made
+    return design.d_in > 0 && design.d_out > 0 && design.cavity_length >= 0 && design.length > design.cavity_length;
+}
+
+SamplingStatistics Model::evaluate_design(const Settings& design, const QVector<EntranceSample>& samples) {
+    // Every variant has a model of its own, its beams and failures are counted in this run
+    Model model(design);
+    SamplingStatistics statistics = model.sample_entrance(samples);
+    budget.count(model.budget.traced());
+    QMutexLocker locker(&failures_mutex);
+    for (int i = 0; i < BEAM_STATUSES; ++i) {
+        failure_counts[i] += model.failure_counts[i];
+    }
+    for (const auto& failure : model.failure_samples) {
+        if (failure_samples.size() >= failure_samples_limit) break;
+        failure_samples.push_back(failure);
+    }
+    return statistics;
+}
+
+Settings Model::design_settings(const QVector<qreal>& deviations) const {
+    // A manufactured design's lens comes with the nominal focus and does not follow the deviated detector
+    Settings design = sampled_settings();
+    design.auto_focus = false;
+    design.d_in += deviations[TOLERANCE_D1];
+    design.d_out += deviations[TOLERANCE_D2];
+    design.length += deviations[TOLERANCE_LENGTH];
+    design.offset_det += deviations[TOLERANCE_DETECTOR_OFFSET];
+    design.focal_length += deviations[TOLERANCE_FOCAL_LENGTH];
+    return design;
+}
+
+static qreal normal_deviate(QRandomGenerator& rng) {
+    // Box-Muller transform
+    qreal u = 1 - rng.generateDouble();
+    return qSqrt(-2 * qLn(u)) * qCos(2 * M_PI * rng.generateDouble());
+}
+
+QVector<qreal> Model::tolerance_analysis(QPair<int, int>& nominal, QVector<qreal>& sensitivities) {
+    // Every design is traced with the same entrance beams, so the differences between the designs' losses
+    // come from their deviations rather than from the sampling noise
+    qint64 count = settings.beam_count > 0 ? settings.beam_count : (settings.precision ? 20000 : 5000);
+    const QVector<EntranceSample> samples = entrance_samples(count);
+    QVector<qreal> tolerances = settings.tolerances;
+    if (!settings.lens) tolerances[TOLERANCE_FOCAL_LENGTH] = 0;
+
+    nominal = evaluate_design(design_settings(QVector<qreal>(TOLERANCES, 0)), samples).counts();
+
+    int designs = qMax(1, settings.designs);
+    QVector<QVector<qreal>> deviations(designs);
+    QVector<qreal> losses(designs, 0);
+    QVector<bool> evaluated(designs, false);
+    std::atomic<int> designs_done{0};
+    parallel_for(designs, 1, [&](qint64 begin, qint64 end, qint64) {
+        for (qint64 k = begin; k < end; ++k) {
+            if (budget.exhausted()) return;
+            // Every design has its own generator so that the results do not depend on the threads' scheduling
+            QRandomGenerator rng(static_cast<quint32>(k) + 1);
+            QVector<qreal> deviation(TOLERANCES, 0);
+            for (int i = 0; i < TOLERANCES; ++i) {
+                qreal u = settings.normal_tolerances ? normal_deviate(rng) / 3 : 2 * rng.generateDouble() - 1;
+                deviation[i] = tolerances[i] * u;
             }
-        } else --i;
+            deviations[k] = deviation;
+            Settings design = design_settings(deviation);
+            if (is_feasible(design)) {
+                SamplingStatistics statistics = evaluate_design(design, samples);
+                losses[k] = loss(statistics.passed, statistics.total);
+                evaluated[k] = true;
+                ++candidates;
+            }
+            report_progress(static_cast<qreal>(++designs_done) / designs);
+        }
+    });
+    work_planned = designs;
+    work_done = designs_done;
+    if (work_done < work_planned) {
+        coverage = static_cast<qreal>(work_done) / work_planned;
     }
-    return qMakePair(beams_passed, beams_total);
+
+    // The sensitivity is the slope of the loss against the deviation in the units of the tolerance.
+    // The deviations are independent, so the slopes of the single parameters need no joint fit.
+    // The designs passing no beams have no finite loss and are left out
+    sensitivities = QVector<qreal>(TOLERANCES, 0);
+    for (int i = 0; i < TOLERANCES; ++i) {
+        if (tolerances[i] <= 0) continue;
+        qreal n = 0, x_mean = 0, y_mean = 0;
+        for (int k = 0; k < designs; ++k) {
+            if (!evaluated[k] || !qIsFinite(losses[k])) continue;
+            ++n;
+            x_mean += deviations[k][i] / tolerances[i];
+            y_mean += losses[k];
+        }
+        if (n < 2) continue;
+        x_mean /= n;
+        y_mean /= n;
+        qreal covariance = 0, variance = 0;
+        for (int k = 0; k < designs; ++k) {
+            if (!evaluated[k] || !qIsFinite(losses[k])) continue;
+            qreal x = deviations[k][i] / tolerances[i] - x_mean;
+            covariance += x * (losses[k] - y_mean);
+            variance += x * x;
+        }
+        if (variance > 0) sensitivities[i] = covariance / variance;
+    }
+
+    QVector<qreal> design_losses;
+    for (int k = 0; k < designs; ++k) {
+        if (evaluated[k]) design_losses.push_back(losses[k]);
+    }
+    std::sort(design_losses.begin(), design_losses.end());
+    return design_losses;
+}
+
+// Steps of the finite differences per SensitivityParameter: mm, the defocus in the detector's radii
+static const qreal sensitivity_steps[SENSITIVITY_PARAMETERS] = {1, 0.1, 1, 0.1, 0.2, 0.1};
+
+bool Model::is_applicable(int parameter) const {
+    switch (parameter) {
+    case SENSITIVITY_FOCAL_LENGTH:
+        return settings.lens && !settings.auto_focus;
+    case SENSITIVITY_DEFOCUS:
+        return settings.lens && settings.auto_focus;
+    case SENSITIVITY_CAVITY_LENGTH:
+        return cavity != nullptr;
+    default:
+        return true;
+    }
+}
+
+Settings Model::perturbed_settings(const QVector<qreal>& offsets) const {
+    // The lens keeps being focused the way it is set up, as in the optimisation modes
+    Settings design = sampled_settings();
+    design.length += offsets[SENSITIVITY_LENGTH];
+    design.d_out += offsets[SENSITIVITY_D2];
+    design.focal_length += offsets[SENSITIVITY_FOCAL_LENGTH];
+    design.defocus += offsets[SENSITIVITY_DEFOCUS];
+    design.cavity_length += offsets[SENSITIVITY_CAVITY_LENGTH];
+    design.offset_det += offsets[SENSITIVITY_DETECTOR_OFFSET];
+    return design;
+}
+
+QVector<ParameterSensitivity> Model::sensitivity_analysis(QPair<int, int>& nominal, QVector<LossSlice>& slices) {
+    // The current design, ±1 and ±2 steps along every applicable parameter and the grids of the parameters' pairs
+    // are independent variants evaluated concurrently. They share the entrance beams, so the finite differences
+    // are not buried in the sampling noise
+    qint64 count = settings.beam_count > 0 ? settings.beam_count : (settings.precision ? 20000 : 5000);
+    const QVector<EntranceSample> samples = entrance_samples(count);
+    QVector<int> parameters;
+    QVector<qreal> steps(SENSITIVITY_PARAMETERS, 0);
+    for (int i = 0; i < SENSITIVITY_PARAMETERS; ++i) {
+        if (!is_applicable(i)) continue;
+        parameters.push_back(i);
+        steps[i] = sensitivity_steps[i];
+    }
+    // A shallow cavity should not vanish within the slices
+    steps[SENSITIVITY_CAVITY_LENGTH] = qMin(steps[SENSITIVITY_CAVITY_LENGTH], settings.cavity_length / (slice_size / 2 + 1));
+
+    const int half = slice_size / 2;
+    QVector<QVector<qreal>> variants(1, QVector<qreal>(SENSITIVITY_PARAMETERS, 0));
+    for (int p : parameters) {
+        for (int k : {-2, -1, 1, 2}) {
+            QVector<qreal> offsets(SENSITIVITY_PARAMETERS, 0);
+            offsets[p] = k * steps[p];
+            variants.push_back(offsets);
+        }
+    }
+    for (int a = 0; a < parameters.size(); ++a) {
+        for (int b = a + 1; b < parameters.size(); ++b) {
+            for (int j = -half; j <= half; ++j) {
+                for (int i = -half; i <= half; ++i) {
+                    QVector<qreal> offsets(SENSITIVITY_PARAMETERS, 0);
+                    offsets[parameters[a]] = i * steps[parameters[a]];
+                    offsets[parameters[b]] = j * steps[parameters[b]];
+                    variants.push_back(offsets);
+                }
+            }
+        }
+    }
+
+    // The variants that are not evaluated or pass no beams have no finite loss
+    QVector<qreal> losses(variants.size(), qQNaN());
+    std::atomic<int> variants_done{0};
+    parallel_for(variants.size(), 1, [&](qint64 begin, qint64 end, qint64) {
+        for (qint64 k = begin; k < end; ++k) {
+            if (budget.exhausted()) return;
+            Settings design = perturbed_settings(variants[k]);
+            if (is_feasible(design)) {
+                auto counts = evaluate_design(design, samples).counts();
+                if (k == 0) nominal = counts;
+                losses[k] = loss(counts);
+                ++candidates;
+            }
+            report_progress(static_cast<qreal>(++variants_done) / variants.size());
+        }
+    });
+    work_planned = variants.size();
+    work_done = variants_done;
+    if (work_done < work_planned) {
+        coverage = static_cast<qreal>(work_done) / work_planned;
+    }
+
+    // Least squares over x = -2h ... 2h: slope = Σx·L / Σx², and for the constant and the curvature
+    // 5a + 10h²c = ΣL, 10h²a + 34h⁴c = Σx²L
+    QVector<ParameterSensitivity> gradients;
+    for (int n = 0; n < parameters.size(); ++n) {
+        ParameterSensitivity sensitivity;
+        sensitivity.parameter = parameters[n];
+        qreal h = sensitivity.step = steps[parameters[n]];
+        const qreal points[5] = {losses[1 + 4*n], losses[2 + 4*n], losses[0], losses[3 + 4*n], losses[4 + 4*n]};
+        sensitivity.loss = points[2];
+        sensitivity.valid = std::all_of(points, points + 5, [](qreal value) { return qIsFinite(value); });
+        if (sensitivity.valid) {
+            sensitivity.gradient = (points[3] - points[1]) / (2 * h);
+            sensitivity.slope = (-2*points[0] - points[1] + points[3] + 2*points[4]) / (10 * h);
+            qreal sum = 0, squared_sum = 0;
+            for (int k = -2; k <= 2; ++k) {
+                sum += points[k + 2];
+                squared_sum += k * k * h * h * points[k + 2];
+            }
+            sensitivity.curvature = (5 * squared_sum - 10 * h * h * sum) / (70 * qPow(h, 4));
+        }
+        gradients.push_back(sensitivity);
+    }
+
+    slices.clear();
+    int index = 1 + 4 * parameters.size();
+    for (int a = 0; a < parameters.size(); ++a) {
+        for (int b = a + 1; b < parameters.size(); ++b) {
+            LossSlice slice;
+            slice.x_parameter = parameters[a];
+            slice.y_parameter = parameters[b];
+            qreal h_x = steps[parameters[a]], h_y = steps[parameters[b]];
+            slice.losses = Histogram2D(-(half + 0.5) * h_x, (half + 0.5) * h_x, -(half + 0.5) * h_y, (half + 0.5) * h_y,
+                                       slice_size, slice_size);
+            for (int j = -half; j <= half; ++j) {
+                for (int i = -half; i <= half; ++i) {
+                    slice.losses.add(i * h_x, j * h_y, 0, losses[index++]);
+                }
+            }
+            slices.push_back(slice);
+        }
+    }
+    return gradients;
+}
+
+void Curve::add(qreal argument, const QPair<int, int>& point_counts) {
+    // The optimisers may come back to a candidate, it keeps the first result
+    auto position = std::lower_bound(arguments.begin(), arguments.end(), argument);
+    if (position != arguments.end() && *position == argument) return;
+    int index = static_cast<int>(position - arguments.begin());
+    arguments.insert(index, argument);
+    counts.insert(index, point_counts);
+}
+
+QString Curve::to_csv() const {
+    // The points without passed beams have no finite loss and leave its field empty
+    QString csv = "parameter,value,passed,total,transmission,loss\n";
+    const QString name = Model::parameter_name(parameter);
+    for (int k = 0; k < arguments.size(); ++k) {
+        const auto& point = counts[k];
+        csv += name + "," + QString::number(arguments[k], 'g', 10)
+                + "," + QString::number(point.first) + "," + QString::number(point.second)
+                + "," + (point.second > 0 ? QString::number(static_cast<qreal>(point.first) / point.second, 'g', 10) : QString())
+                + "," + (point.first > 0 ? QString::number(Model::loss(point), 'g', 10) : QString()) + "\n";
+    }
+    return csv;
+}
+
+static qreal parameter_value(const Settings& settings, int parameter) {
+    switch (parameter) {
+    case SENSITIVITY_LENGTH:
+        return settings.length;
+    case SENSITIVITY_D2:
+        return settings.d_out;
+    case SENSITIVITY_FOCAL_LENGTH:
+        return settings.focal_length;
+    case SENSITIVITY_DEFOCUS:
+        return settings.defocus;
+    case SENSITIVITY_CAVITY_LENGTH:
+        return settings.cavity_length;
+    case SENSITIVITY_DETECTOR_OFFSET:
+        return settings.offset_det;
+    default:
+        return 0;
+    }
+}
+
+Curve Model::angle_scan() {
+    // Every angle is a parallel bundle as in its mode. The bundles are calculated concurrently,
+    // and the rows of each of them are shared between the threads as well
+    Curve scanned;
+    int points = qMax(2, settings.scan_points);
+    for (int k = 0; k < points; ++k) {
+        scanned.arguments.push_back(qFabs(settings.angle) * k / (points - 1));
+    }
+    scanned.counts = QVector<QPair<int, int>>(points, qMakePair(0, 0));
+    std::atomic<int> points_done{0};
+    parallel_for(points, 1, [&](qint64 begin, qint64 end, qint64) {
+        for (qint64 k = begin; k < end; ++k) {
+            if (budget.exhausted()) return;
+            scanned.counts[k] = calculate_parallel_beams(scanned.arguments[k]);
+            ++candidates;
+            report_progress(static_cast<qreal>(++points_done) / points);
+        }
+    });
+    work_planned = points;
+    work_done = points_done;
+    if (work_done < work_planned) {
+        coverage = static_cast<qreal>(work_done) / work_planned;
+    }
+    return scanned;
+}
+
+Curve Model::parameter_scan() {
+    // Every point is a variant of the design evaluated as in the sensitivity analysis. They share the entrance beams,
+    // so the curve shows the parameter's effect rather than the sampling noise
+    qint64 count = settings.beam_count > 0 ? settings.beam_count : (settings.precision ? 20000 : 5000);
+    const QVector<EntranceSample> samples = entrance_samples(count);
+    Curve scanned;
+    scanned.parameter = settings.scan_parameter;
+    int points = qMax(2, settings.scan_points);
+    qreal from = qMin(settings.scan_from, settings.scan_to), to = qMax(settings.scan_from, settings.scan_to);
+    for (int k = 0; k < points; ++k) {
+        scanned.arguments.push_back(from + (to - from) * k / (points - 1));
+    }
+    scanned.counts = QVector<QPair<int, int>>(points, qMakePair(0, 0));
+    qreal current = parameter_value(settings, scanned.parameter);
+    std::atomic<int> points_done{0};
+    parallel_for(points, 1, [&](qint64 begin, qint64 end, qint64) {
+        for (qint64 k = begin; k < end; ++k) {
+            if (budget.exhausted()) return;
+            QVector<qreal> offsets(SENSITIVITY_PARAMETERS, 0);
+            offsets[scanned.parameter] = scanned.arguments[k] - current;
+            Settings design = perturbed_settings(offsets);
+            if (is_feasible(design)) {
+                scanned.counts[k] = evaluate_design(design, samples).counts();
+                ++candidates;
+            }
+            report_progress(static_cast<qreal>(++points_done) / points);
+        }
+    });
+    work_planned = points;
+    work_done = points_done;
+    if (work_done < work_planned) {
+        coverage = static_cast<qreal>(work_done) / work_planned;
+    }
+    return scanned;
+}
+
+QPair<int, int> Model::calculate_every_beam() {
+    return sample_every_beam().counts();
+}
+
+QString Model::candidate_key(const QString& kind) const {
+    return kind + QString(" L=%1 D2=%2 F=%3").arg(cone->length(), 0, 'g', 12)
+                                            .arg(cone->d2(), 0, 'g', 12)
+                                            .arg(settings.lens ? lens.F() : 0, 0, 'g', 12);
+}
+
+QPair<int, int> Model::evaluate_parallel_beams(qreal angle) {
+    QString key = candidate_key("Parallel " + QString().setNum(angle));
+    QPair<int, int> result;
+    if (!checkpoint.lookup(key, result)) {
+        result = calculate_parallel_beams(angle);
+        checkpoint.store(key, result);
+    }
+    return result;
 }
 
-QPair<int, qreal> MainWindow::optimal_length() {
+QPair<int, int> Model::evaluate_every_beam() {
+    QString key = candidate_key("Exhaustive");
+    QPair<int, int> result;
+    if (!checkpoint.lookup(key, result)) {
+        result = calculate_every_beam();
+        checkpoint.store(key, result);
+    }
+    return result;
+}
+
+Parameters Model::optimal_length() {
+    curve = Curve();
+    curve.parameter = SENSITIVITY_LENGTH;
     int max = 0;
     int optimal_value = 0;
     int first_step = 5;
     int not_improving_length_limit = 150;
     int not_changing_limit = not_improving_length_limit / first_step;
+    int evaluated = 0;
     QPair<int, int> result;
     QPair<int, int> max_result;
     // The optimisation is done in 2 iterations with increasing accuracy
@@ -392,20 +1805,28 @@ QPair<int, qreal> MainWindow::optimal_length() {
         // Increasing cone's length tends to increase both the computation time and the loss value for non-zero beam bundles
         // so it's reasonable to cut the calculations short when the results become predictable
         for (int i = low_limit; i <= high_limit && (iteration == 1 || not_changing_count < not_changing_limit); i += step) {
+            // The rest of the current range and the whole second iteration are left unevaluated
+            int remaining = (high_limit - i) / step + 1 + (iteration == 0 ? 2*first_step - 1 : 0);
+            if (budget.exhausted()) {
+                Parameters best_result = max > 0 ? Parameters(optimal_value, cone->d2(), loss(max_result)) : Parameters();
+                best_result.coverage = static_cast<qreal>(evaluated) / (evaluated + remaining);
+                return best_result;
+            }
+            ++evaluated;
             qreal length = static_cast<qreal>(i);
             cone->set_length(length);
             detector.set_position(length);
             if (cavity) init_cavity(cone);
-            if (ui->lens->isChecked()) {
-                qreal focus = lens_focus(ui->auto_focus->isChecked());
+            if (settings.lens) {
+                qreal focus = lens_focus(settings.auto_focus);
                 lens.set_focus(focus);
             }
-            if (ui->ocular->isChecked()) {
+            if (settings.ocular) {
                 ocular.set_position(length);
             }
             // Optimal length criterion №1: Acceptable loss value for parallel bundle at given angle
-            if (loss(calculate_parallel_beams(ui->angle->value())) < loss_limit) {
-                result = calculate_every_beam();
+            if (loss(evaluate_parallel_beams(settings.angle)) < loss_limit) {
+                result = evaluate_every_beam();
                 int current_value = result.first;
                 // Optimal length criterion №2: Minimum loss (maximum number of beams passing) in exhaustive sampling
                 if (current_value > max || (current_value == max && i <= optimal_value)) {
@@ -416,38 +1837,46 @@ QPair<int, qreal> MainWindow::optimal_length() {
                 } else {
                     ++not_changing_count;
                 }
-                qDebug() << i << current_value;
-            } else {
-                qDebug() << "High loss value at " << i << " mm";
+                curve.add(i, result);
             }
+            ++candidates;
+            report_progress(static_cast<qreal>(evaluated) / (evaluated + remaining - 1), QPair<qint64, qint64>(),
+                            max > 0 ? Parameters(optimal_value, cone->d2(), loss(max_result)) : Parameters());
         }
-        qDebug() << optimal_value << max;
 
         if (iteration == 0) {
             // If the first iteration gives a positive result then start the second, else show a fail message
             if (max > 0) {
                 ++iteration;
-            } else return qMakePair(length_limit, loss_limit);
+            } else return Parameters();
         } else break;
     }
-    return qMakePair(optimal_value, loss(max_result));
+    return Parameters(optimal_value, cone->d2(), loss(max_result));
 }
 
-QPair<qreal, qreal> MainWindow::optimal_d_out() {
+Parameters Model::optimal_d_out() {
+    // Inside the full optimisation the curves of every length candidate would be mixed up
+    curve = Curve();
+    curve.parameter = SENSITIVITY_D2;
     int count = 2; // considering step = 0.5
-    int start = qFloor(ui->d_det->value() * count);
-    int end = qCeil(ui->aperture->value()) * count;
+    int start = qFloor(settings.d_det * count);
+    int end = qCeil(settings.aperture) * count;
     qreal max = 0;
     qreal optimal_value = 0;
+    qreal evaluated_part = 1;
     QPair<int, int> result;
     QPair<int, int> max_result;
     bool decrease_started = false;
     for (int i = start; i <= end && !decrease_started; ++i) {
+        if (budget.exhausted()) {
+            evaluated_part = static_cast<qreal>(i - start) / (end - start + 1);
+            break;
+        }
         qreal d_out = static_cast<qreal>(i) / count;
         init_cone(cone->d1(), d_out, cone->length());
         if (cavity) init_cavity(cone);
-        if (loss(calculate_parallel_beams(0)) < loss_limit && loss(calculate_parallel_beams(ui->angle->value())) < loss_limit) {
-            result = calculate_every_beam();
+        if (loss(evaluate_parallel_beams(0)) < loss_limit && loss(evaluate_parallel_beams(settings.angle)) < loss_limit) {
+            result = evaluate_every_beam();
             int current_value = result.first;
             if (current_value > max) {
                 max = current_value;
@@ -456,30 +1885,45 @@ QPair<qreal, qreal> MainWindow::optimal_d_out() {
             } else if (optimal_value > 0) {
                 decrease_started = true;
             }
-            qDebug() << "(D_out)  " << "Length: " << cone->length() << " D_out: " << cone->d2() << " Beams: " << current_value;
-        } else {
-            qDebug() << "High loss value at " << d_out << " mm";
+            if (settings.mode == D_OUT_OPTIMISATION) {
+                curve.add(d_out, result);
+            }
+        }
+        // Inside the full optimisation the progress is reported per length candidate
+        if (settings.mode == D_OUT_OPTIMISATION) {
+            ++candidates;
+            report_progress(static_cast<qreal>(i - start + 1) / (end - start + 1), QPair<qint64, qint64>(),
+                            optimal_value > 0 ? Parameters(qRound(cone->length()), optimal_value, loss(max_result)) : Parameters());
         }
     }
-    return qMakePair(optimal_value, loss(max_result));
+    Parameters best_result = optimal_value > 0 ? Parameters(qRound(cone->length()), optimal_value, loss(max_result)) : Parameters();
+    best_result.coverage = evaluated_part;
+    return best_result;
 }
 
-QPair<int, qreal> MainWindow::optimal_focus() {
+Parameters Model::optimal_focus() {
     // The lower bound of focus length is determined by the f-number of the lens (k = f'/D_in >= 1).
     // The upper bound corresponds to forming a beam parallel to the axis on the edge of the lens
     // and is determined by the system's FOV (or input beam angle value) and cone's entrance diameter.
     // Further increasing focus length is totally possible but seems to be pointless in our case.
-    int low_limit = qFloor(ui->focal_length->minimum());
-    int high_limit = qMin(qCeil(ui->focal_length->maximum()), 500);
+    int low_limit = qFloor(settings.focal_length_min);
+    int high_limit = qMin(qCeil(settings.focal_length_max), 500);
     int max = 0;
     int optimal_value = 0;
+    qreal evaluated_part = 1;
     QPair<int, int> result;
     QPair<int, int> max_result;
+    curve = Curve();
+    curve.parameter = SENSITIVITY_FOCAL_LENGTH;
     for (int focus = low_limit; focus <= high_limit; ++focus) {
+        if (budget.exhausted()) {
+            evaluated_part = static_cast<qreal>(focus - low_limit) / (high_limit - low_limit + 1);
+            break;
+        }
         lens.set_focus(focus);
         // Optimal length criterion №1: Acceptable loss value for parallel bundle at given angle
-        if (loss(calculate_parallel_beams(ui->angle->value())) < loss_limit) {
-            result = calculate_every_beam();
+        if (loss(evaluate_parallel_beams(settings.angle)) < loss_limit) {
+            result = evaluate_every_beam();
             int current_value = result.first;
             // Optimal length criterion №2: Minimum loss (maximum number of beams passing) in exhaustive sampling
             if (current_value > max || (current_value == max && focus <= optimal_value)) {
@@ -487,18 +1931,24 @@ QPair<int, qreal> MainWindow::optimal_focus() {
                 optimal_value = focus;
                 max_result = result;
             }
-            qDebug() << focus << current_value;
-        } else {
-            qDebug() << "High loss value at " << focus << " mm";
+            curve.add(focus, result);
         }
+        ++candidates;
+        report_progress(static_cast<qreal>(focus - low_limit + 1) / (high_limit - low_limit + 1), QPair<qint64, qint64>(),
+                        optimal_value > 0 ? Parameters(qRound(cone->length()), optimal_value, cone->d2(), loss(max_result)) : Parameters());
     }
-    return qMakePair(optimal_value, loss(max_result));
+    Parameters best_result = optimal_value > 0
+            ? Parameters(qRound(cone->length()), optimal_value, cone->d2(), loss(max_result))
+            : Parameters();
+    best_result.coverage = evaluated_part;
+    return best_result;
 }
 
-MainWindow::Parameters MainWindow::full_optimisation() {
+Parameters Model::full_optimisation() {
     int first_step = 5;
     int not_improving_length_limit = 100;
     int not_changing_limit = not_improving_length_limit / first_step;
+    int evaluated = 0;
     Parameters best_result;
 
     // The optimisation is done in 2 iterations with increasing accuracy
@@ -509,31 +1959,43 @@ MainWindow::Parameters MainWindow::full_optimisation() {
         int not_changing_count = 0;
 
         for (int i = low_limit; i <= high_limit && not_changing_count < not_changing_limit; i += step) {
+            // The rest of the current range and the whole second iteration are left unevaluated
+            int remaining = (high_limit - i) / step + 1 + (iteration == 0 ? 2*first_step - 1 : 0);
+            if (budget.exhausted()) {
+                best_result.coverage = static_cast<qreal>(evaluated) / (evaluated + remaining);
+                return best_result;
+            }
+            ++evaluated;
             qreal length = static_cast<qreal>(i);
             cone->set_length(length);
             detector.set_position(length);
             if (cavity) init_cavity(cone);
-            if (ui->lens->isChecked()) {
-                qreal focus = lens_focus(ui->auto_focus->isChecked());
+            if (settings.lens) {
+                qreal focus = lens_focus(settings.auto_focus);
                 lens.set_focus(focus);
             }
-            if (ui->ocular->isChecked()) {
+            if (settings.ocular) {
                 ocular.set_position(length);
             }
             auto result = optimal_d_out();
-            qreal d_out = result.first;
-            qreal current_loss_value = result.second;
+            if (result.coverage < 1) {
+                // The exit diameters of this length were cut short, so it is not compared as a candidate
+                // and counts only with its evaluated part
+                best_result.coverage = (evaluated - 1 + result.coverage) / (evaluated + remaining - 1);
+                return best_result;
+            }
+            qreal d_out = result.d_out;
+            qreal current_loss_value = result.loss;
 
             if (current_loss_value < best_result.loss) {
-                qDebug() << "NEW RECORD";
                 best_result = Parameters(i, d_out, current_loss_value);
                 not_changing_count = 0;
             } else {
                 ++not_changing_count;
             }
-            qDebug() << "(Length) " << "Length: " << i << " D_out: " << d_out << " Loss: " << current_loss_value;
+            ++candidates;
+            report_progress(static_cast<qreal>(evaluated) / (evaluated + remaining - 1), QPair<qint64, qint64>(), best_result);
         }
-        qDebug() << "(Best) " << "Length: " << best_result.length << " D_out: " << best_result.d_out << " Loss: " << best_result.loss;
         if (best_result.length > 0) {
             ++iteration;
         } else break;
@@ -541,35 +2003,346 @@ MainWindow::Parameters MainWindow::full_optimisation() {
     return best_result;
 }
 
-MainWindow::Parameters MainWindow::complex_optimisation() {
+Parameters Model::complex_optimisation() {
     // This mode is too heavy to use in its current form so it's currently uneccessible from the UI.
     // The results obtained through tests suggest that the idea of optimising 3 parameters at once is really excessive anyway.
     // Optimising focon's length and exit diameter with autofocused lens works much faster and gives the same results.
-    int focus_low_limit = qFloor(ui->focal_length->minimum());
-    int focus_high_limit = qMin(qCeil(ui->focal_length->maximum()), 500);
+    int focus_low_limit = qFloor(settings.focal_length_min);
+    int focus_high_limit = qMin(qCeil(settings.focal_length_max), 500);
     Parameters best_result;
     for (int focus = focus_low_limit; focus <= focus_high_limit; ++focus) {
+        if (budget.exhausted()) {
+            best_result.coverage = static_cast<qreal>(focus - focus_low_limit) / (focus_high_limit - focus_low_limit + 1);
+            break;
+        }
         lens.set_focus(focus);
         auto result = full_optimisation();
+        if (result.coverage < 1) {
+            // The lengths of this focus were cut short, so it is not compared as a candidate
+            best_result.coverage = (focus - focus_low_limit + result.coverage) / (focus_high_limit - focus_low_limit + 1);
+            break;
+        }
         if (result.loss < best_result.loss) {
-            qDebug() << "NEW RECORD";
             best_result = Parameters(focus, result);
         }
-        qDebug() << "(Focus) " << "Length: " << best_result.length << " D_out: " << best_result.d_out << " F': " << focus << " Loss: " << best_result.loss;
     }
     return best_result;
 }
 
-qreal MainWindow::loss(const QPair<int, int>& result) const {
-    int beams_passed = result.first;
-    int beams_total = result.second;
+qreal Model::loss(const QPair<int, int>& result) {
+    return loss(result.first, result.second);
+}
+
+qreal Model::loss(qint64 beams_passed, qint64 beams_total) {
     return 10*qLn(static_cast<qreal>(beams_total)/beams_passed)/qLn(10);
 }
 
-qreal MainWindow::mean_exit_angle() const {
-    qreal result = 0;
-    for (const auto& angle : beam_angles) {
-        result += angle;
+qreal Model::loss(qreal transmission) {
+    return -10*qLn(transmission)/qLn(10);
+}
+
+QString Model::results_message(qint64 beams_passed, qint64 beams_total, qreal coverage) {
+    QString passed = "Принято ";
+    QString beams_of = " лучей из ";
+
+    if ((beams_passed % 100 - beams_passed % 10) != 10) {
+        if (beams_passed % 10 == 1) {
+            passed = "Принят ";
+            beams_of = " луч из ";
+        } else if (beams_passed % 10 > 1 && beams_passed % 10 < 5) {
+            beams_of = " луча из ";
+        }
+    }
+
+    return passed + QString().setNum(beams_passed) + beams_of + QString().setNum(beams_total)
+           + ". Потери составляют " + QString().setNum(loss(beams_passed, beams_total)) + " дБ." + coverage_message(coverage);
+}
+
+QString Model::results_message(const Parameters& result) const {
+    QString message;
+    switch (settings.mode) {
+    case LENGTH_OPTIMISATION:
+        if (result.length > 0) {
+            message = "Оптимальная длина фокона составляет " + QString().setNum(result.length)
+                    + " мм. Потери составляют " + QString().setNum(result.loss) + " дБ.";
+        } else {
+            message = "Оптимального значения длины в пределах до " + QString().setNum(length_limit)
+                    + " мм не найдено: потери для боковых пучков превышают "
+                    + QString().setNum(loss_limit) + " дБ. Попробуйте уменьшить входной угол пучка или увеличить допуск потерь.";
+        }
+        break;
+    case D_OUT_OPTIMISATION:
+        if (result.d_out > 0) {
+            message = "Оптимальный диаметр выходного окна оставляет " + QString().setNum(result.d_out)
+                    + " мм. Потери составляют " + QString().setNum(result.loss) + " дБ.";
+        } else {
+            message = "Оптимального значения диаметра выходного окна не найдено: потери для боковых пучков превышают "
+                    + QString().setNum(loss_limit) + " дБ. Попробуйте уменьшить входной угол пучка или увеличить допуск потерь.";
+        }
+        break;
+    case FOCUS_OPTIMISATION:
+        if (result.focus > 0) {
+            message = "Оптимальное фокусное расстояние составляет " + QString().setNum(result.focus)
+                    + " мм. Потери составляют " + QString().setNum(result.loss) + " дБ.";
+        } else {
+            message = "Оптимального значения фокусного расстояния не найдено: потери для боковых пучков превышают "
+                    + QString().setNum(loss_limit) + " дБ. Попробуйте уменьшить входной угол пучка или увеличить допуск потерь.";
+        }
+        break;
+    default:
+        if (result.length > 0) {
+            if (result.focus > 0) {
+                message = "Оптимальные параметры: длина = " + QString().setNum(result.length)
+                        + " мм, выходной диаметр = " + QString().setNum(result.d_out)
+                        + " мм, фокусное расстояние = " + QString().setNum(result.focus)
+                        + " мм. Потери составляют " + QString().setNum(result.loss) + " дБ.";
+            } else {
+                message = "Оптимальные параметры: длина = " + QString().setNum(result.length)
+                        + " мм, выходной диаметр = " + QString().setNum(result.d_out)
+                        + " мм. Потери составляют " + QString().setNum(result.loss) + " дБ.";
+            }
+        } else {
+            message = "Оптимальной комбинации параметров не найдено: потери для боковых пучков превышают "
+                    + QString().setNum(loss_limit) + " дБ. Попробуйте уменьшить входной угол пучка или увеличить допуск потерь.";
+        }
+        break;
+    }
+    return message + coverage_message(result.coverage);
+}
+
+QString Model::results_message(const Distribution& angles) const {
+    return "Средний выходной угол = " + QString().setNum(angles.mean) + " градусов, СКО = "
+            + QString().setNum(angles.deviation()) + ", 90% лучей выходят под углом до "
+            + QString().setNum(angles.quantile(0.9)) + ", максимальный = " + QString().setNum(angles.maximum) + " градусов.";
+}
+
+QString Model::results_message(const SpotDiagram& spot) const {
+    if (spot.beams == 0) return "Ни один луч не достиг плоскости приёмника.";
+    return "Радиус пятна на приёмнике: " + QString().setNum(spot.detector_radii.quantile(0.5)) + " мм (50% лучей), "
+            + QString().setNum(spot.detector_radii.quantile(0.9)) + " мм (90%), "
+            + QString().setNum(spot.detector_radii.quantile(1)) + " мм (100%). Медианный угол падения: "
+            + QString().setNum(spot.incidence_angles.quantile(0.5)) + " градусов, максимальный: "
+            + QString().setNum(spot.max_angle) + " градусов.";
+}
+
+QString Model::energy_message(const SamplingStatistics& statistics) const {
+    if (!settings.energy || statistics.detected_energy <= 0) return QString();
+    return " Потери энергии с учётом отражения от стенок, френелевского отражения и поглощения: "
+            + QString().setNum(statistics.energy_loss()) + " ± " + QString().setNum(statistics.energy_loss_error()) + " дБ.";
+}
+
+QVector<QPair<qreal, qreal>> Model::band_losses(const SamplingStatistics& statistics) const {
+    // In the energy mode the bands' losses include the energy lost by the detected beams as well
+    QVector<QPair<qreal, qreal>> losses;
+    QVector<qreal> wavelengths = settings.band_wavelengths();
+    for (int k = 0; k < statistics.bands(); ++k) {
+        losses.push_back(qMakePair(wavelengths.value(k), statistics.band_loss(k, settings.energy)));
+    }
+    return losses;
+}
+
+QString Model::bands_message(const QVector<QPair<qreal, qreal>>& bands) const {
+    if (bands.isEmpty()) return QString();
+    QStringList losses;
+    for (const auto& band : bands) {
+        losses.push_back(QString().setNum(band.first * 1000, 'f', 0) + " нм: " + QString().setNum(band.second, 'g', 4));
+    }
+    return " Потери по спектральным полосам, дБ: " + losses.join("; ") + ".";
+}
+
+QString Model::tolerance_message(const QPair<int, int>& nominal, const QVector<qreal>& losses, const QVector<qreal>& sensitivities) const {
+    QString message = "Номинальные потери: " + QString().setNum(loss(nominal)) + " дБ.";
+    if (losses.isEmpty()) return message + " Ни один вариант конструкции не рассчитан." + coverage_message(coverage);
+    message += " Рассчитано вариантов: " + QString().setNum(losses.size())
+            + ". Потери вариантов: P10 " + QString().setNum(percentile(losses, 0.1))
+            + ", медиана " + QString().setNum(percentile(losses, 0.5))
+            + ", P90 " + QString().setNum(percentile(losses, 0.9))
+            + ", P99 " + QString().setNum(percentile(losses, 0.99))
+            + ", максимум " + QString().setNum(losses.last()) + " дБ.";
+    int blind = std::count_if(losses.begin(), losses.end(), [](qreal value) { return !qIsFinite(value); });
+    if (blind > 0) message += " Вариантов без принятых лучей: " + QString().setNum(blind) + ".";
+    // The parameters are listed from the most influential one
+    QVector<int> order;
+    for (int i = 0; i < TOLERANCES; ++i) {
+        if (sensitivities[i] != 0) order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return qFabs(sensitivities[a]) > qFabs(sensitivities[b]); });
+    QStringList items;
+    for (int i : order) {
+        items << tolerance_name(i) + " (±" + QString().setNum(settings.tolerances[i]) + " мм): "
+                 + QString().setNum(sensitivities[i], 'g', 3);
+    }
+    if (!items.isEmpty()) message += " Чувствительность к отклонениям, дБ на допуск: " + items.join("; ") + ".";
+    return message + coverage_message(coverage);
+}
+
+QString Model::parameter_unit(int parameter) {
+    return parameter == scan_angle ? QString("°") : parameter == SENSITIVITY_DEFOCUS ? QString() : QString(" мм");
+}
+
+QString Model::sensitivity_message(const QVector<ParameterSensitivity>& gradients) const {
+    if (gradients.isEmpty() || !qIsFinite(gradients.first().loss)) {
+        return "Текущая конструкция не принимает ни одного луча." + coverage_message(coverage);
+    }
+    QString message = "Потери текущей конструкции: " + QString().setNum(gradients.first().loss) + " дБ.";
+    QStringList items;
+    for (const auto& sensitivity : gradients) {
+        QString unit = parameter_unit(sensitivity.parameter);
+        QString item = parameter_name(sensitivity.parameter) + " (шаг " + QString().setNum(sensitivity.step) + unit + "): ";
+        if (!sensitivity.valid) {
+            items << item + "нет данных";
+            continue;
+        }
+        QString per_unit = unit.isEmpty() ? " дБ" : " дБ/мм";
+        item += "градиент " + QString().setNum(sensitivity.gradient, 'g', 3) + per_unit
+                + ", кривизна " + QString().setNum(2 * sensitivity.curvature, 'g', 3) + (unit.isEmpty() ? " дБ" : " дБ/мм²");
+        // The vertex of the parabola estimates the optimum along the parameter
+        if (sensitivity.curvature > 0) {
+            item += ", минимум при отклонении " + QString().setNum(-sensitivity.slope / (2 * sensitivity.curvature), 'g', 3) + unit;
+        } else item += ", минимума нет";
+        items << item;
     }
-    return result/beam_angles.size();
+    return message + " " + items.join("; ") + "." + coverage_message(coverage);
+}
+
+QString Model::scan_message(const Curve& scanned) const {
+    QString unit = parameter_unit(scanned.parameter);
+    auto argument = [&](int k) { return QString().setNum(scanned.arguments[k], 'g', 4) + unit; };
+    int evaluated = 0, empty = 0;
+    for (const auto& point : scanned.counts) {
+        if (point.second == 0) continue;
+        ++evaluated;
+        if (point.first == 0) ++empty;
+    }
+    if (evaluated == 0) return "Ни одна точка не рассчитана." + coverage_message(coverage);
+
+    QString message;
+    if (scanned.parameter == scan_angle) {
+        auto transmission = [&](int k) {
+            const auto& point = scanned.counts[k];
+            return point.second > 0 ? static_cast<qreal>(point.first) / point.second : qQNaN();
+        };
+        int last = scanned.arguments.size() - 1;
+        while (last > 0 && scanned.counts[last].second == 0) --last;
+        message = "Пропускание параллельного пучка: " + QString().setNum(100 * transmission(0), 'g', 3) + "% при " + argument(0)
+                + ", " + QString().setNum(100 * transmission(last), 'g', 3) + "% при " + argument(last) + ".";
+        // The half transmission angle is interpolated between the points
+        qreal half = transmission(0) / 2;
+        for (int k = 1; k <= last && half > 0; ++k) {
+            if (transmission(k) >= half) continue;
+            qreal share = (transmission(k - 1) - half) / (transmission(k - 1) - transmission(k));
+            qreal angle = scanned.arguments[k - 1] + share * (scanned.arguments[k] - scanned.arguments[k - 1]);
+            message += " Пропускание падает вдвое при " + QString().setNum(angle, 'g', 3) + "°.";
+            break;
+        }
+    } else {
+        int best = -1, worst = -1;
+        for (int k = 0; k < scanned.counts.size(); ++k) {
+            if (scanned.counts[k].first == 0) continue;
+            if (best < 0 || loss(scanned.counts[k]) < loss(scanned.counts[best])) best = k;
+            if (worst < 0 || loss(scanned.counts[k]) > loss(scanned.counts[worst])) worst = k;
+        }
+        message = parameter_name(scanned.parameter) + " от " + argument(0) + " до " + argument(scanned.arguments.size() - 1) + ": ";
+        message += best < 0
+                ? "ни в одной точке лучи не приняты."
+                : "наименьшие потери " + QString().setNum(loss(scanned.counts[best])) + " дБ при " + argument(best)
+                  + ", наибольшие " + QString().setNum(loss(scanned.counts[worst])) + " дБ при " + argument(worst) + ".";
+    }
+    if (empty > 0 && empty < evaluated) {
+        message += " Точек без принятых лучей: " + QString().setNum(empty) + ".";
+    }
+    return message + coverage_message(coverage);
+}
+
+QString Model::reverse_results_message(const SamplingStatistics& statistics, qreal acceptance, qreal loss_error) const {
+    qint64 reached = statistics.statuses[HIT] + statistics.statuses[DETECTED];
+    QString message = "С приёмника выпущено лучей: " + QString().setNum(statistics.total)
+            + ", дошли до входа: " + QString().setNum(reached)
+            + ", из них в пределах входного угла: " + QString().setNum(statistics.passed) + ".";
+    if (statistics.passed == 0) return message + " Ни один луч не попал в пределы входного угла." + coverage_message(coverage);
+    message += " Принимается " + QString().setNum(acceptance * 100) + "% этендю входа"
+            + (settings.energy ? " с учётом потерь энергии" : "") + ", потери "
+            + QString().setNum(loss(acceptance)) + " ± " + QString().setNum(loss_error) + " дБ.";
+    // Reverse tracing pays off when the detector's etendue is the smaller one
+    if (etendue_ratio() > 1) {
+        message += " Этендю приёмника больше этендю входа, прямой метод Монте-Карло здесь эффективнее.";
+    }
+    return message + coverage_message(coverage);
+}
+
+QString Model::failure_name(BeamStatus status) {
+    switch (status) {
+    case DEGENERATE_ROOT:
+        return "не найдено пересечение со стенкой";
+    case VERTEX_HIT:
+        return "луч попал в вершину полости";
+    case NON_TERMINATING:
+        return "луч не покидает фокон";
+    default:
+        return QString();
+    }
+}
+
+QString Model::tolerance_name(int tolerance) {
+    switch (tolerance) {
+    case TOLERANCE_D1:
+        return "D1";
+    case TOLERANCE_D2:
+        return "D2";
+    case TOLERANCE_LENGTH:
+        return "длина";
+    case TOLERANCE_DETECTOR_OFFSET:
+        return "смещение приёмника";
+    case TOLERANCE_FOCAL_LENGTH:
+        return "фокус линзы";
+    default:
+        return QString();
+    }
+}
+
+QString Model::parameter_name(int parameter) {
+    switch (parameter) {
+    case SENSITIVITY_LENGTH:
+        return "Длина";
+    case SENSITIVITY_D2:
+        return "D2";
+    case SENSITIVITY_FOCAL_LENGTH:
+        return "Фокус линзы";
+    case SENSITIVITY_DEFOCUS:
+        return "Расфокусировка";
+    case SENSITIVITY_CAVITY_LENGTH:
+        return "Глубина полости";
+    case SENSITIVITY_DETECTOR_OFFSET:
+        return "Смещение приёмника";
+    case scan_angle:
+        return "Входной угол";
+    default:
+        return QString();
+    }
+}
+
+qreal Model::percentile(const QVector<qreal>& sorted, qreal q) {
+    // Nearest rank
+    if (sorted.isEmpty()) return 0;
+    int rank = qBound(1, qCeil(q * sorted.size()), sorted.size());
+    return sorted[rank - 1];
+}
+
+QString Model::failures_message(const QVector<qint64>& failure_counts, qint64 beams) {
+    qint64 failures = 0;
+    QStringList classes;
+    for (int status = DEGENERATE_ROOT; status < failure_counts.size(); ++status) {
+        if (failure_counts[status] == 0) continue;
+        failures += failure_counts[status];
+        classes << failure_name(static_cast<BeamStatus>(status)) + " — " + QString().setNum(failure_counts[status]);
+    }
+    return " Не удалось рассчитать ход " + QString().setNum(failures) + " из " + QString().setNum(beams)
+            + " лучей (" + QString().setNum(100.0 * failures / qMax<qint64>(1, beams), 'g', 3) + "%: "
+            + classes.join(", ") + "), они исключены из расчёта.";
+}
+
+QString Model::coverage_message(qreal coverage) {
+    if (coverage >= 1) return QString();
+    return " Вычисления прерваны досрочно: охвачено " + QString().setNum(qRound(coverage * 100))
+            + "% пространства поиска.";
 }
@@ -0,0 +1,83 @@
+#include "..\include\checkpoint.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QSaveFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+
+bool Checkpoint::open(const QString& file_path, const QString& settings_fingerprint) {
+    close();
+    path = file_path;
+    fingerprint = settings_fingerprint;
+    timer.start();
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+    QJsonObject json_file = QJsonDocument::fromJson(file.readAll()).object();
+    file.close();
+    // Results obtained with different settings are useless and have to be discarded
+    if (json_file.value("Fingerprint").toString() != fingerprint) return false;
+
+    QJsonObject stored_results = json_file.value("Results").toObject();
+    for (auto it = stored_results.constBegin(); it != stored_results.constEnd(); ++it) {
+        QJsonArray counts = it.value().toArray();
+        results.insert(it.key(), qMakePair(counts.at(0).toInt(), counts.at(1).toInt()));
+    }
+    return !results.isEmpty();
+}
+
+bool Checkpoint::lookup(const QString& key, QPair<int, int>& result) const {
+    auto it = results.constFind(key);
+    if (it == results.constEnd()) return false;
+    result = it.value();
+    return true;
+}
+
+void Checkpoint::store(const QString& key, const QPair<int, int>& result) {
+    if (!is_open()) return;
+    results.insert(key, result);
+    modified = true;
+    if (timer.elapsed() > save_interval) save();
+}
+
+void Checkpoint::save() {
+    if (!is_open() || !modified) return;
+    QJsonObject stored_results;
+    for (auto it = results.constBegin(); it != results.constEnd(); ++it) {
+        stored_results.insert(it.key(), QJsonArray({it.value().first, it.value().second}));
+    }
+    QJsonObject json_file = {
+                              {"Fingerprint", fingerprint},
+                              {"Results", stored_results}
+                            };
+    // The file is replaced atomically so that an interruption during saving does not corrupt it
+    QSaveFile file(path);
+    if (file.open(QIODevice::WriteOnly)) {
+        file.write(QJsonDocument(json_file).toJson(QJsonDocument::Compact));
+        file.commit();
+    }
+    modified = false;
+    timer.restart();
+}
+
+void Checkpoint::remove() {
+    if (is_open()) QFile::remove(path);
+    path.clear();
+    results.clear();
+    modified = false;
+}
+
+void Checkpoint::close() {
+    save();
+    path.clear();
+    results.clear();
+    modified = false;
+}
+
+QString Checkpoint::path_for(const QString& settings_path) {
+    if (settings_path.isEmpty()) return QString();
+    QFileInfo info(settings_path);
+    return info.dir().filePath(info.completeBaseName() + ".checkpoint");
+}
@@ -0,0 +1,75 @@
+#include "..\include\curve_plot.h"
+#include <QtMath>
+
+void CurvePlot::set_curve(const Curve& new_curve) {
+    curve = new_curve;
+    update();
+}
+
+void CurvePlot::paintEvent(QPaintEvent * event) {
+    Q_UNUSED(event);
+    QPainter painter(this);
+    painter.fillRect(rect(), palette().base());
+    painter.setPen(palette().text().color());
+
+    // The transmission is given in percents, the loss in dB. The points not evaluated
+    // and the losses of the points without passed beams break the line
+    bool transmission = curve.parameter == scan_angle;
+    QVector<qreal> values(curve.arguments.size(), qQNaN());
+    qreal low = 0, high = 0;
+    bool found = false;
+    for (int k = 0; k < values.size(); ++k) {
+        const auto& point = curve.counts[k];
+        if (point.second == 0 || (!transmission && point.first == 0)) continue;
+        values[k] = transmission ? 100.0 * point.first / point.second : Model::loss(point);
+        low = found ? qMin(low, values[k]) : values[k];
+        high = found ? qMax(high, values[k]) : values[k];
+        found = true;
+    }
+    if (!found) {
+        painter.drawText(rect(), Qt::AlignCenter, "Нет данных");
+        return;
+    }
+    const QFontMetrics metrics = fontMetrics();
+    QString unit = Model::parameter_unit(curve.parameter);
+    QString title = QString(transmission ? "Пропускание" : "Потери") + " в зависимости от параметра «"
+            + Model::parameter_name(curve.parameter) + "»: от " + QString().setNum(low, 'f', 2)
+            + " до " + QString().setNum(high, 'f', 2) + (transmission ? "%" : " дБ");
+    painter.drawText(QRect(0, 0, width(), metrics.height() + 4), Qt::AlignCenter, title);
+
+    // The transmission is shown in full, the loss over its range
+    if (transmission) {
+        low = 0;
+        high = 100;
+    } else if (high - low < 0.01) {
+        low -= 0.005;
+        high += 0.005;
+    }
+
+    QRectF plot = QRectF(10, metrics.height() + 8, width() - 20, height() - 2*metrics.height() - 16);
+    if (plot.width() <= 0 || plot.height() <= 0) return;
+    qreal x_low = curve.arguments.first(), x_high = curve.arguments.last();
+    if (x_high <= x_low) x_high = x_low + 1;
+    auto point_of = [&](int k) {
+        return QPointF(plot.left() + (curve.arguments[k] - x_low) / (x_high - x_low) * plot.width(),
+                       plot.bottom() - (values[k] - low) / (high - low) * plot.height());
+    };
+
+    painter.setPen(QPen(palette().highlight(), 2));
+    painter.setBrush(palette().highlight());
+    for (int k = 0; k < values.size(); ++k) {
+        if (!qIsFinite(values[k])) continue;
+        if (k > 0 && qIsFinite(values[k - 1])) {
+            painter.drawLine(point_of(k - 1), point_of(k));
+        }
+        painter.drawEllipse(point_of(k), 1.5, 1.5);
+    }
+
+    // Axes with the range's bounds
+    painter.setPen(palette().text().color());
+    painter.drawLine(plot.bottomLeft(), plot.bottomRight());
+    painter.drawLine(plot.bottomLeft(), plot.topLeft());
+    QRectF labels = QRectF(plot.left(), plot.bottom() + 2, plot.width(), metrics.height());
+    painter.drawText(labels, Qt::AlignLeft, QString().setNum(x_low) + unit);
+    painter.drawText(labels, Qt::AlignRight, QString().setNum(x_high) + unit);
+}
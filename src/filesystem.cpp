@@ -1,30 +1,66 @@
 #include "..\include\mainwindow.h"
 #include "ui_mainwindow.h"
 
+QJsonObject MainWindow::settings() const {
+    return {
+             {"D1", ui->d_in->value()},
+             {"D2", ui->d_out->value()},
+             {"Length", ui->length->value()},
+             {"Angle", ui->angle->value()},
+             {"X offset", ui->offset->value()},
+             {"Y offset", ui->height->value()},
+             {"Detector's window", ui->aperture->value()},
+             {"Detector's offset", ui->offset_det->value()},
+             {"Detector's FOV", ui->fov->value()},
+             {"Detector's diameter", ui->d_det->value()},
+             {"Mode", ui->mode->currentIndex()},
+             {"Rotation", ui->rotation->value()},
+             {"Lens", ui->lens->isChecked()},
+             {"Focal length", ui->focal_length->value()},
+             {"Auto focus", ui->auto_focus->isChecked()},
+             {"Defocus", ui->defocus->value()},
+             {"Ocular", ui->ocular->isChecked()},
+             {"Ocular focal length", ui->ocular_focal_length->value()},
+             {"Glass", ui->glass->isChecked()},
+             {"Cavity length", ui->cavity_length->value()},
+             {"Precision", ui->precision->currentIndex()},
+             {"Single precision", ui->single_precision->isChecked()},
+             {"Energy", ui->energy->isChecked()},
+             {"Wall reflectivity", ui->wall_reflectivity->value()},
+             {"Absorption", ui->absorption->value()},
+             {"Glass material", glass_material.to_json()},
+             {"Wavelength", ui->wavelength->value()},
+             {"Minimal wavelength", ui->wavelength_min->value()},
+             {"Maximal wavelength", ui->wavelength_max->value()},
+             {"Bands", ui->bands->value()},
+             {"D1 tolerance", ui->d_in_tolerance->value()},
+             {"D2 tolerance", ui->d_out_tolerance->value()},
+             {"Length tolerance", ui->length_tolerance->value()},
+             {"Detector's offset tolerance", ui->offset_det_tolerance->value()},
+             {"Focal length tolerance", ui->focal_length_tolerance->value()},
+             {"Normal tolerances", ui->tolerance_distribution->currentIndex() == 1},
+             {"Designs", ui->designs->value()},
+             {"Scan parameter", ui->scan_parameter->currentIndex()},
+             {"Scan start", ui->scan_from->value()},
+             {"Scan end", ui->scan_to->value()},
+             {"Scan points", ui->scan_points->value()},
+             {"Budget", ui->budget->isChecked()},
+             {"Time limit", ui->time_limit->value()},
+             {"Beam limit", ui->beam_limit->value()},
+             {"Rays file", rays_source_path}
+           };
+}
+
+Settings MainWindow::current_settings() const {
+    Settings current = Settings::from_json(settings());
+    current.focal_length_min = ui->focal_length->minimum();
+    current.focal_length_max = ui->focal_length->maximum();
+    current.path = settings_path;
+    return current;
+}
+
 void MainWindow::save_settings() {
-    QJsonObject json_file = {
-                              {"D1", ui->d_in->value()},
-                              {"D2", ui->d_out->value()},
-                              {"Length", ui->length->value()},
-                              {"Angle", ui->angle->value()},
-                              {"X offset", ui->offset->value()},
-                              {"Y offset", ui->height->value()},
-                              {"Detector's window", ui->aperture->value()},
-                              {"Detector's offset", ui->offset_det->value()},
-                              {"Detector's FOV", ui->fov->value()},
-                              {"Detector's diameter", ui->d_det->value()},
-                              {"Mode", ui->mode->currentIndex()},
-                              {"Rotation", ui->rotation->value()},
-                              {"Lens", ui->lens->isChecked()},
-                              {"Focal length", ui->focal_length->value()},
-                              {"Auto focus", ui->auto_focus->isChecked()},
-                              {"Defocus", ui->defocus->value()},
-                              {"Ocular", ui->ocular->isChecked()},
-                              {"Ocular focal length", ui->ocular_focal_length->value()},
-                              {"Glass", ui->glass->isChecked()},
-                              {"Cavity length", ui->cavity_length->value()},
-                              {"Precision", ui->precision->currentIndex()}
-                            };
+    QJsonObject json_file = settings();
     QString fileName = QFileDialog::getSaveFileName(this, tr("Сохранить файл"),
                                                     QCoreApplication::applicationDirPath() + "//untitled.foc",
                                                     tr("Файлы настроек (*.foc)"));
@@ -35,6 +71,7 @@ void MainWindow::save_settings() {
             out << QJsonDocument(json_file).toJson();
             file.close();
         }
+        settings_path = fileName;
         ui->statusbar->showMessage("Настройки сохранены");
     }
 }
@@ -46,6 +83,7 @@ void MainWindow::load_settings() {
     QFile file;
     file.setFileName(filepath);
     file.open(QIODevice::ReadOnly | QIODevice::Text);
+    settings_path = filepath;
     QString val = file.readAll();
     file.close();
 
@@ -115,6 +153,52 @@ void MainWindow::load_settings() {
     if (json_file.contains("Precision")) {
         ui->precision->setCurrentIndex(json_file.value("Precision").toInt());
     }
+    ui->single_precision->setChecked(json_file.value("Single precision").toBool());
+    ui->energy->setChecked(json_file.value("Energy").toBool());
+    if (json_file.contains("Wall reflectivity")) {
+        ui->wall_reflectivity->setValue(json_file.value("Wall reflectivity").toDouble());
+    }
+    if (json_file.contains("Absorption")) {
+        ui->absorption->setValue(json_file.value("Absorption").toDouble());
+    }
+    Glass material;
+    Glass::from_json(json_file.value("Glass material").toObject(), material);
+    set_material(material);
+    if (json_file.contains("Wavelength")) {
+        ui->wavelength->setValue(json_file.value("Wavelength").toDouble());
+    }
+    if (json_file.contains("Minimal wavelength")) {
+        ui->wavelength_min->setValue(json_file.value("Minimal wavelength").toDouble());
+    }
+    if (json_file.contains("Maximal wavelength")) {
+        ui->wavelength_max->setValue(json_file.value("Maximal wavelength").toDouble());
+    }
+    ui->bands->setValue(json_file.value("Bands").toInt());
+    ui->d_in_tolerance->setValue(json_file.value("D1 tolerance").toDouble());
+    ui->d_out_tolerance->setValue(json_file.value("D2 tolerance").toDouble());
+    ui->length_tolerance->setValue(json_file.value("Length tolerance").toDouble());
+    ui->offset_det_tolerance->setValue(json_file.value("Detector's offset tolerance").toDouble());
+    ui->focal_length_tolerance->setValue(json_file.value("Focal length tolerance").toDouble());
+    ui->tolerance_distribution->setCurrentIndex(json_file.value("Normal tolerances").toBool() ? 1 : 0);
+    if (json_file.contains("Designs")) {
+        ui->designs->setValue(json_file.value("Designs").toInt());
+    }
+    if (json_file.contains("Scan parameter")) {
+        ui->scan_parameter->setCurrentIndex(json_file.value("Scan parameter").toInt());
+        ui->scan_from->setValue(json_file.value("Scan start").toDouble());
+        ui->scan_to->setValue(json_file.value("Scan end").toDouble());
+        ui->scan_points->setValue(json_file.value("Scan points").toInt());
+    }
+    if (json_file.contains("Budget")) {
+        ui->budget->setChecked(json_file.value("Budget").toBool());
+    }
+    if (json_file.contains("Time limit")) {
+        ui->time_limit->setValue(json_file.value("Time limit").toInt());
+    }
+    if (json_file.contains("Beam limit")) {
+        ui->beam_limit->setValue(json_file.value("Beam limit").toInt());
+    }
+    rays_source_path = json_file.value("Rays file").toString();
     if (json_file.contains("Defocusing")) { // This subfunction provides backwards compatibility with older save files
         auto def = json_file.value("Defocusing").toString();
         ui->defocus->setValue(def == "plus" ? 1 : def == "minus" ? -1 : 0);
@@ -147,3 +231,60 @@ void MainWindow::save_image_xoy() {
         ui->statusbar->showMessage("Изображение сохранено: " + fileName);
     }
 }
+
+void MainWindow::save_spot() {
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Сохранить распределения"),
+                                                    QCoreApplication::applicationDirPath(),
+                                                    tr("Таблица CSV (*.csv)"));
+    if (!fileName.isNull()) {
+        QFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            ui->statusbar->showMessage("Не удалось сохранить файл " + fileName);
+            return;
+        }
+        file.write(spot.to_csv().toUtf8());
+        file.close();
+        ui->statusbar->showMessage("Распределения сохранены: " + fileName);
+    }
+}
+
+void MainWindow::save_curve() {
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Сохранить кривую"),
+                                                    QCoreApplication::applicationDirPath(),
+                                                    tr("Таблица CSV (*.csv)"));
+    if (!fileName.isNull()) {
+        QFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            ui->statusbar->showMessage("Не удалось сохранить файл " + fileName);
+            return;
+        }
+        file.write(curve.to_csv().toUtf8());
+        file.close();
+        ui->statusbar->showMessage("Кривая сохранена: " + fileName);
+    }
+}
+
+void MainWindow::set_recording(bool recording) {
+    if (!recording) return;
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Записывать лучи в файл"),
+                                                    QCoreApplication::applicationDirPath(),
+                                                    tr("Файл лучей (*.rays)"));
+    if (fileName.isNull()) {
+        // Recording stays off until a file is chosen
+        QSignalBlocker blocker(ui->record_rays);
+        ui->record_rays->setChecked(false);
+        return;
+    }
+    rays_path = fileName;
+    ui->statusbar->showMessage("Лучи следующих расчётов будут записываться в файл " + rays_path);
+}
+
+void MainWindow::open_rays() {
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Выбрать файл лучей"),
+                                                    QCoreApplication::applicationDirPath(),
+                                                    tr("Файлы лучей (*.rays *.bin *.csv *.txt);;Все файлы (*)"));
+    if (!fileName.isNull()) {
+        rays_source_path = fileName;
+        ui->statusbar->showMessage("Выбран файл лучей: " + fileName);
+    }
+}
@@ -1,6 +1,8 @@
 #include "..\include\geometry.h"
+#include "..\include\profiler.h"
 #include <QDebug>
 #include <iomanip>
+#include <cmath>
 
 QDebug& operator<<(QDebug debug, const Point& p) {
     debug << "Point (" << QString().setNum(p.x_, 'f', 6) << ", "
@@ -92,7 +94,7 @@ QDebug& operator<<(QDebug debug, const Matrix& m) {
     return debug.noquote();
 }
 
-bool Tube::is_conic() { return dynamic_cast<Cone*>(this); }
+bool Tube::is_conic() const { return dynamic_cast<const Cone*>(this); }
 
 QDebug& operator<<(QDebug debug, const Beam& b) {
     debug << "Beam (" << b.p << "dx = " << QString().setNum(b.d_x(), 'f', 6) << ", "
@@ -111,10 +113,9 @@ Beam Tube::reflected(const Beam& beam, const Point& intersection) const {
     return m.transponed()*transformed_beam;
 }
 
-Beam Tube::refracted(const Beam &beam) const {
+Beam Tube::refracted(const Beam &beam, qreal n) const {
     qreal length_xz = sqrt(beam.d_x()*beam.d_x() + beam.d_z()*beam.d_z());
-    qreal n_ratio = beam.d_y() < 0 ? 1.0/1.5 : 1.5;
-    qreal sin_new_beta = qSin(qAcos(beam.d_y()))*n_ratio;
+    qreal sin_new_beta = qSin(qAcos(beam.d_y()))*n;
     if (sin_new_beta > 1 || beam.d_y() < 0) {
         return Beam(beam.p1(), Vector(beam.d_x(), -beam.d_y(), beam.d_z()));
     }
@@ -124,7 +125,8 @@ Beam Tube::refracted(const Beam &beam) const {
     return Beam(beam.p1(), Vector(dx, qCos(new_beta), dz));
 }
 
-Point Tube::intersection(const Beam &beam) const {
+Point Tube::intersection(const Beam &beam, IntersectionStatus * status) const {
+    if (status) *status = INTERSECTION_FOUND;
     // The only case when the beam does not intersect the tube is when the input angle == 0
     // Then the exiting point coordinates in XOY are equal to the input coordinates
     if (qFabs(beam.d_y()) < 1e-6) return Point(beam.x(), beam.y(), 2*length());
@@ -137,61 +139,78 @@ Point Tube::intersection(const Beam &beam) const {
     return Point(beam.x() + t*beam.cos_a(), beam.y() + t*beam.cos_b(), beam.z() + t*beam.cos_g());
 }
 
-Point Cone::intersection(const Beam& beam) const {
-    // Axial beam intersects the cone's vertex and passes
-    if (qFabs(beam.d_y()) < 1e-6 && qFabs(beam.x()) < 1e-6 && qFabs(beam.y()) < 1e-6) {
-        return Point(0, 0, z_k() * (r1() > r2() ? 1 : -length()));
-    }
-    qreal a = pow(beam.cos_a(), 2) + pow(beam.cos_b(), 2) - pow(beam.cos_g()*tan_phi(), 2);
-    qreal b = 2 * (beam.x() * beam.cos_a() + beam.y() * beam.cos_b() - (beam.z() - z_k()) * beam.cos_g() * pow(tan_phi(), 2));
-    qreal c = pow(beam.x(), 2) + pow(beam.y(), 2) - pow((beam.z() - z_k()) * tan_phi(), 2);
-    qreal d = pow(b, 2) - 4*a*c;
-    // There might be a case when 'd' turns out to be a miniscule negative number due to some floating point ambiguities
-    // Negative 'd' means that the beam does not intersect the cone at all, which is impossible
-    // So this case should be fixed by setting 'd' to zero
-    if (d < 0 && fabs(d) < 1e-8) d = 0;
-    // If (a == 0) then the equation degenerates into linear equation
-//    qDebug() << "roots" << (-b + qSqrt(d))/(2*a) << (-b - qSqrt(d))/(2*a);
-    qreal t1 = (-b + qSqrt(d))/(2*a);
-    qreal t2 = (-b - qSqrt(d))/(2*a);
-    // Case 1: t1 > 0, t2 > 0. Beam's starting point does not belong the cone's surface.
-
-    qreal t = qFabs(a) > 1e-9
-            ? t2 > 0 && qFabs(t2) > 1e-6
-              ? qFabs(t1) > 1e-6
-                ? qMin(t1, t2)
-                : t2
-              : /*qFabs(t1) > 1e-9 ? */ t1 //: t2
-            : -c/b;
-//    qDebug() << t << " selected";
-    Point p;
-    if (qFabs(t) < 1e-6) {
-        if (t2 < -1e-6) {
-            t = t2;
-            p = Point(beam.x() - t*beam.cos_a(), beam.y() - t*beam.cos_b(), beam.z() - t*beam.cos_g());
-        } else throw bad_intersection();
-    } else p = Point(beam.x() + t*beam.cos_a(), beam.y() + t*beam.cos_b(), beam.z() + t*beam.cos_g());
-//    qDebug() << "check" << qFabs(qSqrt(p.x()*p.x() + p.y()*p.y())) << (z_k() - p.z())*tan_phi();
-
-    bool correct_root = qFabs(qSqrt(p.x()*p.x() + p.y()*p.y()) - (z_k() - p.z())*tan_phi()) < 1e-6;
-    if (!correct_root && d1() < 1e-6 /*&& qFabs(t2) > 1e-6*/) {
-        t = (t == t1) ? t2 : t1;
-        p = Point(beam.x() + t*beam.cos_a(), beam.y() + t*beam.cos_b(), beam.z() + t*beam.cos_g());
-//        qDebug() << "check failed " << t << " selected instead";
-//        qDebug() << "check" << qFabs(qSqrt(p.x()*p.x() + p.y()*p.y())) << (z_k() - p.z())*tan_phi();
+Point Cone::intersection(const Beam& beam, IntersectionStatus * status) const {
+    // The surface is r = (z_k - z)*tan(phi) and the beam is P + t*D, which gives a*t^2 + 2*h*t + c = 0.
+    // The roots are found without cancellation and only those ahead of the beam and on the cone's own nappe
+    // (the vertex side where the radius is positive) are taken. There are no loops, so every call has a bounded cost.
+    // The failures are reported through the status instead of exceptions, so the caller decides what to do with the beam
+    if (status) *status = INTERSECTION_FOUND;
+    // All the tolerances are relative to the cone's size
+    const qreal scale = qMax(qMax(r1(), r2()), length());
+    const qreal tolerance = intersection_tolerance;
+    const qreal dx = beam.d_x(), dy = beam.d_y(), dz = beam.d_z();
+
+    // A beam that does not meet the surface leaves the cone through one of its ends and gets a point just beyond it
+    auto escape = [&]() {
+        PROFILE_COUNT(PROFILE_ESCAPES);
+        if (qFabs(dz) < tolerance) {
+            // Going across the axis, the beam cannot miss the surface
+            PROFILE_COUNT(PROFILE_FAILED_INTERSECTIONS);
+            if (status) *status = INTERSECTION_DEGENERATE;
+            return beam.p1();
+        }
+        qreal z_end = dz > 0 ? z_offset + length() : z_offset;
+        qreal t = qMax<qreal>((z_end - beam.z()) / dz, 0) + tolerance * scale / qFabs(dz);
+        return Point(beam.x() + t*dx, beam.y() + t*dy, beam.z() + t*dz);
+    };
+
+    // Axial beam passes the cone's vertex
+    if (dx*dx + dy*dy < tolerance * tolerance && beam.p1().r_sqr() < tolerance * tolerance * scale * scale) {
+        return escape();
     }
-    if (qFabs(t) < 1e-6 && d1() > 1e-6) throw bad_intersection();
-    correct_root = qFabs(qSqrt(p.x()*p.x() + p.y()*p.y()) - (z_k() - p.z())*tan_phi()) < 1e-6;
-    if (!correct_root) {
-        // False root means that the beam goes outward without intersecting the cone's surface
-        // (the intersection point is located on the imaginary side).
-        // So the resulting point does not have to belong to the cone's surface
-        // But it has to be located outside of the cone so that no false beams appear from it and the calculations stop.
-        while (d1() > 1e-6 && ((d1() > d2() && beam.z() - t*beam.cos_g() > 0)
-               || (d1() < d2() && beam.z() - t*beam.cos_g() < z_offset + length()))) {
-            t *= 2;
+
+    const qreal tan_phi_ = tan_phi();
+    const qreal tan2 = tan_phi_ * tan_phi_;
+    const qreal w = beam.z() - z_k();
+    const qreal a = dx*dx + dy*dy - dz*dz*tan2;
+    const qreal h = beam.x()*dx + beam.y()*dy - w*dz*tan2;
+    const qreal c = beam.p1().r_sqr() - w*w*tan2;
+    qreal roots[2];
+    int root_count = 0;
+    if (qFabs(a) <= tolerance * (dx*dx + dy*dy + dz*dz*tan2)) {
+        // The beam is parallel to a generatrix, so the equation is linear
+        if (h != 0) roots[root_count++] = -c / (2*h);
+    } else {
+        qreal discriminant = h*h - a*c;
+        if (discriminant < 0) {
+            // A miniscule negative value belongs to a tangent beam spoiled by rounding
+            if (discriminant < -tolerance * (h*h + qFabs(a*c))) return escape();
+            discriminant = 0;
         }
-        p = Point(beam.x() - t*beam.cos_a(), beam.y() - t*beam.cos_b(), beam.z() - t*beam.cos_g());
+        // Both roots are taken from the sum of the terms of the same sign
+        qreal q = -(h + std::copysign(qSqrt(discriminant), h));
+        roots[root_count++] = q / a;
+        if (q != 0) roots[root_count++] = c / q;
+    }
+
+    // The root at the beam's start is the point of the previous reflection
+    const qreal t_min = tolerance * scale;
+    qreal t = qInf();
+    for (int i = 0; i < root_count; ++i) {
+        if (roots[i] <= t_min || roots[i] >= t) continue;
+        // The other nappe lies beyond the vertex
+        qreal z = beam.z() + roots[i]*dz;
+        if ((z_k() - z) * tan_phi_ < -tolerance * scale) continue;
+        t = roots[i];
+    }
+    if (qIsInf(t)) return escape();
+
+    Point p = Point(beam.x() + t*dx, beam.y() + t*dy, beam.z() + t*dz);
+    bool vertex_inside = z_k() > z_offset - tolerance * scale && z_k() < z_offset + length() + tolerance * scale;
+    if (vertex_inside && p.r_sqr() < tolerance * tolerance * scale * scale) {
+        // The vertex inside the cone (the cavity's one) has no normal to reflect or refract the beam
+        PROFILE_COUNT(PROFILE_FAILED_INTERSECTIONS);
+        if (status) *status = INTERSECTION_VERTEX;
     }
     return p;
 }
@@ -227,3 +246,13 @@ Beam Plane::refracted(const Beam &beam, qreal n1, qreal n2) const {
     qreal dy = beam.d_y() * qSin(new_gamma) / length_xy;
     return Beam(beam.p1(), Vector(dx, dy, qCos(new_gamma)));
 }
+
+qreal fresnel_reflectance(qreal cos_in, qreal n1, qreal n2) {
+    cos_in = qMin<qreal>(qFabs(cos_in), 1);
+    qreal sin_out = n1 / n2 * qSqrt(1 - cos_in*cos_in);
+    if (sin_out >= 1) return 1;
+    qreal cos_out = qSqrt(1 - sin_out*sin_out);
+    qreal rs = (n1*cos_in - n2*cos_out) / (n1*cos_in + n2*cos_out);
+    qreal rp = (n1*cos_out - n2*cos_in) / (n1*cos_out + n2*cos_in);
+    return (rs*rs + rp*rp) / 2;
+}
@@ -0,0 +1,62 @@
+#include "..\include\glass.h"
+#include <QtMath>
+#include <QJsonArray>
+#include <QStringList>
+
+static const QStringList formula_names = {"Constant", "Cauchy", "Sellmeier"};
+
+qreal Glass::n(qreal wavelength) const {
+    qreal squared = wavelength * wavelength;
+    switch (formula_) {
+    case CAUCHY: {
+        qreal n = 0, power = 1;
+        for (qreal coefficient : coefficients_) {
+            n += coefficient / power;
+            power *= squared;
+        }
+        return n;
+    }
+    case SELLMEIER: {
+        qreal n_squared = 1;
+        for (int i = 0; i + 1 < coefficients_.size(); i += 2) {
+            n_squared += coefficients_[i] * squared / (squared - coefficients_[i + 1]);
+        }
+        return qSqrt(n_squared);
+    }
+    default:
+        return coefficients_.value(0, 1);
+    }
+}
+
+QJsonObject Glass::to_json() const {
+    QJsonArray stored_coefficients;
+    for (qreal coefficient : coefficients_) {
+        stored_coefficients.append(coefficient);
+    }
+    return {
+             {"Formula", formula_names[formula_]},
+             {"Coefficients", stored_coefficients}
+           };
+}
+
+bool Glass::from_json(const QJsonObject& json_file, Glass& glass) {
+    int formula = formula_names.indexOf(json_file.value("Formula").toString());
+    QVector<qreal> coefficients;
+    for (const auto& value : json_file.value("Coefficients").toArray()) {
+        coefficients.push_back(value.toDouble());
+    }
+    // Sellmeier's terms go in pairs, the others need one coefficient at least
+    bool valid = formula >= 0 && !coefficients.isEmpty() && (formula != SELLMEIER || coefficients.size() % 2 == 0);
+    if (valid) glass = Glass(static_cast<Formula>(formula), coefficients);
+    return valid;
+}
+
+Glass Glass::n_bk7() {
+    // SCHOTT's catalogue data, valid from 0.3 to 2.5 µm
+    return Glass(SELLMEIER, {1.03961212, 0.00600069867, 0.231792344, 0.0200179144, 1.01046945, 103.560653});
+}
+
+Glass Glass::fused_silica() {
+    // Malitson's formula, valid from 0.21 to 3.71 µm
+    return Glass(SELLMEIER, {0.6961663, 0.0684043 * 0.0684043, 0.4079426, 0.1162414 * 0.1162414, 0.8974794, 9.896161 * 9.896161});
+}
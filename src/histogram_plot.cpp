@@ -0,0 +1,65 @@
+#include "..\include\histogram_plot.h"
+#include <algorithm>
+
+void HistogramPlot::set_distribution(const Distribution& new_distribution) {
+    distribution = new_distribution;
+    update();
+}
+
+void HistogramPlot::paintEvent(QPaintEvent * event) {
+    Q_UNUSED(event);
+    QPainter painter(this);
+    painter.fillRect(rect(), palette().base());
+    painter.setPen(palette().text().color());
+    if (distribution.count == 0) {
+        painter.drawText(rect(), Qt::AlignCenter, "Нет данных");
+        return;
+    }
+
+    const QFontMetrics metrics = fontMetrics();
+    QString summary = "Среднее: " + QString().setNum(distribution.mean, 'f', 2) + unit
+            + ", СКО: " + QString().setNum(distribution.deviation(), 'f', 2) + unit
+            + ", медиана: " + QString().setNum(distribution.quantile(0.5), 'f', 2) + unit
+            + ", P90: " + QString().setNum(distribution.quantile(0.9), 'f', 2) + unit
+            + ", P99: " + QString().setNum(distribution.quantile(0.99), 'f', 2) + unit
+            + ", макс.: " + QString().setNum(distribution.maximum, 'f', 2) + unit;
+    painter.drawText(QRect(0, 0, width(), metrics.height() + 4), Qt::AlignCenter, summary);
+
+    QRectF plot = QRectF(10, metrics.height() + 8, width() - 20, height() - 2*metrics.height() - 16);
+    if (plot.width() <= 0 || plot.height() <= 0) return;
+
+    // The range is cut at the maximum rounded up to 5 units, the fine bins are grouped into bars of at least 3 px
+    const Histogram& histogram = distribution.histogram;
+    qreal low = histogram.bin_low(0);
+    qreal high = qMax(low + 5, low + qCeil((distribution.maximum - low) / 5) * 5);
+    int bins = qBound(1, qCeil((high - low) / histogram.bin_width()), histogram.size());
+    high = low + bins * histogram.bin_width();
+    int group = qMax(1, qCeil(3 * bins / plot.width()));
+    QVector<qint64> bars((bins + group - 1) / group, 0);
+    for (int i = 0; i < bins; ++i) {
+        bars[i / group] += histogram[i];
+    }
+    qint64 max_bar = *std::max_element(bars.begin(), bars.end());
+    if (max_bar == 0) return;
+
+    auto x_of = [&](qreal value) { return plot.left() + (value - low) / (high - low) * plot.width(); };
+    qreal bar_width = plot.width() / bars.size();
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(palette().highlight());
+    for (int k = 0; k < bars.size(); ++k) {
+        qreal bar_height = plot.height() * bars[k] / max_bar;
+        painter.drawRect(QRectF(plot.left() + k * bar_width, plot.bottom() - bar_height, bar_width, bar_height));
+    }
+
+    // Axis with the range's bounds and the quantiles marked by dashed lines
+    painter.setPen(palette().text().color());
+    painter.drawLine(plot.bottomLeft(), plot.bottomRight());
+    QRectF labels = QRectF(plot.left(), plot.bottom() + 2, plot.width(), metrics.height());
+    painter.drawText(labels, Qt::AlignLeft, QString().setNum(low) + unit);
+    painter.drawText(labels, Qt::AlignRight, QString().setNum(high) + unit);
+    painter.setPen(QPen(palette().text().color(), 1, Qt::DashLine));
+    for (qreal q : {0.5, 0.9}) {
+        qreal x = x_of(distribution.quantile(q));
+        painter.drawLine(QPointF(x, plot.top()), QPointF(x, plot.bottom()));
+    }
+}
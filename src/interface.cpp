@@ -4,7 +4,6 @@
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
-    , lens(Lens(1))
     , scene(new QGraphicsScene())
     , y_axis(new QGraphicsLineItem())
     , z_axis(new QGraphicsLineItem())
@@ -34,14 +33,63 @@ MainWindow::MainWindow(QWidget *parent)
     , origin_label_xoy(new QGraphicsTextItem("0"))
     , origin_label_yoz(new QGraphicsTextItem("0"))
     , polygon(new QGraphicsPolygonItem())
+    , beams(new BeamsItem())
+    , beams_xoy(new BeamsItem())
+    , density_xoy(new QGraphicsPixmapItem())
+    , angles_plot(new HistogramPlot("°"))
+    , slices_plot(new SlicesPlot())
+    , curve_plot(new CurvePlot())
+    , performance_view(new QPlainTextEdit())
 
 {
     ui->setupUi(this);
 
+    // Beams and progress are reported from the thread pool through queued connections
+    qRegisterMetaType<BeamRecord>();
+    qRegisterMetaType<QVector<BeamRecord>>();
+    qRegisterMetaType<Progress>();
+    qRegisterMetaType<Histogram2D>();
+    connect(&watcher, &QFutureWatcher<Model::Result>::finished, this, &MainWindow::finish_calculation);
+    connect(ui->cancel, &QPushButton::clicked, this, &MainWindow::cancel);
+
     connect(ui->load, SIGNAL(triggered(bool)), this, SLOT(load_settings()));
     connect(ui->save, SIGNAL(triggered(bool)), this, SLOT(save_settings()));
     connect(ui->save_whole_image, SIGNAL(triggered(bool)), this, SLOT(save_image()));
     connect(ui->save_image_xoy, SIGNAL(triggered(bool)), this, SLOT(save_image_xoy()));
+    connect(ui->save_spot, SIGNAL(triggered(bool)), this, SLOT(save_spot()));
+    connect(ui->save_curve, SIGNAL(triggered(bool)), this, SLOT(save_curve()));
+    connect(ui->record_rays, SIGNAL(toggled(bool)), this, SLOT(set_recording(bool)));
+    connect(ui->open_rays, SIGNAL(triggered(bool)), this, SLOT(open_rays()));
+
+    angles_dock = new QDockWidget("Распределение выходных углов", this);
+    angles_dock->setObjectName("angles_dock");
+    angles_dock->setWidget(angles_plot);
+    addDockWidget(Qt::BottomDockWidgetArea, angles_dock);
+    angles_dock->hide();
+    ui->menu_3->addAction(angles_dock->toggleViewAction());
+
+    slices_dock = new QDockWidget("Срезы потерь", this);
+    slices_dock->setObjectName("slices_dock");
+    slices_dock->setWidget(slices_plot);
+    addDockWidget(Qt::BottomDockWidgetArea, slices_dock);
+    slices_dock->hide();
+    ui->menu_3->addAction(slices_dock->toggleViewAction());
+
+    curve_dock = new QDockWidget("Кривая", this);
+    curve_dock->setObjectName("curve_dock");
+    curve_dock->setWidget(curve_plot);
+    addDockWidget(Qt::BottomDockWidgetArea, curve_dock);
+    curve_dock->hide();
+    ui->menu_3->addAction(curve_dock->toggleViewAction());
+
+    performance_view->setReadOnly(true);
+    performance_view->setPlainText(performance_text(QJsonObject()));
+    performance_dock = new QDockWidget("Производительность", this);
+    performance_dock->setObjectName("performance_dock");
+    performance_dock->setWidget(performance_view);
+    addDockWidget(Qt::RightDockWidgetArea, performance_dock);
+    performance_dock->hide();
+    ui->menu_3->addAction(performance_dock->toggleViewAction());
     connect(ui->night_mode, SIGNAL(toggled(bool)), this, SLOT(set_colors(bool)));
     connect(ui->big_text, SIGNAL(toggled(bool)), this, SLOT(set_text_size(bool)));
     connect(ui->lens, SIGNAL(toggled(bool)), this, SLOT(set_lens(bool)));
@@ -60,6 +108,11 @@ MainWindow::MainWindow(QWidget *parent)
         ui->focal_length->setEnabled(!auto_focus);
     });
 
+    connect(ui->glass_constant, QOverload<bool>::of(&QAction::triggered), this, [&]() { set_material(Glass()); });
+    connect(ui->glass_n_bk7, QOverload<bool>::of(&QAction::triggered), this, [&]() { set_material(Glass::n_bk7()); });
+    connect(ui->glass_fused_silica, QOverload<bool>::of(&QAction::triggered), this, [&]() { set_material(Glass::fused_silica()); });
+    connect(ui->wavelength, QOverload<qreal>::of(&QDoubleSpinBox::valueChanged), this, [&]() { set_material(glass_material); });
+
     connect(ui->Hamamatsu_G12180_005A, QOverload<bool>::of(&QAction::triggered), this, [&]() {
         ui->aperture->setValue(2.2);
         ui->offset_det->setValue(1.1);
@@ -97,6 +150,12 @@ MainWindow::MainWindow(QWidget *parent)
         ui->defocus->setEnabled(mode != FOCUS_OPTIMISATION && ui->lens->isChecked() && ui->auto_focus->isChecked());
         circle_out->setVisible(mode != PARALLEL_BUNDLE_EXIT);
         ui->detector_parameters->setEnabled(mode != PARALLEL_BUNDLE_EXIT);
+        ui->tolerances->setEnabled(mode == TOLERANCE_ANALYSIS);
+        // The angle scan goes up to the input angle, only the number of its points is set
+        ui->scan->setEnabled(mode == ANGLE_SCAN || mode == PARAMETER_SCAN);
+        ui->scan_parameter->setEnabled(mode == PARAMETER_SCAN);
+        ui->scan_from->setEnabled(mode == PARAMETER_SCAN);
+        ui->scan_to->setEnabled(mode == PARAMETER_SCAN);
     });
 
     ui->height->setMaximum(ui->d_in->value()/2);
@@ -118,6 +177,8 @@ MainWindow::MainWindow(QWidget *parent)
         ui->focal_length->setMaximum(length + 100);
     });
 
+    // The scene holds a few dozen long-living items, so indexing them is not worth its upkeep
+    scene->setItemIndexMethod(QGraphicsScene::NoIndex);
     ui->view->setScene(scene);
     scene->setSceneRect(0,0,ui->view->width()-margin, ui->view->height());
     init_graphics();
@@ -195,9 +256,22 @@ MainWindow::MainWindow(QWidget *parent)
     scene->addItem(origin_label_xoy);
     scene->addItem(origin_label_yoz);
     scene->addItem(polygon);
+    // Beams are drawn above the system's outline
+    beams->setZValue(1);
+    beams_xoy->setZValue(1);
+    density_xoy->setZValue(1);
+    scene->addItem(beams);
+    scene->addItem(beams_xoy);
+    scene->addItem(density_xoy);
 }
 
 MainWindow::~MainWindow() {
+    if (calculation) {
+        calculation->cancel();
+        watcher.waitForFinished();
+        delete calculation;
+    }
+    delete model;
     delete ui;
 }
 
@@ -212,7 +286,11 @@ void MainWindow::resizeEvent(QResizeEvent *event) {
 }
 
 void MainWindow::init_graphics() {
-    init_objects();
+    delete model;
+    model = new Model(current_settings());
+    ui->focal_length->setValue(model->entrance_lens().f());
+    const Tube * cone = model->focon();
+    const Detector& detector = model->photodetector();
 
     qreal x_axis_length = scene->width();
     qreal y_axis_length = scene->height();
@@ -336,6 +414,7 @@ void MainWindow::set_ocular(bool visible) {
 
 void MainWindow::set_glass(bool glass_on) {
     QVector<QPointF> polygon_points = {focon_up->line().p2(), focon_up->line().p1(), focon_down->line().p1(), focon_down->line().p2()};
+    const Cone * cavity = model ? model->cavity_cone() : nullptr;
     if (cavity) {
         QPointF cavity_vertex((cavity->z_k()) * scale, scene->height()/2);
         polygon_points.push_back(cavity_vertex);
@@ -357,70 +436,65 @@ void MainWindow::set_glass(bool glass_on) {
     }
 }
 
-void MainWindow::clear() {
-    for (auto& beam : beams) {
-        delete beam;
-    }
-    beams.clear();
+void MainWindow::set_material(const Glass& material) {
+    glass_material = material;
+    ui->label_material->setText("Стекло: n = " + QString().setNum(material.n(ui->wavelength->value()), 'f', 4)
+                                + (material.is_dispersive() ? ", с дисперсией" : ", без дисперсии"));
+}
 
-    for (auto& beam : beams_xoy) {
-        delete beam;
-    }
-    beams_xoy.clear();
+void MainWindow::clear() {
+    beams->clear();
+    beams_xoy->clear();
+    density_xoy->setPixmap(QPixmap());
+    angles_plot->clear();
+    slices_plot->clear();
+    curve_plot->clear();
 }
 
-void MainWindow::draw(int rotation_angle) {
-    qreal theta = qDegreesToRadians(static_cast<qreal>(rotation_angle));
+void MainWindow::draw() {
+    const auto& points = path;
     for (int i = 0; i < points.size()-1; ++i) {
-        QLineF line = QLineF(points[i].z() * scale, -(-points[i].y()*qCos(theta) + points[i].x()*qSin(theta)) * scale + scene->height()/2,
-                             points[i+1].z() * scale, -(-points[i+1].y()*qCos(theta) + points[i+1].x()*qSin(theta))* scale + scene->height()/2);
-        beams.push_back(new QGraphicsLineItem(line));
-        scene->addItem(beams.back());
-
-        QLineF line_xoy = QLineF(-(points[i].x()*qCos(theta) + points[i].y()*qSin(theta))*scale_xoy + scene->width() - diameter/2 - margin,
-                                 -(points[i].x()*qSin(theta) - points[i].y()*qCos(theta))*scale_xoy + diameter/2 + margin + margin,
-                                 -(points[i+1].x()*qCos(theta) + points[i+1].y()*qSin(theta))*scale_xoy + scene->width() - diameter/2 - margin,
-                                 -(points[i+1].x()*qSin(theta) - points[i+1].y()*qCos(theta))*scale_xoy + diameter/2 + margin + margin);
-        beams_xoy.push_back(new QGraphicsLineItem(line_xoy));
-        scene->addItem(beams_xoy.back());
-
-        set_beam_color(beams[i], single_beam_status);
-        set_beam_color(beams_xoy[i], single_beam_status);
+        beams->add_segment(points[i], points[i+1], beam_color(single_beam_status));
+        beams_xoy->add_segment(points[i], points[i+1], beam_color(single_beam_status));
     }
 }
 
-void MainWindow::draw(const Point& point, BeamStatus status, int rotation_angle) {
+void MainWindow::set_projections(int rotation_angle) {
+    // Rotation around z axis changes the side view's projection,
+    // while the XOY projection is just rotated as a whole around the inset's center
     qreal theta = qDegreesToRadians(static_cast<qreal>(rotation_angle));
-    switch (ui->mode->currentIndex()) {
-        case PARALLEL_BUNDLE: {
-            QLineF line_xoy = QLineF(-(point.x()*qCos(theta) + point.y()*qSin(theta))*scale_xoy + scene->width() - diameter/2 - margin,
-                                     -(point.x()*qSin(theta) - point.y()*qCos(theta))*scale_xoy + diameter/2 + margin + margin,
-                                     -(point.x()*qCos(theta) + point.y()*qSin(theta))*scale_xoy + scene->width() - diameter/2 - margin,
-                                     -(point.x()*qSin(theta) - point.y()*qCos(theta))*scale_xoy + diameter/2 + margin + margin);
-            beams_xoy.push_back(new QGraphicsLineItem(line_xoy));
-            scene->addItem(beams_xoy.back());
-            set_beam_color(beams_xoy.back(), status);
-        } break;
-        case DIVERGENT_BUNDLE: {
-            auto start = starting_point();
-            QLineF line = QLineF(start.z() * scale, -(-start.y()*qCos(theta) + start.x()*qSin(theta)) * scale + scene->height()/2,
-                                 point.z()* scale, -(-point.y()*qCos(theta) + point.x()*qSin(theta))* scale + scene->height()/2);
-            beams.push_back(new QGraphicsLineItem(line));
-            scene->addItem(beams.back());
-            set_beam_color(beams.back(), status);
-        } break;
+    Projection yoz;
+    yoz.xx = 0;
+    yoz.xz = scale;
+    yoz.yx = -qSin(theta) * scale;
+    yoz.yy = qCos(theta) * scale;
+    yoz.dy = scene->height()/2;
+    beams->set_projection(yoz);
+
+    qreal xoy_scale = ui->mode->currentIndex() == PARALLEL_BUNDLE_EXIT ? scale_exit_xoy : scale_xoy;
+    // The spot diagram fills the whole inset
+    if (ui->mode->currentIndex() == SPOT_DIAGRAM && density_radius > 0) {
+        xoy_scale = diameter / (2 * density_radius);
+    }
+    QPointF center = QPointF(scene->width() - diameter/2 - margin, diameter/2 + margin + margin);
+    Projection xoy;
+    xoy.xx = -xoy_scale;
+    xoy.yy = xoy_scale;
+    xoy.dx = center.x();
+    xoy.dy = center.y();
+    beams_xoy->set_projection(xoy);
+    beams_xoy->setTransformOriginPoint(center);
+    beams_xoy->setRotation(rotation_angle);
+
+    // The map's pixels are scaled to the inset and rotated around its center as well
+    QPixmap map = density_xoy->pixmap();
+    if (!map.isNull()) {
+        QPointF map_center = QPointF(map.width(), map.height()) / 2;
+        density_xoy->setTransformOriginPoint(map_center);
+        density_xoy->setPos(center - map_center);
+        density_xoy->setScale(2 * density_radius * xoy_scale / map.width());
+        density_xoy->setRotation(rotation_angle);
     }
-}
-
-void MainWindow::draw(const Point& point, qreal beam_angle, int rotation_angle) {
-    qreal theta = qDegreesToRadians(static_cast<qreal>(rotation_angle));
-    QLineF line_xoy = QLineF(-(point.x()*qCos(theta) + point.y()*qSin(theta))*scale_exit_xoy + scene->width() - diameter/2 - margin,
-                             -(point.x()*qSin(theta) - point.y()*qCos(theta))*scale_exit_xoy + diameter/2 + margin + margin,
-                             -(point.x()*qCos(theta) + point.y()*qSin(theta))*scale_exit_xoy + scene->width() - diameter/2 - margin,
-                             -(point.x()*qSin(theta) - point.y()*qCos(theta))*scale_exit_xoy + diameter/2 + margin + margin);
-    beams_xoy.push_back(new QGraphicsLineItem(line_xoy));
-    scene->addItem(beams_xoy.back());
-    set_beam_color(beams_xoy.back(), beam_angle);
 }
 
 void MainWindow::draw_axes(int rotation_angle) {
@@ -435,136 +509,239 @@ void MainWindow::draw_axes(int rotation_angle) {
     y_label_yoz->setPos(y_axis->line().p1() + y_axis_label_offset);
 }
 
-void MainWindow::set_beam_color(QGraphicsLineItem * beam, BeamStatus status) {
-    QPen pen;
+QColor MainWindow::beam_color(BeamStatus status) const {
     switch (status) {
     case REFLECTED:
-        pen.setColor(Qt::red);
-        break;
+        return Qt::red;
     case MISSED:
-        pen.setColor(QColor(255, 165, 0));
-        break;
+        return QColor(255, 165, 0);
     case HIT:
-        pen.setColor(Qt::yellow);
-        break;
+        return Qt::yellow;
     case DETECTED:
-        pen.setColor(Qt::green);
+        return Qt::green;
+    case DEGENERATE_ROOT:
+    case VERTEX_HIT:
+    case NON_TERMINATING:
+        // The path calculated up to the failure
+        return Qt::magenta;
+    default:
         break;
     }
-    beam->setPen(pen);
+    return QColor();
 }
 
-void MainWindow::set_beam_color(QGraphicsLineItem * beam, qreal angle) {
+QColor MainWindow::beam_color(qreal angle) const {
     int hue = 270 - qFloor(qFabs(angle)*3);
-    QPen pen;
-    pen.setColor(QColor::fromHsv(hue, 255, 255));
-    beam->setPen(pen);
+    return QColor::fromHsv(hue, 255, 255);
 }
 
-void MainWindow::rotate(int rotation_angle) {
-    clear();
-    draw_axes(rotation_angle);
-    switch (ui->mode->currentIndex()) {
-    case SINGLE_BEAM_CALCULATION:
-        draw(rotation_angle);
-        break;
-    case PARALLEL_BUNDLE:
-        for (int i = 0; i < points.size(); ++i) {
-            draw(points[i], statuses[i], rotation_angle);
-            if (qFabs(points[i].x()) > 1e-6) {
-                draw(points[i].x_pair(), statuses[i], rotation_angle);
+QImage MainWindow::density_image(const Histogram2D& density) const {
+    // Colours show the mixture of the beams' statuses or their mean exit angle,
+    // opacity shows the number of beams on a logarithmic scale
+    bool angles = density.layers() < DETECTED + 1;
+    QVector<qreal> counts(density.width() * density.height(), 0);
+    qreal max_count = 0;
+    for (int j = 0; j < density.height(); ++j) {
+        for (int i = 0; i < density.width(); ++i) {
+            qreal count = 0;
+            if (angles) {
+                count = density.value(i, j, 0);
+            } else {
+                for (int status = REFLECTED; status <= DETECTED; ++status) {
+                    count += density.value(i, j, status);
+                }
             }
+            counts[j * density.width() + i] = count;
+            max_count = qMax(max_count, count);
         }
-        break;
-    case PARALLEL_BUNDLE_EXIT:
-        for (int i = 0; i < points.size(); ++i) {
-            draw(points[i], beam_angles[i], rotation_angle);
-            if (qFabs(points[i].x()) > 1e-6) {
-                draw(points[i].x_pair(), beam_angles[i], rotation_angle);
+    }
+
+    QImage image(density.width(), density.height(), QImage::Format_ARGB32);
+    image.fill(Qt::transparent);
+    if (max_count <= 0) return image;
+    for (int j = 0; j < density.height(); ++j) {
+        for (int i = 0; i < density.width(); ++i) {
+            qreal count = counts[j * density.width() + i];
+            if (count <= 0) continue;
+            QColor color;
+            if (angles) {
+                color = beam_color(density.value(i, j, 1) / count);
+            } else {
+                qreal red = 0, green = 0, blue = 0;
+                for (int status = REFLECTED; status <= DETECTED; ++status) {
+                    qreal share = density.value(i, j, status) / count;
+                    QColor status_color = beam_color(static_cast<BeamStatus>(status));
+                    red += share * status_color.redF();
+                    green += share * status_color.greenF();
+                    blue += share * status_color.blueF();
+                }
+                color = QColor::fromRgbF(red, green, blue);
             }
+            color.setAlphaF(0.25 + 0.75 * qLn(1 + count) / qLn(1 + max_count));
+            // x axis of the inset is directed to the left
+            image.setPixel(density.width() - 1 - i, j, color.rgba());
         }
-        break;
-    case DIVERGENT_BUNDLE:
-        for (int i = 0; i < points.size(); ++i) {
-            draw(points[i], statuses[i], rotation_angle);
-        }
-        break;
     }
+    return image;
 }
 
-void MainWindow::show_results(const QPair<int, int>& result) {
-    int beams_passed = result.first;
-    int beams_total = result.second;
-    QString passed = "Принято ";
-    QString beams_of = " лучей из ";
-
-    if ((beams_passed % 100 - beams_passed % 10) != 10) {
-        if (beams_passed % 10 == 1) {
-            passed = "Принят ";
-            beams_of = " луч из ";
-        } else if (beams_passed % 10 > 1 && beams_passed % 10 < 5) {
-            beams_of = " луча из ";
+QString MainWindow::performance_text(const QJsonObject& performance) const {
+    if (performance.isEmpty()) {
+        return "Счётчики производительности доступны в сборке с профилированием (qmake CONFIG+=profiling).";
+    }
+    auto number = [&](const QString& key) { return QString().setNum(static_cast<qint64>(performance.value(key).toDouble())); };
+    QStringList lines;
+    lines << "Рассчитано лучей: " + number("beams")
+          << "Пересечений с конусом: " + number("cone_intersections")
+          << "Пересечений с полостью: " + number("cavity_intersections")
+          << "Неудачных пересечений: " + number("failed_intersections")
+          << "Выходов через торцы без пересечения со стенкой: " + number("escapes")
+          << "Лучей, остановленных русской рулеткой: " + number("roulette_stops");
+    if (performance.value("mean_reflections").isDouble()) {
+        lines << "Среднее количество отражений: " + QString().setNum(performance.value("mean_reflections").toDouble());
+    }
+    // The stages running in the thread pool are summed over the threads
+    QJsonObject stages = performance.value("stage_ms").toObject();
+    lines << "" << "Время этапов, мс:"
+          << "  подготовка: " + QString().setNum(stages.value("setup").toDouble())
+          << "  расчёт: " + QString().setNum(stages.value("trace").toDouble())
+          << "  карты плотности (сумма по потокам): " + QString().setNum(stages.value("density").toDouble())
+          << "  объединение результатов (сумма по потокам): " + QString().setNum(stages.value("merge").toDouble());
+    QJsonArray reflections = performance.value("reflections").toArray();
+    if (!reflections.isEmpty()) {
+        lines << "" << "Лучей по количеству отражений:";
+        for (int i = 0; i < reflections.size(); ++i) {
+            qint64 count = static_cast<qint64>(reflections.at(i).toDouble());
+            if (count == 0) continue;
+            bool last = i == Profile::reflection_bins - 1;
+            lines << "  " + QString().setNum(i) + (last ? " и более: " : ": ") + QString().setNum(count);
         }
     }
+    return lines.join('\n');
+}
 
-    ui->statusbar->showMessage(passed + QString().setNum(beams_passed) + beams_of + QString().setNum(beams_total)
-                               + ". Потери составляют " + QString().setNum(loss(result)) + " дБ.");
+void MainWindow::rotate(int rotation_angle) {
+    draw_axes(rotation_angle);
+    set_projections(rotation_angle);
 }
 
-void MainWindow::show_results(const QPair<int, qreal>& result) {
-    switch (ui->mode->currentIndex()) {
-    case LENGTH_OPTIMISATION:
-        if (result.first != length_limit || qFabs(result.second - loss_limit) > 1e-6) {
-            ui->statusbar->showMessage("Оптимальная длина фокона составляет " + QString().setNum(result.first)
-                                       + " мм. Потери составляют " + QString().setNum(result.second) + " дБ.");
-        } else {
-            ui->statusbar->showMessage("Оптимального значения длины в пределах до " + QString().setNum(length_limit)
-                                       + " мм не найдено: потери для боковых пучков превышают "
-                                       + QString().setNum(loss_limit) + " дБ. Попробуйте уменьшить входной угол пучка или увеличить допуск потерь.");
-        }
-        break;
-    case FOCUS_OPTIMISATION:
-        if (result.first > 0) {
-            ui->statusbar->showMessage("Оптимальное фокусное расстояние составляет " + QString().setNum(result.first)
-                                           + " мм. Потери составляют " + QString().setNum(result.second) + " дБ.");
+void MainWindow::build() {
+    if (calculation) return;
+    clear();
+    path.clear();
+    init_graphics();
+    set_projections(ui->rotation->value());
+    int mode = ui->mode->currentIndex();
+    if (mode >= PARALLEL_BUNDLE && mode <= DIVERGENT_BUNDLE) {
+        draw_axes(ui->rotation->value());
+    }
+
+    calculation = new Model(current_settings());
+    connect(calculation, &Model::beams_calculated, this, &MainWindow::add_beams);
+    connect(calculation, &Model::progress, this, &MainWindow::show_progress);
+    connect(calculation, &Model::density_calculated, this, &MainWindow::show_density);
+    ui->calc->setEnabled(false);
+    ui->mode->setEnabled(false);
+    ui->rotation->setEnabled(false);
+    ui->cancel->setEnabled(true);
+    ui->statusbar->showMessage("Выполняется расчёт...");
+    if (ui->record_rays->isChecked()) {
+        QString error;
+        recorder.reset(new RayRecorder());
+        if (recorder->open(rays_path, error)) {
+            calculation->set_recorder(recorder.get());
         } else {
-            ui->statusbar->showMessage("Оптимального значения фокусного расстояния не найдено: потери для боковых пучков превышают "
-                                       + QString().setNum(loss_limit) + " дБ. Попробуйте уменьшить входной угол пучка или увеличить допуск потерь.");
+            recorder.reset();
+            ui->statusbar->showMessage(error + ". Расчёт выполняется без записи лучей.");
         }
-        break;
-    default:
-        break;
     }
+    watcher.setFuture(QtConcurrent::run(calculation, &Model::run));
 }
 
-void MainWindow::show_results(const QPair<qreal, qreal>& result) {
-    if (result.first > 0) {
-        ui->statusbar->showMessage("Оптимальный диаметр выходного окна оставляет " + QString().setNum(result.first)
-                                               + " мм. Потери составляют " + QString().setNum(result.second) + " дБ.");
-    } else {
-        ui->statusbar->showMessage("Оптимального значения диаметра выходного окна не найдено: потери для боковых пучков превышают "
-                                   + QString().setNum(loss_limit) + " дБ. Попробуйте уменьшить входной угол пучка или увеличить допуск потерь.");
+void MainWindow::cancel() {
+    if (calculation) {
+        calculation->cancel();
+        ui->cancel->setEnabled(false);
     }
 }
 
-void MainWindow::show_results(const MainWindow::Parameters& result) {
-    if (result.length > 0) {
-        if (result.focus > 0) {
-            ui->statusbar->showMessage("Оптимальные параметры: длина = " + QString().setNum(result.length)
-                                       + " мм, выходной диаметр = " + QString().setNum(result.d_out)
-                                       + " мм, фокусное расстояние = " + QString().setNum(result.focus)
-                                       + " мм. Потери составляют " + QString().setNum(result.loss) + " дБ.");
-        } else {
-            ui->statusbar->showMessage("Оптимальные параметры: длина = " + QString().setNum(result.length)
-                                       + " мм, выходной диаметр = " + QString().setNum(result.d_out)
-                                       + " мм. Потери составляют " + QString().setNum(result.loss) + " дБ.");
-        }
-    } else {
-        ui->statusbar->showMessage("Оптимальной комбинации параметров не найдено: потери для боковых пучков превышают "
-                                   + QString().setNum(loss_limit) + " дБ. Попробуйте уменьшить входной угол пучка или увеличить допуск потерь.");
+void MainWindow::add_beams(const QVector<BeamRecord>& new_records) {
+    // Divergent beams arrive in batches so that the interface stays responsive
+    for (const auto& record : new_records) {
+        beams->add_segment(model->starting_point(), record.point, beam_color(record.status));
+    }
+}
+
+void MainWindow::show_density(const Histogram2D& density) {
+    // The whole map is a single image whatever the number of beams
+    density_radius = density.x_high();
+    density_xoy->setPixmap(QPixmap::fromImage(density_image(density)));
+    set_projections(ui->rotation->value());
+}
+
+void MainWindow::show_progress(const Progress& progress) {
+    QString message = "Рассчитано лучей: " + QString().setNum(progress.beams);
+    if (progress.candidates > 0) {
+        message += ", вариантов: " + QString().setNum(progress.candidates);
+    }
+    message += ". Выполнено " + QString().setNum(qRound(progress.done * 100)) + "%";
+    if (progress.eta >= 0) {
+        message += ", осталось около " + QString().setNum(qCeil(progress.eta / 1000.0)) + " с";
     }
+    message += ".";
+    if (progress.counts.first > 0) {
+        message += " Текущие потери: " + QString().setNum(Model::loss(progress.counts.first, progress.counts.second)) + " дБ.";
+    } else if (progress.best.length > 0 || progress.best.d_out > 0 || progress.best.focus > 0) {
+        message += " Лучший результат: " + QString().setNum(progress.best.loss) + " дБ.";
+    }
+    ui->statusbar->showMessage(message);
 }
 
-void MainWindow::show_results(qreal result) {
-    ui->statusbar->showMessage("Средний выходной угол = " + QString().setNum(result) + " градусов.");
+void MainWindow::finish_calculation() {
+    Model::Result result = watcher.result();
+    if (recorder) {
+        bool saved = recorder->close();
+        result.message += saved
+                ? " Записано лучей: " + QString().setNum(recorder->count()) + " в файл " + recorder->path() + "."
+                : " Не удалось записать лучи в файл " + recorder->path() + ".";
+        recorder.reset();
+    }
+    ui->statusbar->showMessage(result.message);
+    if (ui->mode->currentIndex() == SINGLE_BEAM_CALCULATION) {
+        path = result.path;
+        single_beam_status = result.status;
+        draw();
+    }
+    if (!result.density.is_empty()) {
+        show_density(result.density);
+    }
+    spot = result.spot;
+    ui->save_spot->setEnabled(!spot.is_empty());
+    angles_plot->set_distribution(result.exit_angles);
+    slices_plot->set_slices(result.slices);
+    if (!result.slices.isEmpty()) slices_dock->show();
+    curve = result.curve;
+    ui->save_curve->setEnabled(!curve.is_empty());
+    curve_plot->set_curve(curve);
+    if (!curve.is_empty()) curve_dock->show();
+    if (result.exit_angles.count > 0 && !angles_dock_shown) {
+        angles_dock->show();
+        angles_dock_shown = true;
+    }
+    // The beams whose path could not be calculated are listed with the counters for diagnostics
+    QString diagnostics = performance_text(result.performance);
+    if (!result.failure_samples.isEmpty()) {
+        diagnostics += "\n\nЛучи, ход которых не удалось рассчитать (" + QString().setNum(result.failures) + "), примеры:";
+        for (const auto& failure : result.failure_samples) {
+            diagnostics += "\n  x = " + QString().setNum(-failure.beam.x()) + ", y = " + QString().setNum(-failure.beam.y())
+                    + ", входной угол = " + QString().setNum(failure.beam.gamma()) + ": " + Model::failure_name(failure.status);
+        }
+    }
+    performance_view->setPlainText(diagnostics);
+    ui->calc->setEnabled(true);
+    ui->mode->setEnabled(true);
+    ui->cancel->setEnabled(false);
+    ui->rotation->setEnabled(ui->mode->currentIndex() < EXHAUSTIVE_SAMPLING);
+    calculation->deleteLater();
+    calculation = nullptr;
 }
@@ -0,0 +1,43 @@
+#include "..\include\profiler.h"
+#include <QJsonArray>
+
+void Profile::merge(const Profile& other) {
+    for (int i = 0; i < PROFILE_COUNTERS; ++i) {
+        counters[i] += other.counters[i];
+    }
+    for (int i = 0; i < reflection_bins; ++i) {
+        reflections[i] += other.reflections[i];
+    }
+    for (int i = 0; i < PROFILE_STAGES; ++i) {
+        stages[i] += other.stages[i];
+    }
+}
+
+QJsonObject Profile::to_json() const {
+    // The histogram is cut after its last non-empty bin
+    int used_bins = reflection_bins;
+    while (used_bins > 0 && reflections[used_bins - 1] == 0) --used_bins;
+    QJsonArray stored_reflections;
+    qint64 beams = 0, sum = 0;
+    for (int i = 0; i < used_bins; ++i) {
+        stored_reflections.append(static_cast<double>(reflections[i]));
+        beams += reflections[i];
+        sum += i * reflections[i];
+    }
+    return {
+             {"beams", static_cast<double>(counters[PROFILE_BEAMS])},
+             {"cone_intersections", static_cast<double>(counters[PROFILE_CONE_INTERSECTIONS])},
+             {"cavity_intersections", static_cast<double>(counters[PROFILE_CAVITY_INTERSECTIONS])},
+             {"failed_intersections", static_cast<double>(counters[PROFILE_FAILED_INTERSECTIONS])},
+             {"escapes", static_cast<double>(counters[PROFILE_ESCAPES])},
+             {"roulette_stops", static_cast<double>(counters[PROFILE_ROULETTE_STOPS])},
+             {"reflections", stored_reflections},
+             {"mean_reflections", beams > 0 ? QJsonValue(static_cast<qreal>(sum) / beams) : QJsonValue()},
+             {"stage_ms", QJsonObject({
+                  {"setup", stages[STAGE_SETUP] / 1e6},
+                  {"trace", stages[STAGE_TRACE] / 1e6},
+                  {"density", stages[STAGE_DENSITY] / 1e6},
+                  {"merge", stages[STAGE_MERGE] / 1e6}
+              })}
+           };
+}
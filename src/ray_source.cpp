@@ -0,0 +1,123 @@
+#include "..\include\ray_source.h"
+#include <QFileInfo>
+#include <QtConcurrent>
+#include <cstring>
+
+bool RaySource::open(const QString& path, QString& error) {
+    close();
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        error = "Не удалось открыть файл лучей " + path;
+        return false;
+    }
+    QByteArray magic = file.peek(8);
+    QString suffix = QFileInfo(path).suffix().toLower();
+    if (magic == QByteArray(RayFileHeader::magic, 8)) {
+        file_format = RAY_FILE;
+        file.close();
+        if (!ray_file.open(path, error)) return false;
+        ray_count = ray_file.size();
+    } else {
+        file_format = suffix == "csv" || suffix == "txt" ? TEXT : BINARY;
+        data_size = file.size();
+        if (file_format == BINARY && data_size % binary_record_size != 0) {
+            error = "Размер файла лучей " + path + " не кратен размеру записи (" + QString().setNum(binary_record_size) + " байт)";
+            close();
+            return false;
+        }
+        // Empty files cannot be mapped
+        if (data_size > 0) {
+            data = file.map(0, data_size);
+            if (!data) {
+                error = "Не удалось отобразить файл лучей " + path + " в память";
+                close();
+                return false;
+            }
+        }
+        if (file_format == BINARY) ray_count = data_size / binary_record_size;
+    }
+
+    if (file_format != TEXT) {
+        // Chunks of the binary formats are ranges of records of the same size as in the Monte Carlo method
+        chunk_size = qMax<qint64>(1000, ray_count / 4096);
+        for (qint64 first = 0; first < ray_count; first += chunk_size) {
+            chunk_firsts.push_back(first);
+        }
+        chunk_firsts.push_back(ray_count);
+        return true;
+    }
+
+    // A text file is split into byte ranges at line breaks, the ranges' rays are counted concurrently
+    const char * text = reinterpret_cast<const char *>(data);
+    qint64 part_size = qMax<qint64>(1 << 20, data_size / 4096);
+    chunk_offsets.push_back(0);
+    for (qint64 offset = part_size; offset < data_size; offset += part_size) {
+        const char * line_end = static_cast<const char *>(memchr(text + offset, '\n', data_size - offset));
+        if (!line_end) break;
+        offset = line_end + 1 - text;
+        if (offset < data_size) chunk_offsets.push_back(offset);
+    }
+    chunk_offsets.push_back(data_size);
+
+    QVector<qint64> counts(chunk_offsets.size() - 1, 0);
+    QVector<int> chunks(counts.size());
+    for (int i = 0; i < chunks.size(); ++i) {
+        chunks[i] = i;
+    }
+    qint64 * count_data = counts.data();
+    QtConcurrent::blockingMap(chunks, [&](int chunk) {
+        const char * end = text + chunk_offsets[chunk + 1];
+        for (const char * line = text + chunk_offsets[chunk]; line < end;) {
+            const char * line_end = static_cast<const char *>(memchr(line, '\n', end - line));
+            if (!line_end) line_end = end;
+            if (is_ray_line(line, line_end)) ++count_data[chunk];
+            line = line_end + 1;
+        }
+    });
+    chunk_firsts.push_back(0);
+    for (const auto& count : counts) {
+        chunk_firsts.push_back(chunk_firsts.last() + count);
+    }
+    ray_count = chunk_firsts.last();
+    return true;
+}
+
+void RaySource::close() {
+    ray_file.close();
+    if (data) {
+        file.unmap(const_cast<uchar *>(data));
+        data = nullptr;
+    }
+    if (file.isOpen()) file.close();
+    data_size = 0;
+    ray_count = 0;
+    chunk_offsets.clear();
+    chunk_firsts.clear();
+}
+
+bool RaySource::is_ray_line(const char * begin, const char * end) {
+    // Headers and comments start with anything but a number
+    while (begin < end && (*begin == ' ' || *begin == '\t')) ++begin;
+    return begin < end && (std::strchr("+-.0123456789", *begin) != nullptr && *begin != '\0');
+}
+
+bool RaySource::parse_line(const char * begin, const char * end, Beam& ray) {
+    qreal values[5];
+    int count = 0;
+    const char * token = begin;
+    for (const char * p = begin; p <= end; ++p) {
+        if (p == end || *p == ',' || *p == ';' || *p == ' ' || *p == '\t' || *p == '\r') {
+            if (p > token) {
+                if (count == 5) return false;
+                bool ok = false;
+                values[count++] = QByteArray::fromRawData(token, p - token).toDouble(&ok);
+                // The conversion accepts nan and inf, they are rejected as in the binary files
+                if (!ok || !qIsFinite(values[count - 1])) return false;
+            }
+            token = p + 1;
+        }
+    }
+    if (count != 5 || values[4] <= 0) return false;
+    ray = Beam(Point(values[0], values[1], 0), values[2], values[3], values[4]);
+    return true;
+}
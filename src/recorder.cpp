@@ -0,0 +1,152 @@
+#include "..\include\recorder.h"
+#include "..\include\statistics.h"
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QSysInfo>
+#include <thread>
+#include <functional>
+#include <cstddef>
+#include <cstring>
+
+constexpr char RayFileHeader::magic[9];
+constexpr quint32 RayFileHeader::version;
+constexpr quint32 RayFileHeader::first_readable_version;
+constexpr int RayFileHeader::alignment;
+
+QJsonObject RayFileHeader::schema() {
+    QJsonArray fields;
+    auto add_field = [&](const QString& name, const QString& type, std::size_t offset) {
+        fields.append(QJsonObject({{"Name", name}, {"Type", type}, {"Offset", static_cast<int>(offset)}}));
+    };
+    add_field("entry_x", "f8", offsetof(RayRecord, entry_x));
+    add_field("entry_y", "f8", offsetof(RayRecord, entry_y));
+    add_field("entry_dx", "f8", offsetof(RayRecord, entry_dx));
+    add_field("entry_dy", "f8", offsetof(RayRecord, entry_dy));
+    add_field("entry_dz", "f8", offsetof(RayRecord, entry_dz));
+    add_field("exit_x", "f8", offsetof(RayRecord, exit_x));
+    add_field("exit_y", "f8", offsetof(RayRecord, exit_y));
+    add_field("exit_z", "f8", offsetof(RayRecord, exit_z));
+    add_field("exit_dx", "f8", offsetof(RayRecord, exit_dx));
+    add_field("exit_dy", "f8", offsetof(RayRecord, exit_dy));
+    add_field("exit_dz", "f8", offsetof(RayRecord, exit_dz));
+    add_field("reflections", "u4", offsetof(RayRecord, reflections));
+    add_field("status", "u1", offsetof(RayRecord, status));
+    // The names are listed in the order of BeamStatus, so that the status codes index them
+    static_assert(BEAM_STATUSES == 7, "The status names must match BeamStatus");
+    return {
+             {"Version", static_cast<int>(version)},
+             {"Record size", static_cast<int>(sizeof(RayRecord))},
+             {"Byte order", QSysInfo::ByteOrder == QSysInfo::LittleEndian ? "little" : "big"},
+             {"Fields", fields},
+             {"Statuses", QJsonArray({"reflected", "missed", "hit", "detected", "degenerate_root", "vertex_hit", "non_terminating"})}
+           };
+}
+
+bool RayRecorder::open(const QString& path, QString& error) {
+    close();
+    file.setFileName(path);
+    // The stripes are the buffers, so the file's own buffering would only add a copy
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) {
+        error = "Не удалось открыть файл " + path;
+        return false;
+    }
+    QByteArray schema = QJsonDocument(RayFileHeader::schema()).toJson(QJsonDocument::Compact);
+    quint32 header_size = 8 + 4 * sizeof(quint32) + schema.size();
+    header_size = (header_size + RayFileHeader::alignment - 1) / RayFileHeader::alignment * RayFileHeader::alignment;
+
+    QByteArray header(RayFileHeader::magic, 8);
+    for (quint32 value : {RayFileHeader::version, header_size, static_cast<quint32>(sizeof(RayRecord)), static_cast<quint32>(schema.size())}) {
+        header.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+    header.append(schema);
+    header.append(QByteArray(header_size - header.size(), '\0'));
+    if (file.write(header) != header.size()) {
+        error = "Не удалось записать файл " + path;
+        file.close();
+        return false;
+    }
+    written = 0;
+    failed = false;
+    return true;
+}
+
+void RayRecorder::add(const RayRecord& record) {
+    // Every thread sticks to its own stripe, so the stripes' locks are almost never contended
+    Stripe& stripe = stripes[std::hash<std::thread::id>()(std::this_thread::get_id()) % stripe_count];
+    QMutexLocker locker(&stripe.mutex);
+    if (stripe.buffer.capacity() < buffer_size) {
+        stripe.buffer.reserve(buffer_size);
+    }
+    stripe.buffer.push_back(record);
+    if (stripe.buffer.size() >= buffer_size) {
+        flush(stripe);
+    }
+}
+
+void RayRecorder::flush(Stripe& stripe) {
+    if (stripe.buffer.isEmpty()) return;
+    QMutexLocker locker(&file_mutex);
+    qint64 bytes = stripe.buffer.size() * static_cast<qint64>(sizeof(RayRecord));
+    if (file.isOpen() && file.write(reinterpret_cast<const char *>(stripe.buffer.constData()), bytes) == bytes) {
+        written += stripe.buffer.size();
+    } else failed = true;
+    stripe.buffer.resize(0);
+}
+
+bool RayRecorder::close() {
+    if (!file.isOpen()) return !failed;
+    for (auto& stripe : stripes) {
+        QMutexLocker locker(&stripe.mutex);
+        flush(stripe);
+        stripe.buffer.squeeze();
+    }
+    file.close();
+    return !failed;
+}
+
+bool RayFile::open(const QString& path, QString& error) {
+    close();
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        error = "Не удалось открыть файл " + path;
+        return false;
+    }
+    QByteArray header = file.read(8 + 4 * sizeof(quint32));
+    quint32 values[4] = {0, 0, 0, 0};
+    if (header.size() == 8 + 4 * static_cast<int>(sizeof(quint32))) {
+        std::memcpy(values, header.constData() + 8, sizeof(values));
+    }
+    // The header must hold the schema and keep the records aligned, or they would overlap it or be read misaligned
+    const qint64 header_minimum = 8 + 4 * static_cast<qint64>(sizeof(quint32)) + values[3];
+    if (!header.startsWith(QByteArray(RayFileHeader::magic, 8)) || values[0] < RayFileHeader::first_readable_version
+            || values[0] > RayFileHeader::version || values[2] != sizeof(RayRecord) || values[1] > file.size()
+            || values[1] < header_minimum || values[1] % RayFileHeader::alignment != 0) {
+        error = "Файл " + path + " не является файлом лучей этой версии программы";
+        close();
+        return false;
+    }
+    header_size = values[1];
+    file_schema = QJsonDocument::fromJson(file.read(values[3])).object();
+    record_count = (file.size() - header_size) / static_cast<qint64>(sizeof(RayRecord));
+    // Empty files cannot be mapped
+    if (record_count > 0) {
+        data = file.map(0, header_size + record_count * static_cast<qint64>(sizeof(RayRecord)));
+        if (!data) {
+            error = "Не удалось отобразить файл " + path + " в память";
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void RayFile::close() {
+    if (data) {
+        file.unmap(data);
+        data = nullptr;
+    }
+    if (file.isOpen()) file.close();
+    header_size = 0;
+    record_count = 0;
+    file_schema = QJsonObject();
+}
@@ -0,0 +1,108 @@
+#include "..\include\shard.h"
+#include <QStringList>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QSaveFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+bool Shard::parse(const QString& text, Shard& shard) {
+    QStringList parts = text.split('/');
+    if (parts.size() != 2) return false;
+    bool index_ok = false, count_ok = false;
+    int index = parts[0].toInt(&index_ok);
+    int count = parts[1].toInt(&count_ok);
+    if (!index_ok || !count_ok || count < 1 || index < 0 || index >= count) return false;
+    shard = Shard(index, count);
+    return true;
+}
+
+bool ShardResult::save(const QString& path) const {
+    QJsonObject json_file = {
+                              {"Fingerprint", fingerprint},
+                              {"Mode", mode},
+                              {"Shard", shard.index},
+                              {"Shards", shard.count},
+                              {"Planned", static_cast<double>(planned)},
+                              {"Done", static_cast<double>(done)},
+                              {"Elapsed", static_cast<double>(elapsed)},
+                              {"Statistics", statistics.to_json()}
+                            };
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) return false;
+    file.write(QJsonDocument(json_file).toJson(QJsonDocument::Compact));
+    return file.commit();
+}
+
+bool ShardResult::load(const QString& path, ShardResult& result, QString& error) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        error = "Не удалось открыть файл " + path;
+        return false;
+    }
+    QJsonObject json_file = QJsonDocument::fromJson(file.readAll()).object();
+    file.close();
+    if (!json_file.contains("Statistics")) {
+        error = "Файл " + path + " не содержит результатов расчёта";
+        return false;
+    }
+    result.fingerprint = json_file.value("Fingerprint").toString();
+    result.mode = json_file.value("Mode").toInt();
+    result.shard = Shard(json_file.value("Shard").toInt(), json_file.value("Shards").toInt(1));
+    if (result.shard.count < 1 || result.shard.index < 0 || result.shard.index >= result.shard.count) {
+        error = "Файл " + path + " содержит некорректный номер части";
+        return false;
+    }
+    result.planned = static_cast<qint64>(json_file.value("Planned").toDouble());
+    result.done = static_cast<qint64>(json_file.value("Done").toDouble());
+    result.elapsed = static_cast<qint64>(json_file.value("Elapsed").toDouble());
+    result.statistics = SamplingStatistics::from_json(json_file.value("Statistics").toObject());
+    return true;
+}
+
+bool ShardResult::merge(const QVector<ShardResult>& shards, ShardResult& merged, QString& error) {
+    if (shards.isEmpty()) {
+        error = "Нет результатов для объединения";
+        return false;
+    }
+    const ShardResult& first = shards.first();
+    merged = ShardResult();
+    merged.fingerprint = first.fingerprint;
+    merged.mode = first.mode;
+    merged.shard = Shard(0, 1);
+    QVector<bool> present(first.shard.count, false);
+    for (const auto& result : shards) {
+        // Only the parts of one and the same run can be merged
+        if (result.fingerprint != first.fingerprint || result.mode != first.mode || result.shard.count != first.shard.count) {
+            error = "Части рассчитаны с разными настройками";
+            return false;
+        }
+        if (present[result.shard.index]) {
+            error = "Часть " + result.shard.to_string() + " встречается повторно";
+            return false;
+        }
+        present[result.shard.index] = true;
+        if (!merged.statistics.merge(result.statistics)) {
+            error = "Гистограммы частей несовместимы";
+            return false;
+        }
+        merged.planned += result.planned;
+        merged.done += result.done;
+        merged.elapsed += result.elapsed;
+    }
+    QStringList missing;
+    for (int i = 0; i < present.size(); ++i) {
+        if (!present[i]) missing << Shard(i, present.size()).to_string();
+    }
+    if (!missing.isEmpty()) {
+        error = "Отсутствуют части: " + missing.join(", ");
+        return false;
+    }
+    return true;
+}
+
+QString ShardResult::path_for(const QString& settings_path, const Shard& shard) {
+    QFileInfo info(settings_path);
+    return info.dir().filePath(QString("%1.%2of%3.shard").arg(info.completeBaseName()).arg(shard.index).arg(shard.count));
+}
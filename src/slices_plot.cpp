@@ -0,0 +1,75 @@
+#include "..\include\slices_plot.h"
+#include <QtMath>
+
+void SlicesPlot::set_slices(const QVector<LossSlice>& new_slices) {
+    slices = new_slices;
+    update();
+}
+
+void SlicesPlot::paintEvent(QPaintEvent * event) {
+    Q_UNUSED(event);
+    QPainter painter(this);
+    painter.fillRect(rect(), palette().base());
+    painter.setPen(palette().text().color());
+    if (slices.isEmpty()) {
+        painter.drawText(rect(), Qt::AlignCenter, "Нет данных");
+        return;
+    }
+
+    // Blue is the lowest loss of all the slices, red is the highest one. Grey cells passed no beams
+    qreal low = 0, high = 0;
+    bool found = false;
+    for (const auto& slice : slices) {
+        const Histogram2D& losses = slice.losses;
+        for (int j = 0; j < losses.height(); ++j) {
+            for (int i = 0; i < losses.width(); ++i) {
+                qreal value = losses.value(i, j, 0);
+                if (!qIsFinite(value)) continue;
+                low = found ? qMin(low, value) : value;
+                high = found ? qMax(high, value) : value;
+                found = true;
+            }
+        }
+    }
+    const QFontMetrics metrics = fontMetrics();
+    painter.drawText(QRect(0, 0, width(), metrics.height() + 4), Qt::AlignCenter,
+                     "Потери: от " + QString().setNum(low, 'f', 2) + " (синий) до " + QString().setNum(high, 'f', 2) + " дБ (красный)");
+
+    // The maps are laid out in a row, wrapping if they are too narrow
+    int columns = qMax(1, qMin(slices.size(), width() / 120));
+    int rows = (slices.size() + columns - 1) / columns;
+    qreal cell_width = static_cast<qreal>(width()) / columns;
+    qreal cell_height = static_cast<qreal>(height() - metrics.height() - 8) / rows;
+    for (int k = 0; k < slices.size(); ++k) {
+        const LossSlice& slice = slices[k];
+        const Histogram2D& losses = slice.losses;
+        QRectF cell(k % columns * cell_width, metrics.height() + 8 + k / columns * cell_height, cell_width, cell_height);
+        painter.setPen(palette().text().color());
+        painter.drawText(QRectF(cell.left(), cell.top(), cell.width(), metrics.height()), Qt::AlignCenter,
+                         Model::parameter_name(slice.x_parameter) + " × " + Model::parameter_name(slice.y_parameter));
+        qreal side = qMin(cell.width() - 10, cell.height() - metrics.height() - 6);
+        if (side <= 0) continue;
+        QRectF map(cell.center().x() - side / 2, cell.top() + metrics.height() + 2, side, side);
+        qreal pixel_width = side / losses.width(), pixel_height = side / losses.height();
+        painter.setPen(Qt::NoPen);
+        for (int j = 0; j < losses.height(); ++j) {
+            for (int i = 0; i < losses.width(); ++i) {
+                qreal value = losses.value(i, j, 0);
+                QColor color = Qt::gray;
+                if (qIsFinite(value)) {
+                    qreal share = high > low ? (value - low) / (high - low) : 0;
+                    color = QColor::fromHsv(qRound(240 * (1 - share)), 255, 255);
+                }
+                // The y deviation grows upwards
+                painter.setBrush(color);
+                painter.drawRect(QRectF(map.left() + i * pixel_width, map.bottom() - (j + 1) * pixel_height, pixel_width, pixel_height));
+            }
+        }
+        // The current design is in the centre
+        painter.setPen(palette().text().color());
+        painter.setBrush(Qt::NoBrush);
+        painter.drawRect(map);
+        painter.drawRect(QRectF(map.left() + losses.width() / 2 * pixel_width, map.bottom() - (losses.height() / 2 + 1) * pixel_height,
+                                pixel_width, pixel_height));
+    }
+}
@@ -0,0 +1,366 @@
+#include "..\include\statistics.h"
+#include <QJsonArray>
+
+void Histogram::add(qreal value, qint64 weight) {
+    // NaN passes both range checks and would be cast to an out-of-range bin
+    if (bins.isEmpty() || !qIsFinite(value)) return;
+    if (value < low) {
+        underflow += weight;
+    } else if (value >= high) {
+        overflow += weight;
+    } else {
+        int i = qMin(static_cast<int>((value - low) / bin_width()), bins.size() - 1);
+        bins[i] += weight;
+    }
+}
+
+bool Histogram::merge(const Histogram& other) {
+    // Histograms with different binnings cannot be summed
+    if (other.bins.size() != bins.size() || other.low != low || other.high != high) return false;
+    for (int i = 0; i < bins.size(); ++i) {
+        bins[i] += other.bins[i];
+    }
+    underflow += other.underflow;
+    overflow += other.overflow;
+    return true;
+}
+
+qint64 Histogram::total() const {
+    qint64 result = underflow + overflow;
+    for (const auto& bin : bins) {
+        result += bin;
+    }
+    return result;
+}
+
+qreal Histogram::quantile(qreal q) const {
+    // Linear interpolation within the bin, the values beyond the range are taken as its bounds
+    qint64 count = total();
+    if (count == 0 || bins.isEmpty()) return low;
+    qreal target = q * count;
+    qreal cumulative = underflow;
+    if (target <= cumulative) return low;
+    for (int i = 0; i < bins.size(); ++i) {
+        if (bins[i] > 0 && cumulative + bins[i] >= target) {
+            return bin_low(i) + (target - cumulative) / bins[i] * bin_width();
+        }
+        cumulative += bins[i];
+    }
+    return high;
+}
+
+QJsonObject Histogram::to_json() const {
+    QJsonArray stored_bins;
+    for (const auto& bin : bins) {
+        stored_bins.append(static_cast<double>(bin));
+    }
+    return {
+             {"Low", low},
+             {"High", high},
+             {"Underflow", static_cast<double>(underflow)},
+             {"Overflow", static_cast<double>(overflow)},
+             {"Bins", stored_bins}
+           };
+}
+
+Histogram Histogram::from_json(const QJsonObject& json_file) {
+    QJsonArray stored_bins = json_file.value("Bins").toArray();
+    Histogram histogram(json_file.value("Low").toDouble(), json_file.value("High").toDouble(), stored_bins.size());
+    for (int i = 0; i < stored_bins.size(); ++i) {
+        histogram.bins[i] = static_cast<qint64>(stored_bins.at(i).toDouble());
+    }
+    histogram.underflow = static_cast<qint64>(json_file.value("Underflow").toDouble());
+    histogram.overflow = static_cast<qint64>(json_file.value("Overflow").toDouble());
+    return histogram;
+}
+
+void Distribution::add(qreal value, qint64 weight) {
+    // A single non-finite value would turn the mean and the deviation into NaN
+    if (weight <= 0 || !qIsFinite(value)) return;
+    if (count == 0) {
+        minimum = maximum = value;
+    } else {
+        minimum = qMin(minimum, value);
+        maximum = qMax(maximum, value);
+    }
+    // Welford's update keeps the variance accurate for any number of values
+    count += weight;
+    qreal delta = value - mean;
+    mean += delta * weight / count;
+    m2 += delta * (value - mean) * weight;
+    histogram.add(value, weight);
+}
+
+bool Distribution::merge(const Distribution& other) {
+    if (!histogram.merge(other.histogram)) return false;
+    if (other.count == 0) return true;
+    if (count == 0) {
+        minimum = other.minimum;
+        maximum = other.maximum;
+    } else {
+        minimum = qMin(minimum, other.minimum);
+        maximum = qMax(maximum, other.maximum);
+    }
+    qint64 total = count + other.count;
+    qreal delta = other.mean - mean;
+    m2 += other.m2 + delta * delta * count * other.count / total;
+    mean += delta * other.count / total;
+    count = total;
+    return true;
+}
+
+QJsonObject Distribution::to_json() const {
+    QJsonObject json_file = histogram.to_json();
+    json_file.insert("Count", static_cast<double>(count));
+    json_file.insert("Mean", mean);
+    json_file.insert("M2", m2);
+    json_file.insert("Minimum", minimum);
+    json_file.insert("Maximum", maximum);
+    return json_file;
+}
+
+Distribution Distribution::from_json(const QJsonObject& json_file) {
+    Distribution distribution;
+    distribution.histogram = Histogram::from_json(json_file);
+    distribution.count = static_cast<qint64>(json_file.value("Count").toDouble());
+    distribution.mean = json_file.value("Mean").toDouble();
+    distribution.m2 = json_file.value("M2").toDouble();
+    distribution.minimum = json_file.value("Minimum").toDouble();
+    distribution.maximum = json_file.value("Maximum").toDouble();
+    return distribution;
+}
+
+void Histogram2D::add(qreal x, qreal y, int layer, qreal weight) {
+    // Points outside of the area and non-finite ones are dropped
+    if (bins.isEmpty() || !qIsFinite(x) || !qIsFinite(y) || !qIsFinite(weight) || x < x_low_ || x >= x_high_ || y < y_low_ || y >= y_high_) return;
+    int i = qMin(static_cast<int>((x - x_low_) / (x_high_ - x_low_) * width_), width_ - 1);
+    int j = qMin(static_cast<int>((y - y_low_) / (y_high_ - y_low_) * height_), height_ - 1);
+    bins[(layer * height_ + j) * width_ + i] += weight;
+}
+
+bool Histogram2D::merge(const Histogram2D& other) {
+    if (other.is_empty()) return true;
+    if (is_empty()) {
+        *this = other;
+        return true;
+    }
+    if (other.width_ != width_ || other.height_ != height_ || other.layers_ != layers_
+            || other.x_low_ != x_low_ || other.x_high_ != x_high_ || other.y_low_ != y_low_ || other.y_high_ != y_high_) return false;
+    for (int k = 0; k < bins.size(); ++k) {
+        bins[k] += other.bins[k];
+    }
+    return true;
+}
+
+SpotDiagram::SpotDiagram(qreal radius, int resolution)
+    : radius(radius)
+    , window_map(-radius, radius, -radius, radius, resolution, resolution, 1)
+    , detector_map(-radius, radius, -radius, radius, resolution, resolution, 2)
+    , window_radii(0, radius, resolution / 2)
+    , detector_radii(0, radius, resolution / 2) {}
+
+void SpotDiagram::add(const Point& window_point, const Point& detector_point, qreal angle) {
+    ++beams;
+    max_angle = qMax(max_angle, angle);
+    window_map.add(window_point.x(), window_point.y(), 0);
+    detector_map.add(detector_point.x(), detector_point.y(), 0);
+    detector_map.add(detector_point.x(), detector_point.y(), 1, angle);
+    window_radii.add(window_point.r());
+    detector_radii.add(detector_point.r());
+    incidence_angles.add(angle);
+}
+
+bool SpotDiagram::merge(const SpotDiagram& other) {
+    if (other.is_empty()) return true;
+    if (is_empty()) {
+        *this = other;
+        return true;
+    }
+    if (!window_map.merge(other.window_map) || !detector_map.merge(other.detector_map)
+            || !window_radii.merge(other.window_radii) || !detector_radii.merge(other.detector_radii)
+            || !incidence_angles.merge(other.incidence_angles)) return false;
+    beams += other.beams;
+    max_angle = qMax(max_angle, other.max_angle);
+    return true;
+}
+
+QString SpotDiagram::to_csv() const {
+    // One table for all the distributions: the one-dimensional ones leave y bounds empty
+    QString csv = "distribution,x_low,x_high,y_low,y_high,beams\n";
+    auto add_histogram = [&](const QString& name, const Histogram& histogram) {
+        for (int i = 0; i < histogram.size(); ++i) {
+            csv += QString("%1,%2,%3,,,%4\n").arg(name).arg(histogram.bin_low(i)).arg(histogram.bin_low(i) + histogram.bin_width()).arg(histogram[i]);
+        }
+    };
+    auto add_map = [&](const QString& name, const Histogram2D& map) {
+        qreal width = (map.x_high() - map.x_low()) / map.width();
+        qreal height = (map.y_high() - map.y_low()) / map.height();
+        for (int j = 0; j < map.height(); ++j) {
+            for (int i = 0; i < map.width(); ++i) {
+                qreal count = map.value(i, j, 0);
+                if (count <= 0) continue;
+                csv += QString("%1,%2,%3,%4,%5,%6\n").arg(name)
+                        .arg(map.x_low() + i * width).arg(map.x_low() + (i + 1) * width)
+                        .arg(map.y_low() + j * height).arg(map.y_low() + (j + 1) * height).arg(count);
+            }
+        }
+    };
+    add_histogram("window_radius", window_radii);
+    add_histogram("detector_radius", detector_radii);
+    add_histogram("incidence_angle", incidence_angles);
+    add_map("window", window_map);
+    add_map("detector", detector_map);
+    return csv;
+}
+
+void SamplingStatistics::add(BeamStatus status, qreal exit_angle, qreal entry_radius, qint64 weight, qreal energy) {
+    total += weight;
+    statuses[status] += weight;
+    // Only the beams that passed the focon have a meaningful exit angle
+    if (status > REFLECTED) {
+        exit_angles.add(exit_angle, weight);
+    }
+    if (status == DETECTED) {
+        passed += weight;
+        detected_energy += weight * energy;
+        squared_energy += weight * energy * energy;
+        detected_radii.add(entry_radius, weight);
+    }
+}
+
+void SamplingStatistics::add_failure(const Beam& beam, BeamStatus status, qint64 weight) {
+    failed += weight;
+    statuses[status] += weight;
+    if (failures.size() < failure_samples_limit) {
+        failures.push_back(BeamFailure(beam, status));
+    }
+}
+
+void SamplingStatistics::add_band(int band, int bands, BeamStatus status, qint64 weight, qreal energy) {
+    if (band_total.size() < bands) {
+        band_passed.resize(bands);
+        band_total.resize(bands);
+        band_energy.resize(bands);
+    }
+    band_total[band] += weight;
+    if (status == DETECTED) {
+        band_passed[band] += weight;
+        band_energy[band] += weight * energy;
+    }
+}
+
+bool SamplingStatistics::merge(const SamplingStatistics& other) {
+    if (!exit_angles.merge(other.exit_angles) || !detected_radii.merge(other.detected_radii)) return false;
+    passed += other.passed;
+    total += other.total;
+    for (int i = 0; i < statuses.size(); ++i) {
+        statuses[i] += other.statuses[i];
+    }
+    failed += other.failed;
+    single_precision += other.single_precision;
+    escalated += other.escalated;
+    detected_energy += other.detected_energy;
+    squared_energy += other.squared_energy;
+    for (int i = 0; i < other.bands(); ++i) {
+        add_band(i, other.bands(), REFLECTED, other.band_total[i]);
+        band_passed[i] += other.band_passed[i];
+        band_energy[i] += other.band_energy[i];
+    }
+    for (const auto& failure : other.failures) {
+        if (failures.size() >= failure_samples_limit) break;
+        failures.push_back(failure);
+    }
+    return true;
+}
+
+qreal SamplingStatistics::loss() const {
+    return 10*qLn(static_cast<qreal>(total)/passed)/qLn(10);
+}
+
+qreal SamplingStatistics::loss_error() const {
+    // Standard error of the loss estimate considering the number of detected beams binomially distributed
+    if (passed == 0 || total == 0) return 0;
+    qreal p = static_cast<qreal>(passed) / total;
+    return 10/qLn(10) * qSqrt((1 - p) / (p * total));
+}
+
+qreal SamplingStatistics::energy_loss() const {
+    return 10*qLn(total/detected_energy)/qLn(10);
+}
+
+qreal SamplingStatistics::energy_loss_error() const {
+    // Standard error of the mean energy per beam, the beams that are not detected carry none
+    if (detected_energy <= 0 || total == 0) return 0;
+    qreal mean = detected_energy / total;
+    return 10/qLn(10) * qSqrt(qMax<qreal>(0, squared_energy / total - mean * mean) / total) / mean;
+}
+
+qreal SamplingStatistics::band_loss(int band, bool energy) const {
+    qreal detected = energy ? band_energy[band] : band_passed[band];
+    return 10*qLn(band_total[band]/detected)/qLn(10);
+}
+
+QJsonObject SamplingStatistics::to_json() const {
+    QJsonArray stored_bands;
+    for (int i = 0; i < bands(); ++i) {
+        stored_bands.append(QJsonArray({static_cast<double>(band_passed[i]), static_cast<double>(band_total[i]), band_energy[i]}));
+    }
+    QJsonArray stored_statuses;
+    for (const auto& count : statuses) {
+        stored_statuses.append(static_cast<double>(count));
+    }
+    QJsonArray stored_failures;
+    for (const auto& failure : failures) {
+        const Beam& beam = failure.beam;
+        stored_failures.append(QJsonArray({beam.x(), beam.y(), beam.d_x(), beam.d_y(), beam.d_z(), failure.status}));
+    }
+    return {
+             {"Passed", static_cast<double>(passed)},
+             {"Total", static_cast<double>(total)},
+             {"Statuses", stored_statuses},
+             {"Failed", static_cast<double>(failed)},
+             {"Failures", stored_failures},
+             {"Single precision", static_cast<double>(single_precision)},
+             {"Escalated", static_cast<double>(escalated)},
+             {"Detected energy", detected_energy},
+             {"Squared energy", squared_energy},
+             {"Bands", stored_bands},
+             {"Exit angles", exit_angles.to_json()},
+             {"Detected radii", detected_radii.to_json()}
+           };
+}
+
+SamplingStatistics SamplingStatistics::from_json(const QJsonObject& json_file) {
+    SamplingStatistics statistics;
+    statistics.passed = static_cast<qint64>(json_file.value("Passed").toDouble());
+    statistics.total = static_cast<qint64>(json_file.value("Total").toDouble());
+    QJsonArray stored_statuses = json_file.value("Statuses").toArray();
+    for (int i = 0; i < qMin(stored_statuses.size(), statistics.statuses.size()); ++i) {
+        statistics.statuses[i] = static_cast<qint64>(stored_statuses.at(i).toDouble());
+    }
+    statistics.failed = static_cast<qint64>(json_file.value("Failed").toDouble());
+    for (const auto& value : json_file.value("Failures").toArray()) {
+        // The files written before the failures were classified have no status
+        QJsonArray beam = value.toArray();
+        int status = beam.at(5).toInt(DEGENERATE_ROOT);
+        statistics.failures.push_back(BeamFailure(Beam(Point(beam.at(0).toDouble(), beam.at(1).toDouble(), 0),
+                                                       beam.at(2).toDouble(), beam.at(3).toDouble(), beam.at(4).toDouble()),
+                                                  is_failure(static_cast<BeamStatus>(status)) && status < BEAM_STATUSES
+                                                  ? static_cast<BeamStatus>(status) : DEGENERATE_ROOT));
+    }
+    statistics.single_precision = static_cast<qint64>(json_file.value("Single precision").toDouble());
+    statistics.escalated = static_cast<qint64>(json_file.value("Escalated").toDouble());
+    // Without the energy mode every detected beam carries all of its energy
+    statistics.detected_energy = json_file.value("Detected energy").toDouble(statistics.passed);
+    statistics.squared_energy = json_file.value("Squared energy").toDouble(statistics.passed);
+    QJsonArray stored_bands = json_file.value("Bands").toArray();
+    for (int i = 0; i < stored_bands.size(); ++i) {
+        QJsonArray band = stored_bands.at(i).toArray();
+        statistics.add_band(i, stored_bands.size(), REFLECTED, static_cast<qint64>(band.at(1).toDouble()));
+        statistics.band_passed[i] = static_cast<qint64>(band.at(0).toDouble());
+        statistics.band_energy[i] = band.at(2).toDouble();
+    }
+    statistics.exit_angles = Distribution::from_json(json_file.value("Exit angles").toObject());
+    statistics.detected_radii = Histogram::from_json(json_file.value("Detected radii").toObject());
+    return statistics;
+}